@@ -0,0 +1,406 @@
+/*
+BENCHMARK (not shipped)
+------------------------
+  - ns, TSC cycles and heap allocations per call of the engine's codec and
+    crypto primitives, over synthetic healthA-style frames:
+      dataset of 2, 8 or 32 elements (booleans and integers alternating),
+      with and without an 802.1Q tag, 16- or 32-byte HMAC tag
+  - goose_decode, goose_extract_meta, strip_last_octet_tag and
+    make_dataset_canon_from_frame run on every frame shape; the canonical
+    blob and hmac_sha256 only depend on the dataset, HKDF on nothing
+  - strip_last_octet_tag works in place, so each of its calls first copies
+    the frame back (the "frame copy" row is that part alone)
+  - Each row is the median of 5 runs, each run long enough for ~10 ms
+  - Allocations are counted by wrapping malloc/calloc/realloc (glibc), so
+    ones made inside libcrypto show up too
+  - -o FILE writes the rows as CSV, -b FILE prints the change against an
+    earlier CSV (same rows, matched by func and variant)
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//Mirror of goose_parse.c's frame descriptor, keep in sync
+typedef struct {
+  uint16_t off;
+  uint16_t len;
+  uint8_t  hdr;
+  uint8_t  tag;
+} Span;
+
+#define GOOSE_MAX_ELEMS 64
+
+typedef struct {
+  uint16_t appId;
+  uint16_t apdu_off;
+  uint32_t stNum;
+  uint32_t sqNum;
+  Span     seq;
+  Span     gocbRef, ttl, datSet, goID, t;
+  Span     st, sq;
+  Span     simulation, confRev, ndsCom, numEntries;
+  Span     all;
+  Span     tag;
+  int      nelem;
+  Span     elem[GOOSE_MAX_ELEMS];
+} GooseFrame;
+
+typedef struct {
+  uint16_t appId;
+  uint32_t stNum;
+  uint32_t sqNum;
+  int      tag_pos;
+  int      tag_len;
+} GooseMeta;
+
+extern int    goose_decode(const uint8_t* frame, size_t flen, GooseFrame* G);
+extern int    goose_extract_meta(const uint8_t* frame, size_t flen, GooseMeta* M);
+extern int    strip_last_octet_tag(uint8_t* frame, size_t* p_flen, const GooseFrame* G,
+                                   int tag_pos, int tag_len);
+extern size_t make_dataset_canon_from_frame(uint8_t *out, size_t out_max,
+                                            const uint8_t* f, const GooseFrame* G);
+extern size_t auth_canon_prefix(uint8_t *out, size_t out_max,
+                                const char* goID, const char* gocbRef, uint16_t appId);
+extern size_t auth_canon_tail(uint8_t *out, size_t out_max,
+                              uint32_t stNum, uint32_t sqNum,
+                              const uint8_t* ds, size_t ds_len);
+extern void   hkdf_sha256_extract(const uint8_t *salt, size_t salt_len,
+                                  const uint8_t *ikm, size_t ikm_len,
+                                  uint8_t *prk, size_t prk_len);
+extern void   hkdf_sha256_expand(const uint8_t *prk, size_t prk_len,
+                                 const uint8_t *info, size_t info_len,
+                                 uint8_t *okm, size_t okm_len);
+extern void   hmac_sha256(const uint8_t *key, size_t key_len,
+                          const uint8_t *data, size_t data_len,
+                          uint8_t *out32);
+
+#define RUNS     5
+#define RUN_NS   10000000ULL
+#define MAX_ROWS 96
+
+static const char*    GOID  = "IEDA/LLN0$GO$healthA";
+static const char*    GOCB  = "IEDA/LLN0$GO$healthA";
+static const uint16_t APPID = 1000;
+static const char*    INFO  = "GOOSE|IEDA/LLN0$GO$healthA|IEDA/LLN0$GO$healthA|1000";
+
+static const int ds_sizes[]  = { 2, 8, 32 };
+static const int tag_sizes[] = { 16, 32 };
+
+//Heap calls made by anything in the process, libcrypto included
+static unsigned long n_alloc;
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t n);
+extern void* __libc_calloc(size_t k, size_t n);
+extern void* __libc_realloc(void* p, size_t n);
+void* malloc(size_t n){ n_alloc++; return __libc_malloc(n); }
+void* calloc(size_t k, size_t n){ n_alloc++; return __libc_calloc(k, n); }
+void* realloc(void* p, size_t n){ n_alloc++; return __libc_realloc(p, n); }
+#define ALLOCS_COUNTED 1
+#else
+#define ALLOCS_COUNTED 0
+#endif
+
+//One frame shape, and what the engine would know about it
+typedef struct {
+  char       name[32];
+  int        nds;
+  uint8_t    frame[1518];
+  size_t     flen;
+  GooseFrame G;
+  uint8_t    ds[256];    //dataset bytes as the publisher canonicalizes them
+  size_t     ds_len;
+} Case;
+
+typedef struct {
+  char   func[40];
+  char   variant[32];
+  double ns, cyc, allocs;
+  unsigned long ops;
+} Row;
+
+static Case     cases[3*2*2];
+static int      ncases;
+static Case*    cur;
+static uint8_t  work[1518];
+static uint8_t  k_device[32], prk[32], okm[32];
+static Row      rows[MAX_ROWS];
+static int      nrows;
+static volatile unsigned sink;
+
+static inline uint64_t ticks(void){
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+static inline uint64_t now_ns(void){
+  struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//--- Synthetic frames, built the way the publisher lays them out ---
+
+static size_t put_tlv(uint8_t* b, size_t w, uint8_t t, const uint8_t* v, size_t L)
+{
+  b[w++] = t;
+  if (L < 128) b[w++] = (uint8_t)L;
+  else if (L < 256) { b[w++] = 0x81; b[w++] = (uint8_t)L; }
+  else { b[w++] = 0x82; b[w++] = (uint8_t)(L>>8); b[w++] = (uint8_t)L; }
+  memcpy(b + w, v, L);
+  return w + L;
+}
+
+//Shortest two's complement form, as BER wants it
+static size_t put_int(uint8_t* b, size_t w, uint8_t t, uint32_t v)
+{
+  uint8_t x[5] = { 0, (uint8_t)(v>>24), (uint8_t)(v>>16), (uint8_t)(v>>8), (uint8_t)v };
+  int s = 1;
+  while (s < 4 && x[s] == 0 && !(x[s+1] & 0x80)) s++;
+  if (x[s] & 0x80) s--;
+  return put_tlv(b, w, t, x + s, (size_t)(5 - s));
+}
+
+static void build_case(Case* c, int nds, bool vlan, int taglen)
+{
+  uint8_t all[512], apdu[1024], mac[32];
+  size_t a = 0, p = 0;
+
+  c->nds = nds; c->ds_len = 0;
+  snprintf(c->name, sizeof(c->name), "ds%d/%s/tag%d", nds, vlan ? "vlan" : "novlan", taglen);
+  for (int i=0;i<nds;i++) {
+    if (i % 2 == 0) {
+      uint8_t b = (uint8_t)(i % 4 == 0);
+      a = put_tlv(all, a, 0x83, &b, 1);
+      c->ds[c->ds_len++] = 0x01; c->ds[c->ds_len++] = 0x01; c->ds[c->ds_len++] = b;
+    } else {
+      uint32_t v = 25u << (i % 24);
+      a = put_int(all, a, 0x85, v);
+      c->ds[c->ds_len++] = 0x02; c->ds[c->ds_len++] = 0x04;
+      c->ds[c->ds_len++] = (uint8_t)(v>>24); c->ds[c->ds_len++] = (uint8_t)(v>>16);
+      c->ds[c->ds_len++] = (uint8_t)(v>>8);  c->ds[c->ds_len++] = (uint8_t)v;
+    }
+  }
+  //The tag's value does not matter to any of the rows
+  for (int i=0;i<32;i++) mac[i] = (uint8_t)(0x5A ^ i);
+  a = put_tlv(all, a, 0x89, mac, (size_t)taglen);
+
+  static const uint8_t t8[8] = { 0x60,0x60,0x60,0x60,0x60,0x60,0x60,0x60 }, z = 0, one = 1;
+  p = put_tlv(apdu, p, 0x80, (const uint8_t*)GOCB, strlen(GOCB));
+  p = put_int(apdu, p, 0x81, 2000);
+  p = put_tlv(apdu, p, 0x82, (const uint8_t*)"IEDA/LLN0$AnalogValues", 22);
+  p = put_tlv(apdu, p, 0x83, (const uint8_t*)GOID, strlen(GOID));
+  p = put_tlv(apdu, p, 0x84, t8, 8);
+  p = put_int(apdu, p, 0x85, 1);
+  p = put_int(apdu, p, 0x86, 42);
+  p = put_tlv(apdu, p, 0x87, &z, 1);
+  p = put_tlv(apdu, p, 0x88, &one, 1);
+  p = put_tlv(apdu, p, 0x89, &z, 1);
+  p = put_int(apdu, p, 0x8A, (uint32_t)nds + 1);
+  p = put_tlv(apdu, p, 0xAB, all, a);
+
+  static const uint8_t eth[12] = { 0x01,0x0c,0xcd,0x01,0x00,0x01, 0x02,0x00,0x00,0x00,0x00,0x01 };
+  uint8_t* f = c->frame;
+  size_t w = 0;
+  memcpy(f, eth, 12); w = 12;
+  if (vlan) { f[w++] = 0x81; f[w++] = 0x00; f[w++] = 0x80; f[w++] = 0x00; }
+  f[w++] = 0x88; f[w++] = 0xb8;
+  size_t hdr = w;
+  w += 8;
+  w = put_tlv(f, w, 0x61, apdu, p);
+  f[hdr]   = (uint8_t)(APPID>>8); f[hdr+1] = (uint8_t)APPID;
+  f[hdr+2] = (uint8_t)((w - hdr)>>8); f[hdr+3] = (uint8_t)(w - hdr);
+  memset(f + hdr + 4, 0, 4);
+  c->flen = w;
+}
+
+//--- Rows ---
+
+static void do_decode(void){
+  GooseFrame G;
+  sink += (unsigned)goose_decode(cur->frame, cur->flen, &G) + G.nelem;
+}
+static void do_extract_meta(void){
+  GooseMeta M;
+  sink += (unsigned)goose_extract_meta(cur->frame, cur->flen, &M) + (unsigned)M.tag_len;
+}
+static void do_copy(void){
+  memcpy(work, cur->frame, cur->flen);
+  sink += work[cur->flen - 1];
+}
+static void do_strip(void){
+  size_t flen = cur->flen;
+  memcpy(work, cur->frame, flen);
+  const Span* t = &cur->G.tag;
+  sink += (unsigned)strip_last_octet_tag(work, &flen, &cur->G, t->off, t->hdr + t->len) + (unsigned)flen;
+}
+static void do_canon_ds(void){
+  uint8_t ds[255];
+  sink += (unsigned)make_dataset_canon_from_frame(ds, sizeof(ds), cur->frame, &cur->G);
+}
+static void do_canon_blob(void){
+  uint8_t blob[512];
+  size_t w = auth_canon_prefix(blob, sizeof(blob), GOID, GOCB, APPID);
+  w += auth_canon_tail(blob + w, sizeof(blob) - w, 1, 42, cur->ds, cur->ds_len);
+  sink += (unsigned)w;
+}
+static uint8_t hblob[512];
+static size_t  hblob_len;
+static void do_hmac(void){
+  uint8_t mac[32];
+  hmac_sha256(okm, sizeof(okm), hblob, hblob_len, mac);
+  sink += mac[0];
+}
+static void do_extract(void){
+  uint8_t k[32];
+  hkdf_sha256_extract(NULL, 0, k_device, sizeof(k_device), k, sizeof(k));
+  sink += k[0];
+}
+static void do_expand(void){
+  uint8_t k[32];
+  hkdf_sha256_expand(prk, sizeof(prk), (const uint8_t*)INFO, strlen(INFO), k, sizeof(k));
+  sink += k[0];
+}
+
+static int cmp_dbl(const void* a, const void* b){
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+//Median of RUNS timed runs, each sized to take about RUN_NS
+static void run(const char* func, const char* variant, void (*fn)(void))
+{
+  unsigned long n = 64;
+  for (;;) {
+    uint64_t t0 = now_ns();
+    for (unsigned long i=0;i<n;i++) fn();
+    if (now_ns() - t0 >= RUN_NS / 4 || n >= (1ul << 28)) break;
+    n *= 2;
+  }
+  n *= 4;
+
+  double ns[RUNS], cyc[RUNS], al[RUNS], sorted[RUNS];
+  for (int r=0;r<RUNS;r++) {
+    unsigned long a0 = n_alloc;
+    uint64_t t0 = now_ns(), c0 = ticks();
+    for (unsigned long i=0;i<n;i++) fn();
+    uint64_t c1 = ticks(), t1 = now_ns();
+    ns[r]  = (double)(t1 - t0) / n;
+    cyc[r] = (double)(c1 - c0) / n;
+    al[r]  = (double)(n_alloc - a0) / n;
+    sorted[r] = ns[r];
+  }
+  qsort(sorted, RUNS, sizeof(double), cmp_dbl);
+  int m = 0;
+  while (ns[m] != sorted[RUNS/2]) m++;
+
+  if (nrows == MAX_ROWS) return;
+  Row* R = &rows[nrows++];
+  snprintf(R->func, sizeof(R->func), "%s", func);
+  snprintf(R->variant, sizeof(R->variant), "%s", variant);
+  R->ns = ns[m]; R->cyc = cyc[m]; R->allocs = ALLOCS_COUNTED ? al[m] : -1; R->ops = n;
+  printf("%-32s %-20s %9.1f ns/op %9.1f cycles/op %6.2f allocs/op\n",
+         func, variant, R->ns, R->cyc, R->allocs);
+}
+
+static int write_csv(const char* path)
+{
+  FILE* f = fopen(path, "w");
+  if (!f) { perror(path); return -1; }
+  fprintf(f, "component,func,variant,ops,ns_op,cycles_op,allocs_op\n");
+  for (int i=0;i<nrows;i++)
+    fprintf(f, "bitw,%s,%s,%lu,%.2f,%.2f,%.3f\n", rows[i].func, rows[i].variant,
+            rows[i].ops, rows[i].ns, rows[i].cyc, rows[i].allocs);
+  fclose(f);
+  return 0;
+}
+
+static int compare_csv(const char* path)
+{
+  FILE* f = fopen(path, "r");
+  if (!f) { perror(path); return -1; }
+  char line[256], comp[32], func[40], variant[32];
+  unsigned long ops; double ns, cyc, al;
+  printf("\nAgainst %s (ns/op, allocs/op):\n", path);
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "%31[^,],%39[^,],%31[^,],%lu,%lf,%lf,%lf",
+               comp, func, variant, &ops, &ns, &cyc, &al) != 7) continue;
+    for (int i=0;i<nrows;i++) {
+      const Row* R = &rows[i];
+      if (strcmp(R->func, func) || strcmp(R->variant, variant)) continue;
+      printf("%-32s %-20s %9.1f -> %9.1f (%+6.1f%%) %6.2f -> %6.2f\n", func, variant,
+             ns, R->ns, ns > 0 ? 100.0 * (R->ns - ns) / ns : 0.0, al, R->allocs);
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  const char* csv = NULL; const char* base = NULL;
+  int c;
+  while ((c = getopt(argc, argv, "o:b:")) != -1) {
+    if (c == 'o') csv = optarg;
+    else if (c == 'b') base = optarg;
+    else { fprintf(stderr, "Usage: %s [-o results.csv] [-b baseline.csv]\n", argv[0]); return 1; }
+  }
+
+  for (int d=0; d<3; d++)
+    for (int v=0; v<2; v++)
+      for (int t=0; t<2; t++) {
+        Case* k = &cases[ncases++];
+        build_case(k, ds_sizes[d], v, tag_sizes[t]);
+
+        //The frames must look to the engine the way they were meant to
+        uint8_t ds[255];
+        if (goose_decode(k->frame, k->flen, &k->G) != 0 || k->G.nelem != k->nds + 1 ||
+            k->G.tag.len != tag_sizes[t] ||
+            make_dataset_canon_from_frame(ds, sizeof(ds), k->frame, &k->G) != k->ds_len ||
+            memcmp(ds, k->ds, k->ds_len) != 0) {
+          fprintf(stderr, "bad synthetic frame %s\n", k->name);
+          return 1;
+        }
+      }
+
+  for (int i=0;i<32;i++) k_device[i] = (uint8_t)(0xA5 ^ i);
+  hkdf_sha256_extract(NULL, 0, k_device, sizeof(k_device), prk, sizeof(prk));
+  hkdf_sha256_expand(prk, sizeof(prk), (const uint8_t*)INFO, strlen(INFO), okm, sizeof(okm));
+
+  printf("BITW codec and crypto primitives (median of %d runs)\n", RUNS);
+  for (int i=0;i<ncases;i++) { cur = &cases[i]; run("goose_decode", cur->name, do_decode); }
+  for (int i=0;i<ncases;i++) { cur = &cases[i]; run("goose_extract_meta", cur->name, do_extract_meta); }
+  for (int i=0;i<ncases;i++) { cur = &cases[i]; run("frame copy", cur->name, do_copy); }
+  for (int i=0;i<ncases;i++) { cur = &cases[i]; run("strip_last_octet_tag", cur->name, do_strip); }
+  for (int i=0;i<ncases;i++) { cur = &cases[i]; run("make_dataset_canon_from_frame", cur->name, do_canon_ds); }
+
+  //Dataset-only rows: one per size, VLAN and tag length do not reach them
+  for (int i=0;i<ncases;i+=4) {
+    char v[16]; snprintf(v, sizeof(v), "ds%d", cases[i].nds);
+    cur = &cases[i];
+    run("auth_canon_prefix+tail", v, do_canon_blob);
+  }
+  for (int i=0;i<ncases;i+=4) {
+    char v[16]; snprintf(v, sizeof(v), "ds%d", cases[i].nds);
+    hblob_len = auth_canon_prefix(hblob, sizeof(hblob), GOID, GOCB, APPID);
+    hblob_len += auth_canon_tail(hblob + hblob_len, sizeof(hblob) - hblob_len, 1, 42,
+                                 cases[i].ds, cases[i].ds_len);
+    run("hmac_sha256", v, do_hmac);
+  }
+  run("hkdf_sha256_extract", "ikm32", do_extract);
+  run("hkdf_sha256_expand", "okm32", do_expand);
+
+  if (csv && write_csv(csv) != 0) return 1;
+  if (base && compare_csv(base) != 0) return 1;
+  return 0;
+}
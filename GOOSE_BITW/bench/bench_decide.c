@@ -0,0 +1,185 @@
+/*
+BENCHMARK (not shipped)
+------------------------
+  - Instructions, branches and branch misses per frame spent deciding what
+    to do with a verified frame, over a mix of verdicts and streams
+  - before: a mock of the old per-frame code, kept here only as the
+    baseline: magic verdict ints, a ternary chain to the reject stage,
+    strcmp(mode, "enforce") and the stripTag fallback tested on every frame
+  - after:  the engine's own decision, linked from src/verdict.c: tables
+    compiled by verdict_actions() as load_policy() does, verdict_decide()
+    per frame, then frame_out()'s switch
+  - Counts come from perf_event_open; where that is not allowed only the
+    time per frame is printed
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define FRAMES  4096
+#define ROUNDS  2000
+#define NSTRMS  8
+
+//Must match verdict.c
+enum { V_OK, V_UNKNOWN, V_MALFORMED, V_BADTAG, V_REPLAY, V_MAC, V_N };
+enum { ACT_DROP, ACT_FWD, ACT_STRIP };
+enum { REJ_UNKNOWN, REJ_MALFORMED, REJ_REPLAY, REJ_MAC, REJ_N };
+
+extern void verdict_actions(uint8_t act[V_N], bool enforce, bool stripTag);
+extern int  verdict_decide(const uint8_t act[V_N], int v, int fr, int* ver, int* rej);
+
+//Only the fields either path reads: mode and stripTag for the mock,
+//the compiled tables for the engine's path
+typedef struct { bool stripTag; uint8_t act[V_N]; } Stream;
+typedef struct { char mode[16]; bool enforce; bool stripTag; uint8_t act[V_N]; Stream strms[NSTRMS]; } Policy;
+
+//One frame as the verifier left it: old-style code, new-style verdict
+typedef struct { int code; uint8_t v, fr; int8_t sidx; } Frame;
+
+static Policy  P;
+static Frame   frames[FRAMES];
+static uint64_t out[4 + REJ_N];   //drop, fwd, strip, rej[], sum of journal codes
+
+//Mock of the old engine code, not linked from anywhere: the baseline
+__attribute__((noinline)) static void decide_before(const Policy* pol, const Frame* f, int n)
+{
+  for (int i=0;i<n;i++) {
+    const Stream* S = f[i].sidx >= 0 ? &pol->strms[f[i].sidx] : NULL;
+    int ver = f[i].code;
+    out[3 + REJ_N] += (unsigned)ver;
+    int rej = !ver ? -1 : ver == 11 ? REJ_UNKNOWN : ver == 13 ? REJ_MAC
+            : (ver > 20 || ver < 10) ? REJ_REPLAY : REJ_MALFORMED;
+    if (rej >= 0) out[3 + rej]++;
+    bool pass = (strcmp(pol->mode,"enforce")==0) ? (ver == 0) : true;
+    if (!pass) { out[0]++; continue; }
+    if (S ? S->stripTag : pol->stripTag) out[2]++;
+    else out[1]++;
+  }
+}
+
+//The engine's path, as in frame_out()
+__attribute__((noinline)) static void decide_after(const Policy* pol, const Frame* f, int n)
+{
+  for (int i=0;i<n;i++) {
+    const Stream* S = f[i].sidx >= 0 ? &pol->strms[f[i].sidx] : NULL;
+    int ver, rej;
+    int act = verdict_decide(S ? S->act : pol->act, f[i].v, f[i].fr, &ver, &rej);
+    if (rej >= 0) out[3 + rej]++;
+    out[3 + REJ_N] += (unsigned)ver;
+    switch (act) {
+    case ACT_DROP:  out[0]++; continue;
+    case ACT_STRIP: out[2]++; break;
+    default:        out[1]++; break;
+    }
+  }
+}
+
+static long perf_open(uint32_t type, uint64_t config)
+{
+  struct perf_event_attr a;
+  memset(&a, 0, sizeof(a));
+  a.size = sizeof(a); a.type = type; a.config = config;
+  a.disabled = 1; a.exclude_kernel = 1; a.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+}
+
+static inline uint64_t now_ns(void){
+  struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct { double ins, br, miss, ns; bool counted; } Result;
+
+static Result run(const char* name, void (*fn)(const Policy*, const Frame*, int))
+{
+  static const uint64_t cfg[3] = { PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+                                   PERF_COUNT_HW_BRANCH_MISSES };
+  long fd[3];
+  bool counted = true;
+  for (int i=0;i<3;i++) { fd[i] = perf_open(PERF_TYPE_HARDWARE, cfg[i]); if (fd[i] < 0) counted = false; }
+
+  for (int r=0;r<ROUNDS/10;r++) fn(&P, frames, FRAMES);
+  for (int i=0;i<3;i++) if (fd[i] >= 0) { ioctl(fd[i], PERF_EVENT_IOC_RESET, 0); ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0); }
+  uint64_t t0 = now_ns();
+  for (int r=0;r<ROUNDS;r++) fn(&P, frames, FRAMES);
+  uint64_t t1 = now_ns();
+  uint64_t c[3] = {0};
+  for (int i=0;i<3;i++) if (fd[i] >= 0) {
+    ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    if (read((int)fd[i], &c[i], sizeof(c[i])) != sizeof(c[i])) counted = false;
+    close((int)fd[i]);
+  }
+
+  double n = (double)FRAMES * ROUNDS;
+  Result R = { c[0]/n, c[1]/n, c[2]/n, (t1-t0)/n, counted };
+  if (counted)
+    printf("%-34s %7.2f ins/frame %6.2f br/frame %6.3f miss/frame %6.2f ns/frame\n", name, R.ins, R.br, R.miss, R.ns);
+  else
+    printf("%-34s %6.2f ns/frame\n", name, R.ns);
+  return R;
+}
+
+//Mostly good frames with a tail of rejects, over streams with and
+//without stripTag plus some frames that match no stream
+static void make_frames(void)
+{
+  uint32_t x = 0x9E3779B9u;
+  for (int i=0;i<FRAMES;i++) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    unsigned r = x % 100;
+    uint8_t v = r < 80 ? V_OK : r < 86 ? V_REPLAY : r < 90 ? V_MAC : r < 94 ? V_UNKNOWN
+              : r < 97 ? V_MALFORMED : V_BADTAG;
+    Frame* f = &frames[i];
+    f->v = v;
+    f->fr = v == V_REPLAY ? (uint8_t)(1 + (x >> 8) % 5) : 0;
+    int rej;
+    verdict_decide(P.act, v, f->fr, &f->code, &rej);
+    f->sidx = v == V_UNKNOWN ? -1 : (int8_t)((x >> 16) % NSTRMS);
+  }
+}
+
+static void make_policy(const char* mode)
+{
+  memset(&P, 0, sizeof(P));
+  snprintf(P.mode, sizeof(P.mode), "%s", mode);
+  P.enforce = strcmp(mode, "enforce") == 0;
+  P.stripTag = true;
+  verdict_actions(P.act, P.enforce, P.stripTag);
+  for (int i=0;i<NSTRMS;i++) {
+    P.strms[i].stripTag = i % 3 != 0;
+    verdict_actions(P.strms[i].act, P.enforce, P.strms[i].stripTag);
+  }
+}
+
+int main(void)
+{
+  make_frames();
+  printf("BITW per-frame decision (%d frames x %d rounds, %d streams)\n", FRAMES, ROUNDS, NSTRMS);
+
+  const char* modes[] = { "enforce", "monitor" };
+  for (int m=0;m<2;m++) {
+    make_policy(modes[m]);
+
+    //Both paths must agree before counting means anything
+    uint64_t a[4 + REJ_N], b[4 + REJ_N];
+    memset(out, 0, sizeof(out)); decide_before(&P, frames, FRAMES); memcpy(a, out, sizeof(a));
+    memset(out, 0, sizeof(out)); decide_after(&P, frames, FRAMES);  memcpy(b, out, sizeof(b));
+    if (memcmp(a, b, sizeof(a)) != 0) { fprintf(stderr, "decision mismatch in %s mode\n", modes[m]); return 1; }
+
+    printf("mode=%s\n", modes[m]);
+    Result r0 = run("  before: strcmp + ternary chain", decide_before);
+    Result r1 = run("  after:  verdict table + switch", decide_after);
+    if (r0.counted && r1.counted)
+      printf("  saved: %.2f ins/frame, %.2f br/frame, %.3f miss/frame\n",
+             r0.ins - r1.ins, r0.br - r1.br, r0.miss - r1.miss);
+  }
+  return 0;
+}
@@ -0,0 +1,163 @@
+/*
+BENCHMARK (not shipped)
+------------------------
+  - Cycles per HMAC verification of one healthA-sized frame
+  - before: full canonical blob + one-shot HMAC (with and without per-frame HKDF)
+  - after:  per-frame tail only, cloned from the stream's prefix midstate
+  - batch:  the same tails, 8 frames per hmac_sha256_prefix_macv_batch()
+            call, once per SHA-256 kernel this CPU has (cost is per frame)
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+extern void   hkdf_sha256_extract(const uint8_t *salt, size_t salt_len,
+                                  const uint8_t *ikm, size_t ikm_len,
+                                  uint8_t *prk, size_t prk_len);
+extern void   hkdf_sha256_expand(const uint8_t *prk, size_t prk_len,
+                                 const uint8_t *info, size_t info_len,
+                                 uint8_t *okm, size_t okm_len);
+extern void   hmac_sha256(const uint8_t *key, size_t key_len,
+                          const uint8_t *data, size_t data_len,
+                          uint8_t *out32);
+extern void*  hmac_sha256_prefix_new(const uint8_t *key, size_t key_len,
+                                     const uint8_t *prefix, size_t prefix_len);
+extern void   hmac_sha256_prefix_mac(const void *pre,
+                                     const uint8_t *data, size_t data_len,
+                                     uint8_t *out32);
+extern void   hmac_sha256_prefix_macv_batch(const void *const *pre, const struct iovec *const *iov,
+                                            const int *iovcnt, int n, uint8_t (*out32)[32]);
+extern int    sha256_mb_use(const char* name);
+extern size_t auth_canon_prefix(uint8_t *out, size_t out_max,
+                                const char* goID, const char* gocbRef, uint16_t appId);
+extern size_t auth_canon_tail(uint8_t *out, size_t out_max,
+                              uint32_t stNum, uint32_t sqNum,
+                              const uint8_t* ds, size_t ds_len);
+
+#define ITERS 200000
+#define BATCH 8
+
+static const char*    GOID  = "IEDA/LLN0$GO$healthA";
+static const char*    GOCB  = "IEDA/LLN0$GO$healthA";
+static const uint16_t APPID = 1000;
+static const char*    INFO  = "GOOSE|IEDA/LLN0$GO$healthA|IEDA/LLN0$GO$healthA|1000";
+static const uint8_t  DS[]  = { 0x01,0x01,0x01, 0x02,0x04,0x00,0x00,0x00,0x19 };
+
+static uint8_t k_device[32];
+static uint8_t okm[32];
+static void*   mac_pre;
+static volatile unsigned sink;
+
+static inline uint64_t ticks(void){
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+static inline uint64_t now_ns(void){
+  struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//Pre-cache path: HKDF on every frame, full blob, one-shot HMAC
+static void verify_kdf_each(uint32_t sq){
+  uint8_t prk[32]={0}, k[32], blob[512], mac[32];
+  hkdf_sha256_extract(NULL, 0, k_device, 32, prk, 32);
+  hkdf_sha256_expand(prk, 32, (const uint8_t*)INFO, strlen(INFO), k, 32);
+  size_t w = auth_canon_prefix(blob, sizeof(blob), GOID, GOCB, APPID);
+  w += auth_canon_tail(blob+w, sizeof(blob)-w, 1, sq, DS, sizeof(DS));
+  hmac_sha256(k, 32, blob, w, mac);
+  sink += mac[0];
+}
+
+//Cached OKM, full blob, one-shot HMAC
+static void verify_oneshot(uint32_t sq){
+  uint8_t blob[512], mac[32];
+  size_t w = auth_canon_prefix(blob, sizeof(blob), GOID, GOCB, APPID);
+  w += auth_canon_tail(blob+w, sizeof(blob)-w, 1, sq, DS, sizeof(DS));
+  hmac_sha256(okm, 32, blob, w, mac);
+  sink += mac[0];
+}
+
+//Cached prefix midstate, tail only
+static void verify_midstate(uint32_t sq){
+  uint8_t tail[256], mac[32];
+  size_t w = auth_canon_tail(tail, sizeof(tail), 1, sq, DS, sizeof(DS));
+  hmac_sha256_prefix_mac(mac_pre, tail, w, mac);
+  sink += mac[0];
+}
+
+//Tails gathered until BATCH are in, then verified in one call
+static void verify_batch(uint32_t sq){
+  static uint8_t tail[BATCH][256], mac[BATCH][32];
+  static struct iovec v[BATCH];
+  static int n;
+  v[n].iov_base = tail[n];
+  v[n].iov_len = auth_canon_tail(tail[n], sizeof(tail[n]), 1, sq, DS, sizeof(DS));
+  if (++n < BATCH) return;
+  const void* pre[BATCH];
+  const struct iovec* iov[BATCH];
+  int cnt[BATCH];
+  for (int i=0;i<BATCH;i++) { pre[i] = mac_pre; iov[i] = &v[i]; cnt[i] = 1; }
+  hmac_sha256_prefix_macv_batch(pre, iov, cnt, BATCH, mac);
+  for (int i=0;i<BATCH;i++) sink += mac[i][0];
+  n = 0;
+}
+
+static void run(const char* name, void (*fn)(uint32_t)){
+  for (uint32_t i=0;i<ITERS/10;i++) fn(i);
+  uint64_t t0=now_ns(), c0=ticks();
+  for (uint32_t i=0;i<ITERS;i++) fn(i);
+  uint64_t c1=ticks(), t1=now_ns();
+  printf("%-30s %10.1f cycles/op %9.1f ns/op\n", name,
+         (double)(c1-c0)/ITERS, (double)(t1-t0)/ITERS);
+}
+
+int main(void){
+  for (int i=0;i<32;i++) k_device[i]=(uint8_t)(0xA5 ^ i);
+  uint8_t prk[32]={0};
+  hkdf_sha256_extract(NULL, 0, k_device, 32, prk, 32);
+  hkdf_sha256_expand(prk, 32, (const uint8_t*)INFO, strlen(INFO), okm, 32);
+  uint8_t pre[512];
+  size_t pn = auth_canon_prefix(pre, sizeof(pre), GOID, GOCB, APPID);
+  mac_pre = hmac_sha256_prefix_new(okm, 32, pre, pn);
+
+  //Both paths must agree before timing means anything
+  uint8_t blob[512], tail[256], a[32], b[32];
+  size_t w = auth_canon_prefix(blob, sizeof(blob), GOID, GOCB, APPID);
+  w += auth_canon_tail(blob+w, sizeof(blob)-w, 7, 42, DS, sizeof(DS));
+  hmac_sha256(okm, 32, blob, w, a);
+  size_t tn = auth_canon_tail(tail, sizeof(tail), 7, 42, DS, sizeof(DS));
+  hmac_sha256_prefix_mac(mac_pre, tail, tn, b);
+  if (memcmp(a, b, 32) != 0) { fprintf(stderr, "midstate MAC mismatch\n"); return 1; }
+
+  printf("BITW verify path (%d iterations, blob=%zu B, tail=%zu B)\n", ITERS, w, tn);
+  run("before: hkdf + one-shot", verify_kdf_each);
+  run("before: one-shot (cached okm)", verify_oneshot);
+  run("after:  prefix midstate", verify_midstate);
+
+  const void* bp[1] = { mac_pre };
+  struct iovec bv = { tail, tn };
+  const struct iovec* bi[1] = { &bv };
+  int bc[1] = { 1 };
+  static const char* const kernels[] = { "scalar", "shani", "sse2", "avx2" };
+  for (size_t k=0;k<sizeof(kernels)/sizeof(kernels[0]);k++) {
+    if (sha256_mb_use(kernels[k]) != 0) continue;
+    hmac_sha256_prefix_macv_batch(bp, bi, bc, 1, &b);
+    if (memcmp(a, b, 32) != 0) { fprintf(stderr, "batch MAC mismatch (%s)\n", kernels[k]); return 1; }
+    char name[48];
+    snprintf(name, sizeof(name), "batch:  %d x midstate, %s", BATCH, kernels[k]);
+    run(name, verify_batch);
+  }
+  return 0;
+}
@@ -0,0 +1,199 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Publisher canonical blob, split so the constant identity part can be
+//absorbed into a keyed HMAC state once per stream (see load_policy)
+//  prefix: "GOOSE" | goID | gocbRef | appId
+//  tail:   stNum | sqNum | dataset
+static size_t put_strF(uint8_t *b, size_t m, size_t w, const char* s){
+  size_t L = s? strlen(s):0;
+  if (w+2+L>m) return w;
+  b[w++]=0xF0; b[w++]=(uint8_t)L;
+  if (L){memcpy(b+w,s,L); w+=L;}
+  return w;
+}
+static size_t put_u16F(uint8_t *b, size_t m, size_t w, uint16_t v){
+  if (w+4>m) return w;
+  b[w++]=0xF1; b[w++]=2;
+  b[w++]=(uint8_t)((v>>8)&0xFF);
+  b[w++]=(uint8_t)(v&0xFF);
+  return w;
+}
+static size_t put_u32F(uint8_t *b, size_t m, size_t w, uint32_t v){
+  if (w+6>m) return w;
+  b[w++]=0xF2; b[w++]=4;
+  b[w++]=(uint8_t)((v>>24)&0xFF);
+  b[w++]=(uint8_t)((v>>16)&0xFF);
+  b[w++]=(uint8_t)((v>>8)&0xFF);
+  b[w++]=(uint8_t)(v&0xFF);
+  return w;
+}
+static size_t put_blobF(uint8_t *b, size_t m, size_t w, const uint8_t *d, size_t L){
+  if (w+2+L>m) return w;
+  b[w++]=0xF3; b[w++]=(uint8_t)L;
+  if (L){memcpy(b+w,d,L); w+=L;}
+  return w;
+}
+
+size_t auth_canon_prefix(uint8_t *out, size_t out_max,
+                         const char* goID, const char* gocbRef, uint16_t appId)
+{
+  size_t w=0;
+  w=put_strF(out,out_max,w,"GOOSE");
+  w=put_strF(out,out_max,w,goID);
+  w=put_strF(out,out_max,w,gocbRef);
+  w=put_u16F(out,out_max,w,appId);
+  return w;
+}
+
+//Fixed head of the tail, up to and including the dataset blob's length
+//byte, so the dataset itself can be hashed as a separate span
+size_t auth_canon_tail_head(uint8_t *out, size_t out_max,
+                            uint32_t stNum, uint32_t sqNum, size_t ds_len)
+{
+  size_t w=0;
+  w=put_u32F(out,out_max,w,stNum);
+  w=put_u32F(out,out_max,w,sqNum);
+  if (w+2>out_max) return w;
+  out[w++]=0xF3; out[w++]=(uint8_t)ds_len;
+  return w;
+}
+
+size_t auth_canon_tail(uint8_t *out, size_t out_max,
+                       uint32_t stNum, uint32_t sqNum,
+                       const uint8_t* ds, size_t ds_len)
+{
+  size_t w=0;
+  w=put_u32F(out,out_max,w,stNum);
+  w=put_u32F(out,out_max,w,sqNum);
+  w=put_blobF(out,out_max,w,ds,ds_len);
+  return w;
+}
+
+//Which of the verifier's candidate forms a stream's publisher signs.
+//Each stream either pins one in the policy or learns it: every form is
+//tried until one matches, and the stream settles on it. Only a verified
+//match settles, so a forger cannot steer the choice. After `learn` signed
+//frames without any match the stream stays unsettled but tries only pub,
+//and every form on one failed frame in CANON_PROBE: forged frames then
+//cost about one HMAC each, and a publisher that signs another form is
+//still found. Settled, a frame costs one HMAC
+enum { CANON_PUB, CANON_ALL, CANON_SEQ, CANON_N };
+#define CANON_PROBE 16
+static const char* const canon_names[CANON_N] = { "pub", "allData", "seq" };
+
+typedef struct {
+  int32_t  learn_left;  //failed frames left trying every form, then probing
+  int32_t  form;        //settled form, -1 while learning
+  uint64_t hit[CANON_N];
+  uint64_t miss;        //no tried form matched
+  uint64_t spent;       //failed frames since learn_left ran out
+  uint64_t probe_at;    //spent at which the next frame tries every form
+  uint64_t _pad[1];
+} __attribute__((aligned(64))) CanonSel;
+
+_Static_assert(sizeof(CanonSel) == 64, "CanonSel must fill exactly one cache line");
+
+//"auto" = -1, a form index, or -2 if unknown
+int canon_parse(const char* s)
+{
+  if (!s || strcmp(s, "auto") == 0) return -1;
+  for (int f=0; f<CANON_N; f++) if (strcmp(s, canon_names[f]) == 0) return f;
+  return -2;
+}
+
+const char* canon_name(int form)
+{
+  return (form >= 0 && form < CANON_N) ? canon_names[form] : "auto";
+}
+
+//Table of n selectors, indexed like Policy.strms
+void* canon_sel_new(int n, int learn)
+{
+  if (n <= 0) n = 1;
+  CanonSel* t = (CanonSel*)aligned_alloc(64, sizeof(CanonSel) * (size_t)n);
+  if (!t) return NULL;
+  memset(t, 0, sizeof(CanonSel) * (size_t)n);
+  for (int i=0;i<n;i++) { t[i].learn_left = learn > 0 ? learn : 1; t[i].form = -1; }
+  return t;
+}
+
+void canon_sel_free(void* tab){ free(tab); }
+
+//Forms to try for stream idx, in order; returns how many
+int canon_sel_order(void* tab, int idx, int pinned, int order[CANON_N])
+{
+  if (pinned >= 0) { order[0] = pinned; return 1; }
+  CanonSel* c = (CanonSel*)tab + idx;
+  int form = __atomic_load_n(&c->form, __ATOMIC_ACQUIRE);
+  if (form >= 0) { order[0] = form; return 1; }
+  if (__atomic_load_n(&c->learn_left, __ATOMIC_RELAXED) <= 0 &&
+      __atomic_load_n(&c->spent, __ATOMIC_RELAXED) < __atomic_load_n(&c->probe_at, __ATOMIC_RELAXED)) {
+    order[0] = CANON_PUB;
+    return 1;
+  }
+  for (int f=0; f<CANON_N; f++) order[f] = f;
+  return CANON_N;
+}
+
+//Record which form matched (-1 = none) after trying `tried` forms. A
+//match settles the stream. A failed probe puts the next one CANON_PROBE
+//failed frames later (batched frames fail several at a time, so this is
+//a threshold, not a modulo). Returns 1 for the failed frame that used up
+//the learning budget
+int canon_sel_result(void* tab, int idx, int form, int tried)
+{
+  CanonSel* c = (CanonSel*)tab + idx;
+  if (form >= 0) __atomic_fetch_add(&c->hit[form], 1, __ATOMIC_RELAXED);
+  else           __atomic_fetch_add(&c->miss, 1, __ATOMIC_RELAXED);
+  if (__atomic_load_n(&c->form, __ATOMIC_RELAXED) >= 0) return 0;
+  if (form >= 0) {
+    int unset = -1;
+    __atomic_compare_exchange_n(&c->form, &unset, form, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    return 0;
+  }
+  if (__atomic_load_n(&c->learn_left, __ATOMIC_RELAXED) <= 0) {
+    uint64_t n = __atomic_add_fetch(&c->spent, 1, __ATOMIC_RELAXED);
+    if (tried > 1) __atomic_store_n(&c->probe_at, n + CANON_PROBE, __ATOMIC_RELAXED);
+    return 0;
+  }
+  return __atomic_sub_fetch(&c->learn_left, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+//Carry selector si of src over as di of dst on a policy reload: a form
+//src already settled on stays settled, a spent learning budget stays
+//spent, counters move across
+void canon_sel_carry(void* dst, int di, void* src, int si)
+{
+  CanonSel* d = (CanonSel*)dst + di;
+  CanonSel* s = (CanonSel*)src + si;
+  int form = __atomic_load_n(&s->form, __ATOMIC_ACQUIRE);
+  if (form >= 0) {
+    int unset = -1;
+    __atomic_compare_exchange_n(&d->form, &unset, form, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+  }
+  int left = __atomic_load_n(&s->learn_left, __ATOMIC_RELAXED);
+  if (left < __atomic_load_n(&d->learn_left, __ATOMIC_RELAXED))
+    __atomic_store_n(&d->learn_left, left, __ATOMIC_RELAXED);
+  for (int f=0; f<CANON_N; f++)
+    __atomic_fetch_add(&d->hit[f], __atomic_exchange_n(&s->hit[f], 0, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  __atomic_fetch_add(&d->miss, __atomic_exchange_n(&s->miss, 0, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  __atomic_fetch_add(&d->spent, __atomic_exchange_n(&s->spent, 0, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+void canon_sel_report(void* tab, int idx, int pinned, const char* name)
+{
+  CanonSel* c = (CanonSel*)tab + idx;
+  int form = pinned >= 0 ? pinned : __atomic_load_n(&c->form, __ATOMIC_ACQUIRE);
+  bool probing = form < 0 && c->learn_left <= 0;
+  fprintf(stderr, "[canon %s] form=%s (%s) pub=%llu allData=%llu seq=%llu miss=%llu",
+          name, form >= 0 ? canon_names[form] : "-",
+          pinned >= 0 ? "pinned" : form >= 0 ? "learned" : probing ? "probing" : "learning",
+          (unsigned long long)c->hit[CANON_PUB], (unsigned long long)c->hit[CANON_ALL],
+          (unsigned long long)c->hit[CANON_SEQ], (unsigned long long)c->miss);
+  if (probing) fprintf(stderr, " overBudget=%llu", (unsigned long long)c->spent);
+  fprintf(stderr, "\n");
+}
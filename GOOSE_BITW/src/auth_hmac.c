@@ -1,7 +1,13 @@
+#include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
+#include <openssl/sha.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
 
 void hkdf_sha256_extract(const uint8_t *salt, size_t salt_len,
                          const uint8_t *ikm, size_t ikm_len,
@@ -46,3 +52,242 @@ void hmac_sha256(const uint8_t *key, size_t key_len,
     unsigned int L=0;
     HMAC(EVP_sha256(), key, (int)key_len, data, data_len, out32, &L);
 }
+
+//SHA-256 midstate for the batch path: chaining words after the whole
+//blocks absorbed so far, the byte count, and the partial block not yet
+//hashed. Ours, so nothing reaches into SHA256_CTX
+typedef struct {
+    uint32_t h[8];
+    uint64_t len;
+    uint8_t  buf[64];   //len % 64 bytes pending
+} ShaMid;
+
+extern void sha256_blocks(uint32_t h[8], const uint8_t *p, unsigned nblk);
+
+static void mid_start(ShaMid *m, const uint8_t pad[64], const uint8_t *p, size_t n)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19
+    };
+    memcpy(m->h, iv, sizeof(iv));
+    sha256_blocks(m->h, pad, 1);
+    if (n >= 64) sha256_blocks(m->h, p, (unsigned)(n / 64));
+    if (n % 64) memcpy(m->buf, p + n - n % 64, n % 64);
+    m->len = 64 + (uint64_t)n;
+}
+
+//Keyed HMAC context with any constant message prefix already absorbed,
+//cloned per frame so per-frame work is only the variable tail. The batch
+//path below does not go through OpenSSL per frame; it starts from the
+//inner/outer midstates after the ipad/opad block and the prefix
+typedef struct {
+    EVP_MAC_CTX *ctx;
+    ShaMid inner;
+    ShaMid outer;
+} HmacPrefix;
+
+void* hmac_sha256_prefix_new(const uint8_t *key, size_t key_len,
+                             const uint8_t *prefix, size_t prefix_len)
+{
+    HmacPrefix *H = (HmacPrefix*)calloc(1, sizeof(*H));
+    if (!H) return NULL;
+
+    EVP_MAC *mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+    if (mac) H->ctx = EVP_MAC_CTX_new(mac);
+    EVP_MAC_free(mac);   //the context keeps its own reference
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"SHA256", 0),
+        OSSL_PARAM_construct_end()
+    };
+    if (!H->ctx || !EVP_MAC_init(H->ctx, key, key_len, params) ||
+        (prefix_len && !EVP_MAC_update(H->ctx, prefix, prefix_len))) {
+        EVP_MAC_CTX_free(H->ctx);
+        free(H);
+        return NULL;
+    }
+
+    uint8_t k[64]={0}, pad[64];
+    if (key_len > sizeof(k)) SHA256(key, key_len, k);
+    else if (key_len) memcpy(k, key, key_len);
+
+    for (int i=0;i<64;i++) pad[i] = k[i] ^ 0x36;
+    mid_start(&H->inner, pad, prefix, prefix ? prefix_len : 0);
+
+    for (int i=0;i<64;i++) pad[i] = k[i] ^ 0x5c;
+    mid_start(&H->outer, pad, NULL, 0);
+
+    memset(k, 0, sizeof(k)); memset(pad, 0, sizeof(pad));
+    return H;
+}
+
+//MAC over several spans fed in order, as if they were one buffer, so
+//callers can hash straight out of the frame without assembling a copy.
+//A zero tag when the clone fails, which never verifies
+void hmac_sha256_prefix_macv(const void *pre, const struct iovec *iov, int iovcnt,
+                             uint8_t *out32)
+{
+    const HmacPrefix *H = (const HmacPrefix*)pre;
+    EVP_MAC_CTX *c = EVP_MAC_CTX_dup(H->ctx);
+    size_t L = 0;
+    int ok = c != NULL;
+    for (int i=0;i<iovcnt && ok;i++)
+        if (iov[i].iov_len) ok = EVP_MAC_update(c, iov[i].iov_base, iov[i].iov_len);
+    if (!ok || !EVP_MAC_final(c, out32, &L, 32) || L != 32) memset(out32, 0, 32);
+    EVP_MAC_CTX_free(c);
+}
+
+void hmac_sha256_prefix_mac(const void *pre,
+                            const uint8_t *data, size_t data_len,
+                            uint8_t *out32)
+{
+    struct iovec v = { (void*)data, data_len };
+    hmac_sha256_prefix_macv(pre, &v, 1, out32);
+}
+
+void hmac_sha256_prefix_free(void *pre)
+{
+    if (!pre) return;
+    HmacPrefix *H = (HmacPrefix*)pre;
+    EVP_MAC_CTX_free(H->ctx);
+    memset(H, 0, sizeof(*H));
+    free(H);
+}
+
+//Batch of prefix MACs computed together (sha256_mb.c), results in order.
+//Each job's inner tail is padded into whole blocks here, from the state
+//the midstate left off at; tails too long for the buffer go one by one
+typedef struct {
+    uint32_t       h[8];
+    const uint8_t *data;
+    unsigned       nblk;
+} ShaJob;   //must match sha256_mb.c
+
+extern void sha256_mb(ShaJob *j, int n);
+extern int  sha256_mb_use(const char *name);
+
+#define HB_CHUNK   16
+#define HB_BLOCKS  8    //inner tail up to 503 bytes after the prefix
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0]=(uint8_t)(v>>24); p[1]=(uint8_t)(v>>16); p[2]=(uint8_t)(v>>8); p[3]=(uint8_t)v;
+}
+
+//Pads what is left of a message into whole blocks; 0 when it does not fit
+static unsigned hb_pad(uint8_t *blk, size_t cap, const ShaMid *c,
+                       const struct iovec *iov, int iovcnt)
+{
+    size_t w = (size_t)(c->len % 64), add = 0;
+    for (int i=0;i<iovcnt;i++) add += iov[i].iov_len;
+    unsigned nblk = (unsigned)((w + add + 9 + 63) / 64);
+    if ((size_t)nblk * 64 > cap) return 0;
+    memcpy(blk, c->buf, w);
+    for (int i=0;i<iovcnt;i++) {
+        if (iov[i].iov_len) memcpy(blk + w, iov[i].iov_base, iov[i].iov_len);
+        w += iov[i].iov_len;
+    }
+    uint64_t bits = (c->len + add) * 8;
+    blk[w++] = 0x80;
+    memset(blk + w, 0, (size_t)nblk * 64 - w);
+    put_be32(blk + nblk*64 - 8, (uint32_t)(bits >> 32));
+    put_be32(blk + nblk*64 - 4, (uint32_t)bits);
+    return nblk;
+}
+
+void hmac_sha256_prefix_macv_batch(const void *const *pre, const struct iovec *const *iov,
+                                   const int *iovcnt, int n, uint8_t (*out32)[32])
+{
+    for (int base=0; base<n; base+=HB_CHUNK) {
+        int m = n - base < HB_CHUNK ? n - base : HB_CHUNK;
+        ShaJob j[HB_CHUNK];
+        uint8_t blk[HB_CHUNK][HB_BLOCKS*64];
+        int idx[HB_CHUNK], nj = 0;
+
+        for (int i=0;i<m;i++) {
+            const HmacPrefix *H = (const HmacPrefix*)pre[base+i];
+            unsigned nb = hb_pad(blk[nj], sizeof(blk[nj]), &H->inner, iov[base+i], iovcnt[base+i]);
+            if (!nb) {
+                hmac_sha256_prefix_macv(H, iov[base+i], iovcnt[base+i], out32[base+i]);
+                continue;
+            }
+            memcpy(j[nj].h, H->inner.h, sizeof(j[nj].h));
+            j[nj].data = blk[nj]; j[nj].nblk = nb;
+            idx[nj++] = base + i;
+        }
+        sha256_mb(j, nj);
+
+        //Outer hash: one block, the inner digest after the opad block
+        for (int k=0;k<nj;k++) {
+            const HmacPrefix *H = (const HmacPrefix*)pre[idx[k]];
+            uint8_t *b = blk[k];
+            for (int r=0;r<8;r++) put_be32(b + 4*r, j[k].h[r]);
+            b[32] = 0x80;
+            memset(b + 33, 0, 64 - 33 - 4);
+            put_be32(b + 60, (64 + 32) * 8);
+            memcpy(j[k].h, H->outer.h, sizeof(j[k].h));
+            j[k].nblk = 1;
+        }
+        sha256_mb(j, nj);
+        for (int k=0;k<nj;k++)
+            for (int r=0;r<8;r++) put_be32(out32[idx[k]] + 4*r, j[k].h[r]);
+    }
+}
+
+//Batch MACs against OpenSSL's HMAC() over keys, prefixes and tails of
+//assorted lengths (some past the batch buffer), with every kernel this
+//CPU has. Leaves the best kernel selected. 0 when all agree
+int hmac_sha256_batch_selftest(char *err, size_t errlen)
+{
+    static const char *const kernels[] = { "scalar", "shani", "sse2", "avx2" };
+    enum { N = 37 };
+    uint8_t key[N][80], msg[N][600], mac[N][32], ref[32];
+    size_t klen[N], plen[N], mlen[N];
+    void *pre[N] = {0};
+    struct iovec v[N][3];
+    const struct iovec *vp[N];
+    int vc[N];
+    uint32_t x = 0x2545F491u;
+    int rc = 0;
+
+    for (int i=0;i<N;i++) {
+        klen[i] = 1 + (size_t)(i * 13) % 80;
+        plen[i] = (size_t)(i * 29) % 140;
+        mlen[i] = plen[i] + (i < N-3 ? (size_t)(i * 71) % 300 : 480 + (size_t)i);
+        for (size_t k=0;k<klen[i];k++) { x ^= x << 13; x ^= x >> 17; x ^= x << 5; key[i][k] = (uint8_t)x; }
+        for (size_t k=0;k<mlen[i];k++) { x ^= x << 13; x ^= x >> 17; x ^= x << 5; msg[i][k] = (uint8_t)x; }
+        pre[i] = hmac_sha256_prefix_new(key[i], klen[i], msg[i], plen[i]);
+        if (!pre[i]) { snprintf(err, errlen, "out of memory"); rc = -1; goto out; }
+        //Tail in one to three spans, the first one empty when short
+        size_t t = mlen[i] - plen[i], cut[4] = { 0, t / 3, t / 2, t };
+        vc[i] = 1 + i % 3;
+        if (vc[i] == 1) cut[1] = t;
+        if (vc[i] == 2) cut[2] = t;
+        for (int s=0;s<vc[i];s++) {
+            v[i][s].iov_base = msg[i] + plen[i] + cut[s];
+            v[i][s].iov_len  = cut[s+1] - cut[s];
+        }
+        vp[i] = v[i];
+    }
+
+    for (size_t k=0; k<sizeof(kernels)/sizeof(kernels[0]) && !rc; k++) {
+        if (sha256_mb_use(kernels[k]) != 0) continue;
+        for (int n=1; n<=N && !rc; n+=6) {
+            memset(mac, 0, sizeof(mac));
+            hmac_sha256_prefix_macv_batch((const void *const *)pre, vp, vc, n, mac);
+            for (int i=0;i<n;i++) {
+                unsigned int L = 0;
+                HMAC(EVP_sha256(), key[i], (int)klen[i], msg[i], mlen[i], ref, &L);
+                if (memcmp(ref, mac[i], 32) != 0) {
+                    snprintf(err, errlen, "%s kernel: job %d of %d (key %zu B, message %zu B) differs from HMAC()",
+                             kernels[k], i, n, klen[i], mlen[i]);
+                    rc = -1;
+                    break;
+                }
+            }
+        }
+    }
+out:
+    sha256_mb_use("auto");
+    for (int i=0;i<N;i++) if (pre[i]) hmac_sha256_prefix_free(pre[i]);
+    return rc;
+}
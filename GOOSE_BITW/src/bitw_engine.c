@@ -10,13 +10,26 @@ INTERNAL BINARY (not user-facing)
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+
+//Verdicts of the verifier (verify_front() and after) and the actions
+//load_policy() compiles them to, per stream. Must match bitw_policy_loader.c
+enum { V_OK, V_UNKNOWN, V_MALFORMED, V_BADTAG, V_REPLAY, V_MAC, V_N };
+enum { ACT_DROP, ACT_FWD, ACT_STRIP };
 
 //Policy + types (local decls)
 typedef struct {
@@ -30,38 +43,232 @@ typedef struct {
   uint16_t appId;
   char  goID[128];
   char  gocbRef[128];
+  uint8_t dstMac[6];
+  bool  hasDstMac;
   bool  allowUnsigned;
+  //Per-stream settings, defaulting to the top-level ones
+  bool  stripTag;
+  int   ttl_ms;
+  int   maxSqGap;
+  int   maxAge_ms;
+  int   canon;       //MAC input form: -1 = learn, else pinned (auth_canon.c)
+  int   max_rate;    //XDP guard budget in frames/s, 0 = unlimited
+  int   burst;       //... and how many frames may arrive back to back
+  uint16_t dev;      //index into Policy.devs
+  uint16_t next;     //next stream with the same appId (1-based, 0 = end)
+  int   slot;        //live stats and latency slot, -1 = none (set by the engine)
+  uint8_t act[V_N];  //what each verdict does to a frame of this stream (ACT_*)
+  //Cached per-stream key, filled by load_policy()
+  uint8_t okm[32];
+  void*   mac_key;   //HMAC midstate keyed with okm
+  void*   mac_pre;   //... plus the constant canonical prefix
 } Stream;
 
 typedef struct {
   //Mode select "monitor" or "enforce"
   char mode[16];   
+  bool enforce;      //compiled from mode
+  uint8_t act[V_N];  //actions for frames that match no stream
+  //Top-level defaults, already copied into each stream
   bool stripTag;
   int  ttl_ms;
   int  maxSqGap;
   int  maxAge_ms;
-  Device dev;
-  Stream strm;
+  int  canon;
+  int  canon_learn;  //failed signed frames a stream tries every form on before probing
+  bool pass_other;   //bridge ethertypes other than GOOSE/PTP instead of dropping them
+  int  max_rate;
+  int  burst;
+  //Device/stream table, immutable after load_policy()
+  Device*   devs;
+  int       ndevs;
+  Stream*   strms;
+  int       nstrms;
+  uint16_t* by_appId;   //65536 entries, 1-based index into strms, 0 = none
+  void*     fresh;      //per-stream freshness windows (freshness.c), indexed like strms
+  void*     canon_sel;  //per-stream MAC form selectors (auth_canon.c), indexed like strms
+  //Optional "engine" object (runtime knobs, no policy semantics)
+  char io[16];     //"pcap", "mmap" or "xdp"
+  bool threads;    //one pinned thread per direction
+  int  workers;    //PACKET_FANOUT workers per ingress port (>1 implies threads)
+  int  cpus[16];   //CPUs handed out to threads in order, round robin
+  int  ncpus;      //0 = threads are not pinned
+  int  stats_s;    //per-direction stats period, 0 = only at exit
+  int  tx_batch;   //frames per TX flush (1 = flush every frame)
+  int  tx_batch_us;//oldest queued frame waits at most this long
+  int  hmac_batch; //GOOSE frames whose HMACs are computed together (1 = one by one, 0 = auto)
+  char xdp_guard[16];//"off", "auto" (native XDP, generic fallback) or "generic"
+  char journal[256];  //verdict journal file, "" = off
+  int  journal_recs;  //records kept in it
 } Policy;
 
+//Decoded frame (goose_parse.c), must match its Span/GooseFrame
+typedef struct {
+  uint16_t off;
+  uint16_t len;
+  uint8_t  hdr;
+  uint8_t  tag;
+} Span;
+
+#define GOOSE_MAX_ELEMS 64
+
+typedef struct {
+  uint16_t appId;
+  uint16_t apdu_off;
+  uint32_t stNum;
+  uint32_t sqNum;
+  Span     seq;
+  Span     gocbRef, ttl, datSet, goID, t;
+  Span     st, sq;
+  Span     simulation, confRev, ndsCom, numEntries;
+  Span     all;
+  Span     tag;
+  int      nelem;
+  Span     elem[GOOSE_MAX_ELEMS];
+} GooseFrame;
+
 //Externs implemented in other .c files
 extern bool   load_policy(const char* path, Policy* P);
-extern int    goose_extract_meta(const uint8_t* frame, size_t flen, void* M_out);
-extern void   hkdf_sha256_extract(const uint8_t *salt, size_t salt_len,
-                                  const uint8_t *ikm, size_t ikm_len,
-                                  uint8_t *prk, size_t prk_len);
-extern void   hkdf_sha256_expand(const uint8_t *prk, size_t prk_len,
-                                 const uint8_t *info, size_t info_len,
-                                 uint8_t *okm, size_t okm_len);
-extern void   hmac_sha256(const uint8_t *key, size_t key_len,
-                          const uint8_t *data, size_t data_len,
-                          uint8_t *out32);
-extern int    freshness_check(uint32_t st, uint32_t sq, int ttl_ms, int maxSqGap, int maxAge_ms);
-extern int    strip_last_octet_tag(uint8_t* frame, size_t* p_flen, int tag_pos, int tag_len);
+extern void   policy_free(Policy* P);
+extern int    goose_decode(const uint8_t* frame, size_t flen, GooseFrame* G);
+extern void   hmac_sha256_prefix_macv(const void *pre, const struct iovec *iov, int iovcnt,
+                                      uint8_t *out32);
+extern void   hmac_sha256_prefix_macv_batch(const void *const *pre, const struct iovec *const *iov,
+                                            const int *iovcnt, int n, uint8_t (*out32)[32]);
+extern int    hmac_sha256_batch_selftest(char *err, size_t errlen);
+extern const char* sha256_mb_name(void);
+extern int    sha256_mb_lanes(void);
+extern size_t auth_canon_tail_head(uint8_t *out, size_t out_max,
+                                   uint32_t stNum, uint32_t sqNum, size_t ds_len);
+extern int    freshness_check(void* tab, int idx, uint32_t st, uint32_t sq,
+                              int ttl_ms, int maxSqGap, int maxAge_ms);
+extern int    freshness_peek(void* tab, int idx, uint32_t st, uint32_t sq,
+                             int maxSqGap, int maxAge_ms, bool held);
+extern void   freshness_report(void* tab, int idx, const char* name);
+extern void   freshness_carry(void* dst, int di, void* src, int si);
+extern const char* canon_name(int form);
+extern int    canon_sel_order(void* tab, int idx, int pinned, int order[3]);
+extern int    canon_sel_result(void* tab, int idx, int form, int tried);
+extern void   canon_sel_report(void* tab, int idx, int pinned, const char* name);
+extern void   canon_sel_carry(void* dst, int di, void* src, int si);
+extern int    strip_last_octet_tag(uint8_t* frame, size_t* p_flen, const GooseFrame* G,
+                                   int tag_pos, int tag_len);
+extern int    strip_tag_copy(uint8_t* dst, size_t dst_cap, const uint8_t* src, size_t flen,
+                             const GooseFrame* G, int tag_pos, int tag_len, size_t* out_len);
+extern size_t make_dataset_canon_from_frame(uint8_t *out, size_t out_max,
+                                            const uint8_t* f, const GooseFrame* G);
+
+//Frame buffer pool (frame_pool.c)
+extern void*    fpool_new(unsigned nbufs);
+extern size_t   fpool_buf_size(void);
+extern uint8_t* fpool_get(void* pool);
+extern void     fpool_put(void* pool, uint8_t* buf);
+extern void     fpool_free(void* pool, const char* name);
+
+#define DIR_POOL_BUFS 512
+#define STRM_SPARE_SLOTS 16   //live stats slots kept for streams a reload adds
+#define TXQ_MAX       256   //bounded egress/retry queue per direction
+#define TXQ_BURST     64    //frames per sendmmsg call
+
+//PACKET_MMAP backend (io_ring.c)
+extern void*    ring_open(const char* ifname, char* err, size_t errlen);
+extern void*    ring_open_dir(const char* ifname, bool rx, bool tx, char* err, size_t errlen);
+extern int      packet_fanout_join(int fd, uint16_t group, char* err, size_t errlen);
+extern int      prefilter_build(const uint16_t* by_appId, bool check_appId, bool pass_other, void** out);
+extern int      packet_set_filter(int fd, const void* insns, int len, char* err, size_t errlen);
+extern void     ring_close(void* r);
+extern int      ring_fd(void* r);
+extern int      ring_rx_next(void* r, const uint8_t** pkt, size_t* len, uint64_t* ts_ns);
+extern uint8_t* ring_tx_slot(void* r, size_t* cap);
+extern void     ring_tx_commit(void* r, size_t len);
+extern int      ring_tx_send(void* r, const uint8_t* pkt, size_t len);
+extern int      ring_tx_flush(void* r);
+extern void*    xdp_open(const char* ifA, const char* ifB, void* guard, bool generic, char* err, size_t errlen);
+extern void     xdp_close(void* pair);
+extern void*    xdp_port(void* pair, int idx);
+extern int      xdp_fd(void* port);
+extern int      xdp_rx_next(void* port, uint8_t** pkt, size_t* len);
+extern int      xdp_tx_forward(void* rxport, void* txport, const uint8_t* pkt, size_t len);
+extern int      xdp_tx_send(void* txport, const uint8_t* pkt, size_t len);
+extern int      xdp_tx_flush(void* txport);
+
+//XDP early-drop guard (xdp_guard.c)
+extern void*    xguard_new(int max_appids, bool enforce, bool pass_other, char* err, size_t errlen);
+extern int      xguard_allow(void* guard, uint16_t appId, uint32_t rate_pps, uint32_t burst,
+                             char* err, size_t errlen);
+extern int      xguard_attach(void* guard, const char* ifname, bool generic, char* err, size_t errlen);
+extern void     xguard_report(void* guard);
+extern void     xguard_free(void* guard);
+
+//Verdict journal (journal.c), record must match its JRec
+typedef struct {
+  uint64_t ts_ns;       //kernel RX time (CLOCK_REALTIME)
+  uint32_t st, sq;
+  uint32_t proc_ns;     //RX hand-over to verdict
+  uint16_t appId;
+  int16_t  delta;       //bytes removed by strip
+  uint16_t len;         //frame length as received
+  uint8_t  dir;         //0 = A->B, 1 = B->A
+  uint8_t  worker;
+  uint8_t  kind;        //JK_*
+  int8_t   code;        //verifier result
+  int8_t   strip_rc;    //strip error, 0 = none
+  uint8_t  pad;
+} JRec;
+
+//What happened to a frame, must match bitw_journal.c
+enum {
+  JK_FWD,       //forwarded unchanged
+  JK_STRIP,     //forwarded, tag stripped
+  JK_TAIL,      //forwarded, stripped at a tag found by the tail fallback
+  JK_NOSTRIP,   //forwarded, strip wanted but not done (strip_rc says why)
+  JK_DROP,      //GOOSE dropped (code = verifier result)
+  JK_NONGOOSE,  //neither GOOSE nor PTP, dropped
+  JK_OTHER,     //neither GOOSE nor PTP, bridged (passOther)
+};
+
+extern void*    journal_open(const char* path, unsigned cap, char* err, size_t errlen);
+extern void*    journal_ring(void* journal);
+extern void     journal_put(void* ring, const JRec* rec);
+extern int      journal_start(void* journal, char* err, size_t errlen);
+extern void     journal_close(void* journal);
+
+//Live statistics in /dev/shm (shm_stats.c), must match its ShmDirCounters
+typedef struct {
+  uint64_t rx, fwd, drop;
+  uint64_t stripped, ptp, other;
+  uint64_t bytes_rx, bytes_fwd;
+  uint64_t rej[4];
+} ShmDirCounters;
+
+extern void*    shmstats_open(int ndirs, int nstrms, const char* mode, const char* io, char* err, size_t errlen);
+extern void*    shmstats_dir(void* stats, int idx, const char* name);
+extern void     shmstats_stream_init(void* stats, int idx, const char* name, uint16_t appId);
+extern void     shmstats_dir_publish(void* slot, const ShmDirCounters* c);
+extern void*    shmstats_dir_streams(void* stats, int idx);
+extern void     shmstats_stream_frame(void* row, int idx, uint32_t len, int rej, bool fwd, bool stripped,
+                                      uint32_t st, uint32_t sq, uint64_t ts_ns);
+extern void*    shmstats_dir_hist(void* stats, int idx);
+extern void*    shmstats_stream_hists(void* stats);
+extern void     shmstats_mode(void* stats, const char* mode);
+extern void     shmstats_close(void* stats);
+
+//Residence-time histograms (lat_hist.c)
+extern void*    lathist_new(int n);
+extern void*    lathist_at(void* base, int i);
+extern void     lathist_copy(void* dst, const void* src);
+extern void     lathist_add(void* hist, uint64_t ns);
+extern void     lathist_add_shared(void* hist, uint64_t ns);
+extern uint64_t lathist_pct(const void* cur, const void* prev, double q, uint64_t max);
+extern uint64_t lathist_count(const void* hist);
+extern uint64_t lathist_max(const void* hist);
+extern uint64_t lathist_sum(const void* hist);
 
 //Helpers
-static volatile int running = 1;
+static volatile sig_atomic_t running = 1;
 static void on_sig(int s) { (void)s; running = 0; }
+static volatile sig_atomic_t reload_req = 0;
+static void on_hup(int s) { (void)s; reload_req = 1; }
 
 static inline uint16_t be16(const uint8_t* p){ return (uint16_t)(p[0]<<8)|p[1]; }
 
@@ -98,29 +305,6 @@ static inline int parse_eth(const uint8_t* pkt, size_t len, int* out_is_goose, s
   }
 }
 
-//Find seq (0x61) value region and optional allData(0xAB) region
-static int locate_seq_and_allData(const uint8_t* f, size_t flen, size_t apdu_off,
-                                  size_t* seqV, size_t* seqE, size_t* allV, size_t* allE)
-{
-  if (apdu_off + 2 > flen || f[apdu_off] != 0x61) return -1;
-  size_t L,nL; if (!ber_len_read(f, flen, apdu_off+1, &L, &nL)) return -2;
-  size_t V = apdu_off + 1 + nL;
-  size_t E = V + L; if (E > flen) return -3;
-
-  if (seqV) { *seqV = V; }
-  if (seqE) { *seqE = E; }
-  if (allV) { *allV = 0; }
-  if (allE) { *allE = 0; }
-
-  //Search for 0xAB within seq
-  for (size_t p=V; p+2<=E; ) {
-    size_t L2,nL2; if (!ber_len_read(f, E, p+1, &L2, &nL2)) break;
-    if (f[p] == 0xAB) { if (allV) *allV = p + 1 + nL2; if (allE) *allE = (p + 1 + nL2 + L2); break; }
-    size_t nx = p + 1 + nL2 + L2; if (nx<=p || nx>E) break; p = nx;
-  }
-  return 0;
-}
-
 //FALLBACK: Find a TLV ending exactly at flen, with value len 8..64
 static int find_tail_tlv_as_tag(const uint8_t* frame, size_t flen, size_t apdu_off, int* tag_pos, int* tag_len)
 {
@@ -138,330 +322,1741 @@ static int find_tail_tlv_as_tag(const uint8_t* frame, size_t flen, size_t apdu_o
   return -1;
 }
 
-//Helpers to match the publisher's canonicalization exactly
-static size_t make_dataset_canon_from_frame(uint8_t *out, size_t out_max,
-                                            const uint8_t* f, size_t flen,
-                                            size_t apdu_off, int tag_pos)
-{
-  size_t seqV=0, seqE=0, allV=0, allE=0;
-  if (locate_seq_and_allData(f, flen, apdu_off, &seqV, &seqE, &allV, &allE) != 0 || !allV) return 0;
-
-  size_t w=0, p=allV; int idx=0;
-  while ((int)p < tag_pos && p + 2 <= allE) {
-    size_t L,nL; if (!ber_len_read(f,allE,p+1,&L,&nL)) break;
-    const uint8_t* val = f + p + 1 + nL;
-
-    if (idx == 0) {
-      if (w+3 > out_max) return w;
-      out[w++] = 0x01; out[w++] = 0x01;
-      uint8_t b = (L>0 && val[L-1]!=0) ? 1 : 0;
-      out[w++] = b;
-    } else if (idx == 1) {
-      if (w+6 > out_max) return w;
-      out[w++] = 0x02; out[w++] = 0x04;
-      uint32_t u=0; for (size_t k=0;k<L;k++) u=(u<<8)|val[k];
-      out[w++] = (uint8_t)(u>>24);
-      out[w++] = (uint8_t)(u>>16);
-      out[w++] = (uint8_t)(u>>8);
-      out[w++] = (uint8_t)(u);
-    } else {
-      break;
-    }
+//gocbRef is the first element of the GOOSE PDU (context tag 0x80)
+static bool frame_gocbRef_is(const uint8_t* f, const GooseFrame* G, const char* ref)
+{
+  const Span* r = &G->gocbRef;
+  if (!r->hdr || r->off != G->seq.off + G->seq.hdr) return false;
+  return strlen(ref) == r->len && memcmp(f + r->off + r->hdr, ref, r->len) == 0;
+}
+
+//Constant-time appId index. Only streams that share an appId fall through
+//to dstMac and then gocbRef to tell them apart
+static const Stream* stream_lookup(const Policy* P, const uint8_t* f, const GooseFrame* G)
+{
+  uint16_t i = P->by_appId[G->appId];
+  if (!i) return NULL;
+  const Stream* S = &P->strms[i-1];
+  if (!S->next) return S;
 
-    idx++;
-    p = p + 1 + nL + L;
-    if ((int)p >= tag_pos) break;
-  }
-  return w;
-}
-
-static size_t put_strF(uint8_t *b, size_t m, size_t w, const char* s){
-  size_t L = s? strlen(s):0;
-  if (w+2+L>m) return w;
-  b[w++]=0xF0; b[w++]=(uint8_t)L;
-  if (L){memcpy(b+w,s,L); w+=L;}
-  return w;
-}
-static size_t put_u16F(uint8_t *b, size_t m, size_t w, uint16_t v){
-  if (w+4>m) return w;
-  b[w++]=0xF1; b[w++]=2;
-  b[w++]=(uint8_t)((v>>8)&0xFF);
-  b[w++]=(uint8_t)(v&0xFF);
-  return w;
-}
-static size_t put_u32F(uint8_t *b, size_t m, size_t w, uint32_t v){
-  if (w+6>m) return w;
-  b[w++]=0xF2; b[w++]=4;
-  b[w++]=(uint8_t)((v>>24)&0xFF);
-  b[w++]=(uint8_t)((v>>16)&0xFF);
-  b[w++]=(uint8_t)((v>>8)&0xFF);
-  b[w++]=(uint8_t)(v&0xFF);
-  return w;
-}
-static size_t put_blobF(uint8_t *b, size_t m, size_t w, const uint8_t *d, size_t L){
-  if (w+2+L>m) return w;
-  b[w++]=0xF3; b[w++]=(uint8_t)L;
-  if (L){memcpy(b+w,d,L); w+=L;}
-  return w;
-}
-static size_t build_pub_canon(uint8_t *out, size_t out_max,
-                              const char* goID, const char* gocbRef, uint16_t appId,
-                              uint32_t stNum, uint32_t sqNum,
-                              const uint8_t* ds, size_t ds_len)
-{
-  size_t w=0;
-  w=put_strF(out,out_max,w,"GOOSE");
-  w=put_strF(out,out_max,w,goID);
-  w=put_strF(out,out_max,w,gocbRef);
-  w=put_u16F(out,out_max,w,appId);
-  w=put_u32F(out,out_max,w,stNum);
-  w=put_u32F(out,out_max,w,sqNum);
-  w=put_blobF(out,out_max,w,ds,ds_len);
-  return w;
-}
-
-static void build_info_simple(char *out, size_t n, const char* fmt,
-                              const char* goID, const char* gocbRef, uint16_t appId)
-{
-  size_t u=0;
-  while (*fmt && u+1<n) {
-    if (fmt[0]=='{' && strncmp(fmt,"{goID}",6)==0)    { u+=snprintf(out+u, n-u, "%s", goID);    fmt+=6; continue; }
-    if (fmt[0]=='{' && strncmp(fmt,"{gocbRef}",9)==0) { u+=snprintf(out+u, n-u, "%s", gocbRef); fmt+=9; continue; }
-    if (fmt[0]=='{' && strncmp(fmt,"{appId}",8)==0)   { u+=snprintf(out+u, n-u, "%u", (unsigned)appId); fmt+=8; continue; }
-    out[u++] = *fmt++;
-  }
-  out[u] = '\0';
+  const Stream* mac_hit = NULL;
+  for (; i; i = P->strms[i-1].next) {
+    S = &P->strms[i-1];
+    if (S->hasDstMac && memcmp(f, S->dstMac, 6) != 0) continue;
+    if (frame_gocbRef_is(f, G, S->gocbRef)) return S;
+    if (!mac_hit) mac_hit = S;
+  }
+  return mac_hit;
 }
 
 static inline bool tag_match_any16(const uint8_t* mac32, const uint8_t* tag16) {
   return memcmp(mac32, tag16, 16) == 0 || memcmp(mac32+16, tag16, 16) == 0;
 }
 
-//Verifier + freshness (STRICT, correct BER length)
-static int verify_hmac_and_freshness(const Policy* P,
-                                     const uint8_t* frame, size_t flen,
-                                     uint32_t* out_stNum, uint32_t* out_sqNum,
-                                     int* out_tag_pos, int* out_tag_len)
-{
-  struct { uint16_t appId; uint32_t stNum; uint32_t sqNum; int tag_pos; int tag_len; } M;
-  int mrc = goose_extract_meta(frame, flen, &M);
-  if (mrc != 0) return 10;
-
-  *out_stNum  = M.stNum;
-  *out_sqNum  = M.sqNum;
-  *out_tag_pos= M.tag_pos;
-  *out_tag_len= M.tag_len;
-
-  if (M.appId != P->strm.appId) return 11;
-
-  if (P->strm.allowUnsigned && M.tag_pos < 0) {
-    return freshness_check(M.stNum, M.sqNum, P->ttl_ms, P->maxSqGap, P->maxAge_ms);
-  }
-  if (M.tag_pos < 0) return 12;
-  //Tag length + #len-octets for correct V pointer
-  size_t tagVlen=0, nL=0;
-  if (!ber_len_read(frame, flen, (size_t)M.tag_pos+1, &tagVlen, &nL)) return 12;
-  if (tagVlen != 16 && tagVlen != 32) return 12;
-  const uint8_t* tagV = frame + (size_t)M.tag_pos + 1 + nL;
-
-  //Compute APDU offset
-  size_t apdu_off = 22;
-  uint16_t et = be16(frame + 12);
-  if (et == 0x8100) apdu_off = 26;
-
-  //Dataset canonicalization (matches publisher)
-  uint8_t ds[256];
-  size_t ds_len = make_dataset_canon_from_frame(ds, sizeof(ds), frame, flen, apdu_off, M.tag_pos);
-
-  //Publisher-style canonical blob
-  uint8_t pub[512];
-  size_t pub_len = build_pub_canon(pub, sizeof(pub),
-                             P->strm.goID, P->strm.gocbRef, P->strm.appId,
-                             M.stNum, M.sqNum, ds, ds_len);
-
-  //Additional raw candidates up to the tag
-  size_t seqV=0, seqE=0, allV=0, allE=0;
-  locate_seq_and_allData(frame, flen, apdu_off, &seqV, &seqE, &allV, &allE);
-
-  uint8_t v_all[2048]; size_t v_all_len = 0;
-  if (allV && (size_t)M.tag_pos > allV && (size_t)M.tag_pos <= allE) {
-    size_t L = (size_t)M.tag_pos - allV;
-    if (L > sizeof(v_all)) L = sizeof(v_all);
-    memcpy(v_all, frame + allV, L); v_all_len = L;
-  }
-
-  uint8_t v_seq[4096]; size_t v_seq_len = 0;
-  if (seqV && (size_t)M.tag_pos > seqV && (size_t)M.tag_pos <= seqE) {
-    size_t L = (size_t)M.tag_pos - seqV;
-    if (L > sizeof(v_seq)) L = sizeof(v_seq);
-    memcpy(v_seq, frame + seqV, L); v_seq_len = L;
-  }
-
-  //HKDF/OKM
-  char info[256];
-  build_info_simple(info, sizeof(info), P->dev.kdfInfoFmt,
-                    P->strm.goID, P->strm.gocbRef, P->strm.appId);
-  uint8_t prk[32]={0}, okm[32];
-  hkdf_sha256_extract(NULL, 0, P->dev.k_device, 32, prk, 32);
-  hkdf_sha256_expand(prk, 32, (const uint8_t*)info, strlen(info), okm, 32);
-
-  //Try pub, allData, seq
-  struct { const uint8_t* buf; size_t len; } cand[3] = {
-    {pub,    pub_len},
-    {v_all,  v_all_len},
-    {v_seq,  v_seq_len}
-  };
-  uint8_t mac[32];
-
-  for (int i=0;i<3;i++) {
-    if (!cand[i].len) continue;
-    hmac_sha256(okm, 32, cand[i].buf, cand[i].len, mac);
-    if (tagVlen==32 && memcmp(mac, tagV, 32)==0) {
-      int fr = freshness_check(M.stNum, M.sqNum, P->ttl_ms, P->maxSqGap, P->maxAge_ms);
-      return (fr==0) ? 0 : (20 + fr);
+//Verifier + freshness (STRICT), cheapest check first so a flood of
+//forged frames costs at most one HMAC each and unknown or replayed ones
+//cost none:
+//  1 appId table, straight from the header (V_UNKNOWN); G is not decoded
+//  2 decode + structure: lengths agree, tag present and sized (V_MALFORMED, V_BADTAG)
+//  3 stNum/sqNum precheck against the stream window, no state change (V_REPLAY)
+//  4 one HMAC in the stream's form (V_MAC), then commit the window (V_REPLAY)
+//verify_front() runs 1-2 and verify_window() 3; what changes state is
+//left to the caller, so a frame whose HMAC is batched (see vq_stage) is
+//committed in RX order.
+//Verdicts are V_*; *fr_out gets the freshness code behind a V_REPLAY
+enum { FRONT_MAC = -1, FRONT_UNSIGNED = -2 };   //HMAC left, or only the commit of an unsigned frame
+
+static int verify_front(const Policy* P,
+                        const uint8_t* frame, size_t flen, size_t apdu_off,
+                        GooseFrame* G, const Stream** out_S)
+{
+  if (!P->by_appId[be16(frame + apdu_off - 8)]) {
+    memset(G, 0, offsetof(GooseFrame, elem));
+    return V_UNKNOWN;
+  }
+
+  if (goose_decode(frame, flen, G) != 0) return V_MALFORMED;
+  size_t app_off = (size_t)G->apdu_off - 8;
+  size_t app_len = be16(frame + app_off + 2);
+  size_t pdu_end = (size_t)G->seq.off + G->seq.hdr + G->seq.len;
+  if (app_len < pdu_end - app_off || app_off + app_len > flen) return V_MALFORMED;
+
+  const Stream* S = stream_lookup(P, frame, G);
+  if (!S) return V_UNKNOWN;
+  *out_S = S;
+
+  if (S->allowUnsigned && !G->tag.hdr) return FRONT_UNSIGNED;
+  if (!G->tag.hdr) return V_BADTAG;
+  if (G->tag.len != 16 && G->tag.len != 32) return V_BADTAG;
+
+  return FRONT_MAC;
+}
+
+//Stage 3, for a frame verify_front() left at FRONT_MAC. held: frames of
+//the stream are batched ahead of it (see freshness_peek)
+static int verify_window(const Policy* P, const GooseFrame* G, const Stream* S, bool held, int* fr_out)
+{
+  int fr = freshness_peek(P->fresh, (int)(S - P->strms), G->stNum, G->sqNum, S->maxSqGap, S->maxAge_ms, held);
+  if (fr) { *fr_out = fr; return V_REPLAY; }
+  return FRONT_MAC;
+}
+
+static int verify_unsigned(const Policy* P, const GooseFrame* G, const Stream* S, int* fr_out)
+{
+  int fr = freshness_check(P->fresh, (int)(S - P->strms), G->stNum, G->sqNum, S->ttl_ms, S->maxSqGap, S->maxAge_ms);
+  *fr_out = fr;
+  return fr ? V_REPLAY : V_OK;
+}
+
+//MAC input of one form, as spans of the frame or of head/ds, and the
+//midstate to start from. Forms:
+//0 publisher-style canonical tail (prefix already absorbed in mac_pre),
+//  hashed as head + dataset spans
+//1 raw allData up to the tag, 2 raw PDU up to the tag, straight from the frame
+//Returns the span count, 0 when the form has nothing to hash
+static int mac_spans(const Stream* S, const uint8_t* frame, const GooseFrame* G, int form,
+                     uint8_t head[16], uint8_t ds[255], struct iovec v[2], const void** pre)
+{
+  if (form == 0) {
+    size_t ds_len = make_dataset_canon_from_frame(ds, 255, frame, G);
+    v[0].iov_base = head;
+    v[0].iov_len  = auth_canon_tail_head(head, 16, G->stNum, G->sqNum, ds_len);
+    v[1].iov_base = ds; v[1].iov_len = ds_len;
+    *pre = S->mac_pre;
+    return 2;
+  }
+  size_t V = form == 1 ? (size_t)G->all.off + G->all.hdr : (size_t)G->seq.off + G->seq.hdr;
+  v[0].iov_base = (void*)(frame + V); v[0].iov_len = G->tag.off - V;
+  *pre = S->mac_key;
+  return v[0].iov_len ? 1 : 0;
+}
+
+//Tag check for the MAC of one form; on a match the form is learned and
+//the window committed. -1 when the tag does not match
+static int mac_result(const Policy* P, const Stream* S, const uint8_t* frame, const GooseFrame* G,
+                      int form, const uint8_t mac[32], int* fr_out)
+{
+  const uint8_t* tagV = frame + G->tag.off + G->tag.hdr;
+  if (!((G->tag.len == 32 && memcmp(mac, tagV, 32) == 0) ||
+        (G->tag.len == 16 && tag_match_any16(mac, tagV)))) return -1;
+  int sidx = (int)(S - P->strms);
+  canon_sel_result(P->canon_sel, sidx, form, 1);
+  int fr = freshness_check(P->fresh, sidx, G->stNum, G->sqNum, S->ttl_ms, S->maxSqGap, S->maxAge_ms);
+  *fr_out = fr;
+  return fr ? V_REPLAY : V_OK;
+}
+
+#define CANON_PROBE 16   //must match auth_canon.c
+
+//None of the `tried` forms matched. Said once per stream when that uses
+//up its learning budget, the point from which pinning canon saves HMACs
+static void mac_miss(const Policy* P, const Stream* S, int tried)
+{
+  if (canon_sel_result(P->canon_sel, (int)(S - P->strms), -1, tried))
+    fprintf(stderr, "[canon %s] no MAC form matched in %d signed frames; trying pub, and "
+            "every form on 1 frame in %d. Pin \"canon\" in the policy if it is known\n",
+            S->name, P->canon_learn, CANON_PROBE);
+}
+
+//Stage 4 for one frame: only the form this stream uses (all of them until
+//it has learned one)
+static int verify_mac(const Policy* P, const uint8_t* frame, const GooseFrame* G, const Stream* S, int* fr_out)
+{
+  int sidx = (int)(S - P->strms), order[3];
+  int nform = canon_sel_order(P->canon_sel, sidx, S->canon, order);
+  for (int i=0;i<nform;i++) {
+    uint8_t ds[255], head[16], mac[32];
+    struct iovec v[2];
+    const void* pre;
+    int nv = mac_spans(S, frame, G, order[i], head, ds, v, &pre);
+    if (!nv) continue;
+    hmac_sha256_prefix_macv(pre, v, nv, mac);
+    int r = mac_result(P, S, frame, G, order[i], mac, fr_out);
+    if (r >= 0) return r;
+  }
+  mac_miss(P, S, nform);
+  return V_MAC;
+}
+
+//One bridge port, backed by libpcap, PACKET_MMAP rings (io_ring.c)
+//or an AF_XDP socket on the UMEM shared by both ports (io_xdp.c).
+//With --replay, a capture file read through pc and a dump file written
+//in place of the wire, see port_open_file()
+typedef struct {
+  const char* ifname;
+  pcap_t*     pc;
+  pcap_t*     txpc;   //separate send handle when another thread reads pc
+  void*       ring;
+  void*       xsk;
+  bool        file;   //replay: pc is a capture file, sends go to dump
+  pcap_dumper_t* dump;//replay: forwarded frames, NULL = discarded
+  bool        pace;   //replay: hand frames over at their recorded spacing
+  bool        eof;
+  const u_char* next; //replay: frame read but not due yet
+  struct pcap_pkthdr next_hdr;
+  int64_t     pace_off;   //wall clock minus capture clock, 0 = not started
+  uint64_t    due_ns;     //when next is due
+} Port;
+
+//Per-direction counters, written only by the thread serving that direction.
+//Latency (residence time) runs from the RX timestamp to the TX kick that
+//put the frame on the wire, see inflight_done()
+//Verifier stage a frame was turned away at, see verify_front(). Must
+//match verdict.c, which maps each verdict to its stage and journal code
+enum { REJ_UNKNOWN, REJ_MALFORMED, REJ_REPLAY, REJ_MAC, REJ_N };
+
+extern int verdict_decide(const uint8_t act[V_N], int v, int fr, int* ver, int* rej);
+
+typedef struct {
+  uint64_t rx, fwd, drop;
+  uint64_t stripped, ptp, other;   //other = bridged non-GOOSE
+  uint64_t bytes_rx, bytes_fwd;
+  uint64_t rej[REJ_N];   //by stage, counted in monitor mode too
+  uint64_t lat_max_ns;   //current report period, the rest is in Dir.lat
+  uint64_t next_report_ns;
+} __attribute__((aligned(64))) DirStats;
+
+//Egress queue, oldest first. Entries are pool buffers waiting for a
+//batched send, or left over from a partial one and retried on the next
+//flush. When full, the oldest frame is dropped: GOOSE state supersedes
+typedef struct {
+  uint8_t* buf[TXQ_MAX];
+  uint16_t len[TXQ_MAX];
+  uint64_t ts[TXQ_MAX];     //RX time and stream of each frame, for latency
+  int32_t  sidx[TXQ_MAX];
+  unsigned head, n;
+  uint64_t first_ns;    //when the oldest pending frame was queued
+  uint64_t batches, sent, retries, dropped, errors;
+} TxQueue;
+
+//Frames the TX port has taken but not necessarily sent yet. Ring and
+//AF_XDP sends only fill a slot, the frame leaves on the next kick, so the
+//residence time is taken once port_flush() returns. Capped below the
+//ring's own auto-kick (TX_FRAME_NR / 4) so no frame is kicked unseen
+#define INFLIGHT_MAX  TXQ_BURST
+
+typedef struct {
+  uint64_t ts[INFLIGHT_MAX];
+  int32_t  sidx[INFLIGHT_MAX];
+  unsigned n;
+} Inflight;
+
+//GOOSE frame waiting for its HMAC in a batch, see vq_stage()
+#define VQ_MAX  16
+
+typedef struct {
+  uint8_t*      buf;    //pool copy of the frame
+  size_t        len, apdu_off;
+  uint64_t      ts, t0;
+  const Stream* S;
+  int           form;   //MAC form being checked
+  const void*   pre;    //midstate it starts from
+  struct iovec  v[2];   //MAC input, in buf or head/ds
+  int           nv;
+  uint8_t       head[16], ds[255];
+  GooseFrame    G;
+} VerJob;
+
+//Replay only: where the time goes, per pipeline stage, and what the
+//verifier said. prof_to() charges the time since the last switch to the
+//stage that was running. Only sampled frames are timed, see prof_frame()
+enum { STG_RX, STG_DECODE, STG_FRESH, STG_MAC, STG_OUT, STG_N };
+#define PROF_SAMPLE 16   //one frame in this many, on average
+
+typedef struct {
+  uint64_t ns[STG_N];
+  uint64_t reads[STG_N]; //clock reads charged to each, taken out again in the report
+  double   clock_ns;     //cost of one read
+  uint64_t last;
+  int      cur;
+  bool     on;           //this frame is timed
+  uint32_t rng;
+  uint64_t n;            //frames timed
+  uint64_t ver[V_N];
+  uint64_t fresh[5];     //replays by freshness code
+  uint64_t nongoose;     //dropped non-GOOSE
+} Prof;
+
+typedef struct {
+  char          name[16];
+  Port*         rx;
+  Port*         tx;
+  const Policy* P;
+  int           cpu;
+  void*         pool;   //stripped and queued frames
+  void*         jr;     //verdict journal ring, NULL = no journal
+  uint8_t       jdir, jworker;
+  uint64_t      gen;    //policy generation P belongs to, see dir_sync()
+  void*         shm;    //live stats slot, NULL = none
+  void*         shm_strm;   //this thread's stream slots, NULL = none
+  void*         lat;    //residence-time histogram, in the stats segment if there is one
+  void*         lat_prev;   //copy of lat at the last period report
+  DirStats      st;
+  TxQueue       txq;
+  Inflight      inflight;
+  VerJob*       vq;     //frames waiting for a batched HMAC, NULL = batching off
+  int           vq_n, vq_max;
+  Prof*         prof;   //replay stage timing, NULL = live
+} Dir;
+
+static inline uint64_t now_ns(void)
+{
+  struct timespec ts; clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void prof_to(Dir* d, int stg)
+{
+  Prof* p = d->prof;
+  if (!p || !p->on) return;
+  uint64_t t = now_ns();
+  p->ns[p->cur] += t - p->last;
+  p->reads[p->cur]++;
+  p->last = t; p->cur = stg;
+}
+
+//Next frame: close the last sample and pick whether to time this one.
+//Picked at random so the samples do not beat with the HMAC batch, and
+//rarely so the clock reads stay out of the throughput figure
+static inline void prof_frame(Dir* d)
+{
+  Prof* p = d->prof;
+  if (!p) return;
+  prof_to(d, STG_RX);
+  p->rng ^= p->rng << 13; p->rng ^= p->rng >> 17; p->rng ^= p->rng << 5;
+  p->on = p->rng % PROF_SAMPLE == 0;
+  if (p->on) { p->last = now_ns(); p->cur = STG_RX; }
+}
+
+static void* xdp_pair = NULL;
+
+//Receive prefilter built from the policy (io_ring.c), NULL = none
+static void* rx_filter = NULL;
+static int   rx_filter_len = 0;
+
+//XDP guard in front of both ports, NULL = off
+static void* xguard = NULL;
+static bool  xguard_generic = false;
+
+//Verdict journal, NULL = off
+static void* journal = NULL;
+
+//Per-stream residence-time histograms, indexed by Stream.slot and shared
+//by all threads (lat_hist.c)
+static void* strm_lat = NULL;
+static int   strm_slots = 0, strm_slot_next = 0;
+
+//Running policy. A reload (SIGHUP) loads the file into a new table beside
+//it, publishes that here and bumps policy_gen; every thread switches before
+//its next frame (dir_sync) and the old table is freed once all have
+static Policy*     live_policy = NULL;
+static Policy*     boot_policy = NULL;   //main()'s, not heap allocated
+static uint64_t    policy_gen = 0;
+static const char* policy_path = NULL;
+
+//Live stats segment, NULL = could not be created
+static void* shm_stats = NULL;
+
+//Open a port in immediate mode so frames are handed over as they arrive
+//rather than when a TPACKET block fills or its timeout expires
+static pcap_t* open_port(const char* ifname, char* errbuf)
+{
+  pcap_t* p = pcap_create(ifname, errbuf);
+  if (!p) return NULL;
+  pcap_set_snaplen(p, 65535);
+  pcap_set_promisc(p, 1);
+  pcap_set_timeout(p, 1);
+  pcap_set_immediate_mode(p, 1);
+  int rc = pcap_activate(p);
+  if (rc < 0) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(p));
+    pcap_close(p);
+    return NULL;
+  }
+  //Frames sent on this port by another socket (the TX handle of
+  //--threads, a worker's send-only port) come back to this one as
+  //outgoing; forwarding them again would bounce them between the ports
+  if (pcap_setdirection(p, PCAP_D_IN) != 0) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "inbound only: %s", pcap_geterr(p));
+    pcap_close(p);
+    return NULL;
+  }
+  return p;
+}
+
+//Load the prefilter into the receive socket. Only saves work, so on
+//failure userspace simply keeps seeing everything. AF_XDP has no socket filter
+static void port_set_filter(Port* p)
+{
+  if (!rx_filter || p->xsk) return;
+  char err[PCAP_ERRBUF_SIZE];
+  if (p->ring) {
+    if (packet_set_filter(ring_fd(p->ring), rx_filter, rx_filter_len, err, sizeof(err)) != 0)
+      fprintf(stderr, "[prefilter] %s: %s\n", p->ifname, err);
+    return;
+  }
+  struct bpf_program bp = { (u_int)rx_filter_len, (struct bpf_insn*)rx_filter };
+  if (pcap_setfilter(p->pc, &bp) < 0)
+    fprintf(stderr, "[prefilter] %s: %s\n", p->ifname, pcap_geterr(p->pc));
+}
+
+static bool port_open(Port* p, const char* ifname, const char* io, char* errbuf)
+{
+  memset(p, 0, sizeof(*p));
+  p->ifname = ifname;
+  if (strcmp(io, "mmap") == 0) {
+    p->ring = ring_open(ifname, errbuf, PCAP_ERRBUF_SIZE);
+    if (p->ring) port_set_filter(p);
+    return p->ring != NULL;
+  }
+  p->pc = open_port(ifname, errbuf);
+  if (!p->pc) return false;
+  //Non-blocking so a drain stops at an empty ring; poll() does the waiting
+  if (pcap_setnonblock(p->pc, 1, errbuf) == -1)
+    fprintf(stderr, "setnonblock(%s): %s\n", ifname, errbuf);
+  port_set_filter(p);
+  return true;
+}
+
+//AF_XDP ports share one UMEM, so both sides are opened together
+static bool port_open_xdp(Port* a, const char* ifA, Port* b, const char* ifB, char* errbuf)
+{
+  memset(a, 0, sizeof(*a));
+  memset(b, 0, sizeof(*b));
+  a->ifname = ifA; b->ifname = ifB;
+  xdp_pair = xdp_open(ifA, ifB, xguard, xguard_generic, errbuf, PCAP_ERRBUF_SIZE);
+  if (!xdp_pair) return false;
+  a->xsk = xdp_port(xdp_pair, 0);
+  b->xsk = xdp_port(xdp_pair, 1);
+  return true;
+}
+
+//libpcap handles are not thread-safe, so with one thread per direction the
+//sending side gets its own handle. It only listens for outbound frames,
+//which it never sees for its own sends, so its buffer stays empty. The
+//RX handle on the same port does see them; open_port() keeps it inbound
+static pcap_t* open_tx_handle(const char* ifname, char* errbuf)
+{
+  pcap_t* t = pcap_create(ifname, errbuf);
+  if (!t) return NULL;
+  pcap_set_snaplen(t, 64);
+  pcap_set_buffer_size(t, 65536);
+  if (pcap_activate(t) < 0) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(t));
+    pcap_close(t);
+    return NULL;
+  }
+  pcap_setdirection(t, PCAP_D_OUT);
+  //Send only: keep the kernel from queueing copies of every frame to it
+  struct bpf_insn drop_all = { 0x06, 0, 0, 0 };   //ret #0
+  struct bpf_program none = { 1, &drop_all };
+  pcap_setfilter(t, &none);
+  return t;
+}
+
+static bool port_open_tx(Port* p, char* errbuf)
+{
+  if (!p->pc) return true;
+  p->txpc = open_tx_handle(p->ifname, errbuf);
+  return p->txpc != NULL;
+}
+
+//Send side of a worker: nothing is received on it
+static bool port_open_txonly(Port* p, const char* ifname, const char* io, char* errbuf)
+{
+  memset(p, 0, sizeof(*p));
+  p->ifname = ifname;
+  if (strcmp(io, "mmap") == 0) {
+    p->ring = ring_open_dir(ifname, false, true, errbuf, PCAP_ERRBUF_SIZE);
+    return p->ring != NULL;
+  }
+  p->txpc = open_tx_handle(ifname, errbuf);
+  return p->txpc != NULL;
+}
+
+static bool port_join_fanout(Port* p, uint16_t group, char* errbuf)
+{
+  int fd = p->ring ? ring_fd(p->ring) : pcap_fileno(p->pc);
+  return packet_fanout_join(fd, group, errbuf, PCAP_ERRBUF_SIZE) == 0;
+}
+
+//Replay ports: rx reads ifname as a capture file, tx writes what is
+//forwarded to out (NULL = count it and throw it away)
+static bool port_open_file(Port* rx, const char* in, bool pace, Port* tx, const char* out, char* errbuf)
+{
+  memset(rx, 0, sizeof(*rx));
+  memset(tx, 0, sizeof(*tx));
+  rx->ifname = in; rx->file = true; rx->pace = pace;
+  tx->ifname = out ? out : "(discard)"; tx->file = true;
+  rx->pc = pcap_open_offline(in, errbuf);
+  if (!rx->pc) return false;
+  if (pcap_datalink(rx->pc) != DLT_EN10MB) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: not an Ethernet capture", in);
+    pcap_close(rx->pc); rx->pc = NULL;
+    return false;
+  }
+  if (!out) return true;
+  tx->pc = pcap_open_dead(DLT_EN10MB, 65535);
+  tx->dump = tx->pc ? pcap_dump_open(tx->pc, out) : NULL;
+  if (!tx->dump) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", out, tx->pc ? pcap_geterr(tx->pc) : "out of memory");
+    if (tx->pc) pcap_close(tx->pc);
+    pcap_close(rx->pc);
+    rx->pc = tx->pc = NULL;
+    return false;
+  }
+  return true;
+}
+
+static void port_close(Port* p)
+{
+  if (p->dump) { pcap_dump_close(p->dump); p->dump = NULL; }
+  if (p->ring) ring_close(p->ring);
+  if (p->pc) pcap_close(p->pc);
+  if (p->txpc) pcap_close(p->txpc);
+  if (p->xsk && xdp_pair) { xdp_close(xdp_pair); xdp_pair = NULL; }
+  p->ring = NULL; p->pc = NULL; p->txpc = NULL; p->xsk = NULL;
+}
+
+static int port_fd(Port* p)
+{
+  if (p->file) return -1;
+  if (p->xsk) return xdp_fd(p->xsk);
+  return p->ring ? ring_fd(p->ring) : pcap_get_selectable_fd(p->pc);
+}
+
+//Next frame of a capture file. Paced, a frame that is not due yet is
+//kept and 0 returned, so the drain ends as it would on a quiet wire.
+//ts is when the frame enters the pipeline, so residence times are real
+static int file_rx(Port* p, const uint8_t** pkt, size_t* len, uint64_t* ts_ns)
+{
+  if (!p->next) {
+    struct pcap_pkthdr *hdr = NULL; const u_char *d = NULL;
+    int rc = pcap_next_ex(p->pc, &hdr, &d);
+    if (rc == PCAP_ERROR_BREAK) { p->eof = true; return 0; }
+    if (rc <= 0) {
+      fprintf(stderr, "[replay] %s: %s\n", p->ifname, pcap_geterr(p->pc));
+      p->eof = true;
+      return -1;
     }
-    if (tagVlen==16 && tag_match_any16(mac, tagV)) {
-      int fr = freshness_check(M.stNum, M.sqNum, P->ttl_ms, P->maxSqGap, P->maxAge_ms);
-      return (fr==0) ? 0 : (20 + fr);
+    p->next = d; p->next_hdr = *hdr;
+  }
+  uint64_t now = now_ns();
+  if (p->pace) {
+    int64_t rec = (int64_t)p->next_hdr.ts.tv_sec*1000000000LL + (int64_t)p->next_hdr.ts.tv_usec*1000LL;
+    if (!p->pace_off) p->pace_off = (int64_t)now - rec;
+    p->due_ns = (uint64_t)(rec + p->pace_off);
+    if (now < p->due_ns) return 0;
+  }
+  *pkt = p->next; *len = p->next_hdr.caplen; *ts_ns = now;
+  p->next = NULL;
+  return 1;
+}
+
+//Next frame, valid until the following port_rx() on the same port.
+//ts_ns is the kernel RX time, or now when the backend has none
+static int port_rx(Port* p, const uint8_t** pkt, size_t* len, uint64_t* ts_ns)
+{
+  if (p->file) return file_rx(p, pkt, len, ts_ns);
+  if (p->xsk) {
+    int rc = xdp_rx_next(p->xsk, (uint8_t**)pkt, len);
+    if (rc > 0) *ts_ns = now_ns();
+    return rc;
+  }
+  if (p->ring) return ring_rx_next(p->ring, pkt, len, ts_ns);
+  struct pcap_pkthdr *hdr = NULL; const u_char *d = NULL;
+  int rc = pcap_next_ex(p->pc, &hdr, &d);
+  if (rc <= 0) return rc;
+  *pkt = d; *len = hdr->caplen;
+  *ts_ns = (uint64_t)hdr->ts.tv_sec*1000000000ULL + (uint64_t)hdr->ts.tv_usec*1000ULL;
+  return 1;
+}
+
+//TX ring slot to build a frame in directly (NULL on the pcap backend)
+static uint8_t* port_tx_slot(Port* p, size_t* cap)
+{
+  return p->ring ? ring_tx_slot(p->ring, cap) : NULL;
+}
+
+static void port_flush(Port* p)
+{
+  if (p->xsk) xdp_tx_flush(p->xsk);
+  if (p->ring) ring_tx_flush(p->ring);
+}
+
+//Send up to k queued frames from the head in one go.
+//Returns how many left, or -1 when the head frame can never be sent
+static int port_send_batch(Port* p, const TxQueue* q, unsigned k)
+{
+  unsigned i = 0;
+  if (p->xsk) {
+    for (; i<k; i++) {
+      unsigned j = (q->head + i) % TXQ_MAX;
+      if (xdp_tx_send(p->xsk, q->buf[j], q->len[j]) != 0) break;
+    }
+    return (int)i;
+  }
+  if (p->ring) {
+    for (; i<k; i++) {
+      unsigned j = (q->head + i) % TXQ_MAX;
+      if (ring_tx_send(p->ring, q->buf[j], q->len[j]) != 0) break;
+    }
+    return (int)i;
+  }
+  if (p->file) {
+    if (p->dump) {
+      struct timeval tv; gettimeofday(&tv, NULL);
+      for (; i<k; i++) {
+        unsigned j = (q->head + i) % TXQ_MAX;
+        struct pcap_pkthdr h = { tv, q->len[j], q->len[j] };
+        pcap_dump((u_char*)p->dump, &h, q->buf[j]);
+      }
     }
+    return (int)k;
+  }
+  //pcap: the handle's packet socket is bound to the port, so one
+  //sendmmsg() moves the whole batch
+  struct mmsghdr mm[TXQ_BURST];
+  struct iovec   iov[TXQ_BURST];
+  if (k > TXQ_BURST) k = TXQ_BURST;
+  memset(mm, 0, sizeof(mm[0]) * k);
+  for (; i<k; i++) {
+    unsigned j = (q->head + i) % TXQ_MAX;
+    iov[i].iov_base = q->buf[j];
+    iov[i].iov_len  = q->len[j];
+    mm[i].msg_hdr.msg_iov    = &iov[i];
+    mm[i].msg_hdr.msg_iovlen = 1;
+  }
+  int fd = pcap_fileno(p->txpc ? p->txpc : p->pc);
+  int rc = sendmmsg(fd, mm, k, MSG_DONTWAIT);
+  if (rc >= 0) return rc;
+  if (errno == EAGAIN || errno == ENOBUFS || errno == EINTR) return 0;
+  fprintf(stderr, "[inject] %s: %s\n", p->ifname, strerror(errno));
+  return -1;
+}
+
+//Residence time of everything in flight, now that a kick has returned
+static void inflight_done(Dir* d)
+{
+  Inflight* f = &d->inflight;
+  if (!f->n) return;
+  uint64_t now = now_ns();
+  for (unsigned i=0;i<f->n;i++) {
+    uint64_t lat = now > f->ts[i] ? now - f->ts[i] : 0;
+    lathist_add(d->lat, lat);
+    if (lat > d->st.lat_max_ns) d->st.lat_max_ns = lat;
+    if (f->sidx[i] >= 0) lathist_add_shared(lathist_at(strm_lat, f->sidx[i]), lat);
+  }
+  f->n = 0;
+}
+
+static void inflight_add(Dir* d, uint64_t ts, int sidx)
+{
+  Inflight* f = &d->inflight;
+  if (f->n == INFLIGHT_MAX) { port_flush(d->tx); inflight_done(d); }
+  f->ts[f->n] = ts; f->sidx[f->n] = sidx;
+  f->n++;
+}
+
+//Release k frames from the head; sent ones go in flight
+static void txq_pop(Dir* d, unsigned k, bool sent)
+{
+  TxQueue* q = &d->txq;
+  for (unsigned i=0;i<k;i++) {
+    unsigned j = (q->head + i) % TXQ_MAX;
+    fpool_put(d->pool, q->buf[j]);
+    if (sent) inflight_add(d, q->ts[j], q->sidx[j]);
+  }
+  q->head = (q->head + k) % TXQ_MAX;
+  q->n -= k;
+  if (q->n) q->first_ns = now_ns();
+}
+
+//Push everything queued; whatever does not fit stays for the next flush
+static void txq_flush(Dir* d)
+{
+  TxQueue* q = &d->txq;
+  while (q->n) {
+    unsigned k = q->n < TXQ_BURST ? q->n : TXQ_BURST;
+    int rc = port_send_batch(d->tx, q, k);
+    q->batches++;
+    if (rc < 0) { q->errors++; txq_pop(d, 1, false); continue; }
+    q->sent += (uint64_t)rc;
+    txq_pop(d, (unsigned)rc, true);
+    if ((unsigned)rc < k) { q->retries++; break; }
+  }
+  port_flush(d->tx);
+  inflight_done(d);
+}
+
+static void txq_push(Dir* d, uint8_t* buf, size_t len, uint64_t ts, int sidx)
+{
+  TxQueue* q = &d->txq;
+  if (q->n == TXQ_MAX) { q->dropped++; txq_pop(d, 1, false); }
+  if (!q->n) q->first_ns = now_ns();
+  unsigned j = (q->head + q->n) % TXQ_MAX;
+  q->buf[j] = buf; q->len[j] = (uint16_t)len;
+  q->ts[j] = ts; q->sidx[j] = sidx;
+  q->n++;
+  if (q->n >= (unsigned)d->P->tx_batch) txq_flush(d);
+}
+
+//Hand a frame to the egress stage. pooled, when set, is the pool buffer
+//that already holds pkt. Ring and AF_XDP ports take the frame directly
+//while nothing is queued ahead of it; pcap frames are always batched.
+//ts and sidx (-1 = no stream) are kept for the residence time
+static void egress(Dir* d, const uint8_t* pkt, size_t len, uint8_t* pooled, uint64_t ts, int sidx)
+{
+  Port* rx = d->rx; Port* tx = d->tx;
+  if (d->txq.n == 0) {
+    int rc = -1;
+    if (tx->xsk) rc = pooled ? xdp_tx_send(tx->xsk, pkt, len) : xdp_tx_forward(rx->xsk, tx->xsk, pkt, len);
+    else if (tx->ring) rc = ring_tx_send(tx->ring, pkt, len);
+    if (rc == 0) { fpool_put(d->pool, pooled); inflight_add(d, ts, sidx); return; }
+  }
+  if (!pooled) {
+    pooled = len <= fpool_buf_size() ? fpool_get(d->pool) : NULL;
+    if (!pooled) { d->txq.dropped++; return; }
+    memcpy(pooled, pkt, len);
   }
-  return 13;
+  txq_push(d, pooled, len, ts, sidx);
+}
+
+//Deadline flush so a short burst is not held back waiting for a full batch
+static inline void txq_flush_due(Dir* d, uint64_t now)
+{
+  if (d->txq.n && now - d->txq.first_ns >= (uint64_t)d->P->tx_batch_us * 1000ULL) txq_flush(d);
 }
 
-//One place that handles verdict + stripping (with fallback)
-static void process_and_forward(pcap_t* rx, pcap_t* tx, const Policy* P)
+static uint64_t dir_sent(Dir* d, size_t len)
 {
+  d->st.fwd++;
+  d->st.bytes_fwd += len;
+  return now_ns();
+}
+
+//Period report (and reset), or the run totals when total is set
+static void dir_report(Dir* d, bool total)
+{
+  DirStats* s = &d->st;
+  const void* prev = total ? NULL : d->lat_prev;
+  uint64_t n   = lathist_count(d->lat) - (prev ? lathist_count(prev) : 0);
+  uint64_t sum = lathist_sum(d->lat) - (prev ? lathist_sum(prev) : 0);
+  uint64_t mx  = total ? lathist_max(d->lat) : s->lat_max_ns;
+  const TxQueue* q = &d->txq;
+  fprintf(stderr, "[%s %s] rx=%llu fwd=%llu drop=%llu"
+                  " lat avg=%.1fus p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus"
+                  " | rej unknown=%llu malformed=%llu replay=%llu mac=%llu"
+                  " | txq sent=%llu batches=%llu retries=%llu qdrop=%llu err=%llu\n",
+          total ? "total" : "stats", d->name, (unsigned long long)s->rx,
+          (unsigned long long)s->fwd, (unsigned long long)s->drop,
+          n ? (double)sum / (double)n / 1000.0 : 0.0,
+          (double)lathist_pct(d->lat, prev, 0.50, mx) / 1000.0,
+          (double)lathist_pct(d->lat, prev, 0.99, mx) / 1000.0,
+          (double)lathist_pct(d->lat, prev, 0.999, mx) / 1000.0, (double)mx / 1000.0,
+          (unsigned long long)s->rej[REJ_UNKNOWN], (unsigned long long)s->rej[REJ_MALFORMED],
+          (unsigned long long)s->rej[REJ_REPLAY], (unsigned long long)s->rej[REJ_MAC],
+          (unsigned long long)q->sent, (unsigned long long)q->batches,
+          (unsigned long long)q->retries, (unsigned long long)q->dropped,
+          (unsigned long long)q->errors);
+  s->lat_max_ns = 0;
+  if (!total) lathist_copy(d->lat_prev, d->lat);
+}
+
+//Copy this thread's counters to its live stats slot
+static void dir_publish(Dir* d)
+{
+  const DirStats* s = &d->st;
+  ShmDirCounters c = {
+    .rx = s->rx, .fwd = s->fwd, .drop = s->drop,
+    .stripped = s->stripped, .ptp = s->ptp, .other = s->other,
+    .bytes_rx = s->bytes_rx, .bytes_fwd = s->bytes_fwd,
+  };
+  memcpy(c.rej, s->rej, sizeof(c.rej));
+  shmstats_dir_publish(d->shm, &c);
+}
+
+//Periodic report, printed by the thread that owns the counters
+static void dir_report_maybe(Dir* d)
+{
+  if (d->P->stats_s <= 0) return;
+  uint64_t t = now_ns();
+  if (t < d->st.next_report_ns) return;
+  if (d->st.next_report_ns) dir_report(d, false);
+  d->st.next_report_ns = t + (uint64_t)d->P->stats_s * 1000000000ULL;
+}
+
+//Journal one verdict. Only a copy into this thread's ring; the journal
+//thread does the file I/O
+static void jlog(Dir* d, uint64_t ts, uint64_t t0, const GooseFrame* G, size_t len,
+                 int kind, int code, int strip_rc, ssize_t delta)
+{
+  JRec r;
+  memset(&r, 0, sizeof(r));
+  r.ts_ns   = ts ? ts : t0;
+  r.proc_ns = (uint32_t)(now_ns() - t0);
+  if (G) { r.appId = G->appId; r.st = G->stNum; r.sq = G->sqNum; }
+  r.len     = (uint16_t)len;
+  r.delta   = (int16_t)delta;
+  r.dir     = d->jdir;
+  r.worker  = d->jworker;
+  r.kind    = (uint8_t)kind;
+  r.code    = (int8_t)code;
+  r.strip_rc = (int8_t)strip_rc;
+  journal_put(d->jr, &r);
+}
+
+//Has a reload published a policy this thread is not using yet?
+static inline bool dir_stale(const Dir* d)
+{
+  return __atomic_load_n(&policy_gen, __ATOMIC_ACQUIRE) != d->gen;
+}
+
+//Move to the current policy, with its prefilter on our own receive socket.
+//Storing gen tells the reloader we no longer touch the old table
+static void dir_sync(Dir* d)
+{
+  uint64_t g = __atomic_load_n(&policy_gen, __ATOMIC_ACQUIRE);
+  d->P = __atomic_load_n(&live_policy, __ATOMIC_ACQUIRE);
+  port_set_filter(d->rx);
+  __atomic_store_n(&d->gen, g, __ATOMIC_RELEASE);
+}
+
+static void vq_run(Dir* d);
+
+//One place that handles verdict + stripping (with fallback). owned, when
+//set, is the pool buffer pkt was copied into for a batched HMAC: it can be
+//stripped in place and is handed on to egress or returned to the pool
+static void frame_out(Dir* d, const uint8_t* pkt, size_t caplen, uint8_t* owned,
+                      uint64_t ts, uint64_t t0, size_t apdu_off,
+                      const GooseFrame* G, const Stream* S, int v, int fr)
+{
+  Port* rx = d->rx; Port* tx = d->tx; const Policy* P = d->P;
+  //What to do was decided at load time, per stream and verdict
+  int ver, rej;
+  int act = verdict_decide(S ? S->act : P->act, v, fr, &ver, &rej);
+  if (rej >= 0) d->st.rej[rej]++;
+  if (d->prof) { d->prof->ver[v]++; if (v == V_REPLAY && fr >= 1 && fr <= 5) d->prof->fresh[fr-1]++; }
+  int sidx = S ? S->slot : -1;
+
+  const uint8_t* outp = pkt; size_t outlen = caplen;
+  uint8_t* buf = NULL;
+  bool in_slot = false;
+  int kind = JK_FWD, strip_rc = 0;
+
+  //Frames waiting on a batched HMAC arrived first, so they leave first
+  if (act != ACT_DROP && !owned && d->vq_n) vq_run(d);
+  switch (act) {
+  case ACT_DROP:
+    if (d->jr) jlog(d, ts, t0, G, caplen, JK_DROP, ver, 0, 0);
+    if (sidx >= 0 && d->shm_strm) shmstats_stream_frame(d->shm_strm, sidx, (uint32_t)caplen, rej, false, false, 0, 0, 0);
+    d->st.drop++;
+    fpool_put(d->pool, owned);
+    return;
+
+  case ACT_STRIP: {
+    int pos = G->tag.hdr ? G->tag.off : -1, len = G->tag.hdr ? G->tag.hdr + G->tag.len : 0;
+
+    //If parser didn't give a tag, try tail fallback (BER-correct)
+    bool tail = false;
+    if (!(pos > 0 && len > 0))
+      tail = find_tail_tlv_as_tag(pkt, caplen, apdu_off, &pos, &len) == 0;
+
+    if (pos > 0 && len > 0) {
+      //AF_XDP (or a batched copy): the buffer is ours, strip it in place.
+      //Otherwise build the stripped frame straight into the TX ring slot,
+      //or into a pool buffer for pcap, copying around the tag once
+      int sr;
+      if (rx->xsk || owned) {
+        sr = strip_last_octet_tag((uint8_t*)pkt, &outlen, G, pos, len);
+        if (sr == 0) buf = (uint8_t*)pkt;
+      } else {
+        //Only straight into the ring while nothing is queued ahead
+        size_t cap = 0;
+        buf = d->txq.n ? NULL : port_tx_slot(tx, &cap);
+        if (buf) in_slot = true;
+        else { buf = fpool_get(d->pool); cap = fpool_buf_size(); }
+        sr = buf ? strip_tag_copy(buf, cap, pkt, caplen, G, pos, len, &outlen) : -9;
+        if (sr != 0) {
+          //Slot not committed, so it is simply reused by the next frame
+          if (!in_slot) fpool_put(d->pool, buf);
+          in_slot = false; buf = NULL; outlen = caplen;
+        }
+      }
+      if (sr == 0) { outp = buf; kind = tail ? JK_TAIL : JK_STRIP; }
+      else         { kind = JK_NOSTRIP; strip_rc = sr; }
+    } else {
+      kind = JK_NOSTRIP;
+    }
+    break;
+  }
+
+  default:
+    break;
+  }
+
+  if (in_slot) { ring_tx_commit(tx->ring, outlen); inflight_add(d, ts, sidx); fpool_put(d->pool, owned); }
+  else if (outp == pkt) egress(d, pkt, outlen, owned, ts, sidx);
+  else { egress(d, outp, outlen, buf, ts, sidx); fpool_put(d->pool, owned); }
+  txq_flush_due(d, dir_sent(d, outlen));
+  bool stripped = kind == JK_STRIP || kind == JK_TAIL;
+  if (stripped) d->st.stripped++;
+  if (sidx >= 0 && d->shm_strm)
+    shmstats_stream_frame(d->shm_strm, sidx, (uint32_t)caplen, rej < 0 ? 0 : rej, true, stripped,
+                          G->stNum, G->sqNum, ts ? ts : now_ns());
+  if (d->jr) jlog(d, ts, t0, G, caplen, kind, ver, strip_rc, (ssize_t)caplen - (ssize_t)outlen);
+}
+
+//HMAC batch (engine hmacBatch > 1). A GOOSE frame that only has its HMAC
+//left is copied out of the RX buffer, which the next read may reuse, and
+//waits in d->vq. The batch runs when full, when RX is drained, and before
+//anything that must not overtake it: a frame being sent, a frame verified
+//on its own, a policy switch. Verdicts are then committed in RX order
+static bool vq_stage(Dir* d, const uint8_t* pkt, size_t len, size_t apdu_off,
+                     uint64_t ts, uint64_t t0, const Stream* S)
+{
+  const Policy* P = d->P;
+  int order[3];
+  //Streams still learning their MAC form try several; those go one by one
+  if (canon_sel_order(P->canon_sel, (int)(S - P->strms), S->canon, order) != 1) return false;
+  if (len > fpool_buf_size()) return false;
+  uint8_t* buf = fpool_get(d->pool);
+  if (!buf) return false;
+  VerJob* q = &d->vq[d->vq_n];
+  memcpy(buf, pkt, len);
+  q->nv = mac_spans(S, buf, &q->G, order[0], q->head, q->ds, q->v, &q->pre);
+  if (!q->nv) { fpool_put(d->pool, buf); return false; }
+  q->buf = buf; q->len = len; q->apdu_off = apdu_off;
+  q->ts = ts; q->t0 = t0; q->S = S; q->form = order[0];
+  if (++d->vq_n == d->vq_max) vq_run(d);
+  return true;
+}
+
+static bool vq_holds(const Dir* d, const Stream* S)
+{
+  for (int i=0;i<d->vq_n;i++) if (d->vq[i].S == S) return true;
+  return false;
+}
+
+static void vq_run(Dir* d)
+{
+  int n = d->vq_n;
+  if (!n) return;
+  d->vq_n = 0;
+  const void* pre[VQ_MAX] = {0};
+  const struct iovec* iov[VQ_MAX] = {0};
+  int nv[VQ_MAX] = {0};
+  uint8_t mac[VQ_MAX][32];
+  for (int i=0;i<n;i++) { pre[i] = d->vq[i].pre; iov[i] = d->vq[i].v; nv[i] = d->vq[i].nv; }
+  int stg = d->prof ? d->prof->cur : 0;
+  prof_to(d, STG_MAC);
+  hmac_sha256_prefix_macv_batch(pre, iov, nv, n, mac);
+
+  const Policy* P = d->P;
+  for (int i=0;i<n;i++) {
+    VerJob* q = &d->vq[i];
+    int fr = 0;
+    int v = mac_result(P, q->S, q->buf, &q->G, q->form, mac[i], &fr);
+    if (v < 0) { mac_miss(P, q->S, 1); v = V_MAC; }
+    prof_to(d, STG_OUT);
+    frame_out(d, q->buf, q->len, q->buf, q->ts, q->t0, q->apdu_off, &q->G, q->S, v, fr);
+    prof_to(d, STG_MAC);
+  }
+  prof_to(d, stg);
+}
+
+static void process_and_forward(Dir* d)
+{
+  Port* rx = d->rx; const Policy* P = d->P;
   while (running) {
-    struct pcap_pkthdr *hdr = NULL; const u_char *pkt = NULL;
-    int rc = pcap_next_ex(rx, &hdr, &pkt);
+    //A reload applies from the next frame; this one is not read yet
+    if (dir_stale(d)) { vq_run(d); dir_sync(d); P = d->P; }
+    const uint8_t *pkt = NULL; size_t caplen = 0; uint64_t ts = 0;
+    prof_frame(d);
+    int rc = port_rx(rx, &pkt, &caplen, &ts);
     if (rc <= 0) break;
+    if (d->prof && d->prof->on) d->prof->n++;
+    prof_to(d, STG_DECODE);
+    d->st.rx++;
+    d->st.bytes_rx += caplen;
+    uint64_t t0 = d->jr ? now_ns() : 0;
 
     //PTP passthrough (0x88f7 incl. VLAN)
     int is_ptp = 0;
-    if (hdr->caplen >= 14) {
+    if (caplen >= 14) {
       uint16_t et = ((uint16_t)pkt[12] << 8) | pkt[13];
       if (et == 0x88f7) {
         is_ptp = 1;
-      } else if (et == 0x8100 && hdr->caplen >= 18) {
+      } else if (et == 0x8100 && caplen >= 18) {
         uint16_t inner = ((uint16_t)pkt[16] << 8) | pkt[17];
         if (inner == 0x88f7) is_ptp = 1;
       }
     }
     if (is_ptp) {
-      int inj = pcap_inject(tx, pkt, (int)hdr->caplen);
-      if (inj != (int)hdr->caplen)
-        fprintf(stderr, "[inject-ptp] %s\n", pcap_geterr(tx));
+      d->st.ptp++;
+      prof_to(d, STG_OUT);
+      vq_run(d);
+      egress(d, pkt, caplen, NULL, ts, -1);
+      txq_flush_due(d, dir_sent(d, caplen));
       continue;
     }
 
     int is_goose=0, vlan=0; size_t apdu_off=0;
-    parse_eth(pkt, hdr->caplen, &is_goose, &apdu_off, &vlan);
+    parse_eth(pkt, caplen, &is_goose, &apdu_off, &vlan);
 
-    //STRICT drop non-GOOSE too
+    //STRICT drop non-GOOSE too, unless the policy bridges it
     if (!is_goose) {
-      fprintf(stderr, "[drop non-goose] len=%u\n", (unsigned)hdr->caplen);
+      if (P->pass_other) {
+        d->st.other++;
+        prof_to(d, STG_OUT);
+        vq_run(d);
+        egress(d, pkt, caplen, NULL, ts, -1);
+        txq_flush_due(d, dir_sent(d, caplen));
+        if (d->jr) jlog(d, ts, t0, NULL, caplen, JK_OTHER, 0, 0, 0);
+        continue;
+      }
+      if (d->jr) jlog(d, ts, t0, NULL, caplen, JK_NONGOOSE, 0, 0, 0);
+      if (d->prof) d->prof->nongoose++;
+      d->st.drop++;
       continue;
     }
 
-    uint32_t st=0, sq=0; int tag_pos=-1, tag_len=0;
-    int ver = verify_hmac_and_freshness(P, pkt, hdr->caplen, &st, &sq, &tag_pos, &tag_len);
+    //Decoded once inside the verifier; strip and the journal reuse G.
+    //With batching it is decoded straight into the next batch entry
+    GooseFrame Gl;
+    GooseFrame* G = d->vq ? &d->vq[d->vq_n].G : &Gl;
+    const Stream* S = NULL;
+    int fr = 0;
+    int v = verify_front(P, pkt, caplen, apdu_off, G, &S);
+    if (v == FRONT_MAC) {
+      prof_to(d, STG_FRESH);
+      v = verify_window(P, G, S, vq_holds(d, S), &fr);
+    }
+    if (v < 0) {
+      prof_to(d, STG_MAC);
+      if (v == FRONT_MAC && d->vq && vq_stage(d, pkt, caplen, apdu_off, ts, t0, S)) continue;
+      //Commits the stream's window, so whatever is batched goes first
+      vq_run(d);
+      v = v == FRONT_MAC ? verify_mac(P, pkt, G, S, &fr) : verify_unsigned(P, G, S, &fr);
+    }
+    prof_to(d, STG_OUT);
+    frame_out(d, pkt, caplen, NULL, ts, t0, apdu_off, G, S, v, fr);
+  }
+  //RX is drained: nothing else is coming to fill the batches
+  vq_run(d);
+  prof_to(d, STG_OUT);
+  txq_flush(d);
+  prof_to(d, STG_RX);
+  if (d->prof) d->prof->on = false;
+  if (d->shm) dir_publish(d);
+}
 
-    //Enforce only forward verified frames
-    bool pass = (strcmp(P->mode,"enforce")==0) ? (ver == 0) : true;
-    if (!pass) {
-      fprintf(stderr, "[drop] ver=%d st=%u sq=%u\n", ver, st, sq);
-      continue;
+//Per-stream freshness, MAC form and residence-time figures, printed at exit
+static void report_streams(const Policy* P)
+{
+  for (int i=0;i<P->nstrms;i++) {
+    freshness_report(P->fresh, i, P->strms[i].name);
+    canon_sel_report(P->canon_sel, i, P->strms[i].canon, P->strms[i].name);
+    if (P->strms[i].slot < 0) continue;
+    const void* h = lathist_at(strm_lat, P->strms[i].slot);
+    uint64_t mx = lathist_max(h);
+    if (lathist_count(h))
+      fprintf(stderr, "[lat %s] n=%llu p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n", P->strms[i].name,
+              (unsigned long long)lathist_count(h),
+              (double)lathist_pct(h, NULL, 0.50, mx) / 1000.0, (double)lathist_pct(h, NULL, 0.99, mx) / 1000.0,
+              (double)lathist_pct(h, NULL, 0.999, mx) / 1000.0, (double)mx / 1000.0);
+  }
+}
+
+//Residence-time histogram of thread idx: in the stats segment when there
+//is one, so the manager sees it too
+static bool dir_lat_init(Dir* d, int idx)
+{
+  d->lat = shm_stats ? shmstats_dir_hist(shm_stats, idx) : lathist_new(1);
+  d->lat_prev = lathist_new(1);
+  return d->lat && d->lat_prev;
+}
+
+static void dir_lat_free(Dir* d)
+{
+  if (!shm_stats) free(d->lat);
+  free(d->lat_prev);
+  d->lat = d->lat_prev = NULL;
+}
+
+//HMAC batch of a thread, none when hmacBatch is 1
+static bool dir_vq_init(Dir* d)
+{
+  if (d->P->hmac_batch <= 1) return true;
+  d->vq = (VerJob*)calloc((size_t)d->P->hmac_batch, sizeof(VerJob));
+  d->vq_max = d->P->hmac_batch;
+  return d->vq != NULL;
+}
+
+static void dir_vq_free(Dir* d)
+{
+  free(d->vq);
+  d->vq = NULL;
+}
+
+//The "engine" object is only read at start: the ports, threads and
+//journal are already set up, so a reload keeps the running settings
+static void policy_keep_engine(Policy* np, const Policy* old)
+{
+  memcpy(np->io, old->io, sizeof(np->io));
+  np->threads = old->threads;
+  np->workers = old->workers;
+  memcpy(np->cpus, old->cpus, sizeof(np->cpus));
+  np->ncpus = old->ncpus;
+  np->stats_s = old->stats_s;
+  np->tx_batch = old->tx_batch;
+  np->tx_batch_us = old->tx_batch_us;
+  np->hmac_batch = old->hmac_batch;
+  memcpy(np->xdp_guard, old->xdp_guard, sizeof(np->xdp_guard));
+  memcpy(np->journal, old->journal, sizeof(np->journal));
+  np->journal_recs = old->journal_recs;
+}
+
+//Old stream that np's stream S continues: same appId, gocbRef and goID
+static int policy_match(const Policy* old, const Stream* S)
+{
+  for (uint16_t j = old->by_appId[S->appId]; j; j = old->strms[j-1].next) {
+    const Stream* O = &old->strms[j-1];
+    if (strcmp(O->gocbRef, S->gocbRef) == 0 && strcmp(O->goID, S->goID) == 0) return j - 1;
+  }
+  return -1;
+}
+
+//Carry per-stream state from old into np for streams that still exist.
+//The first pass also hands out stats slots; returns how many carried over
+static int policy_carry(Policy* np, Policy* old, bool first)
+{
+  int carried = 0;
+  for (int i=0;i<np->nstrms;i++) {
+    Stream* S = &np->strms[i];
+    int j = policy_match(old, S);
+    if (first) {
+      if (j >= 0) S->slot = old->strms[j].slot;
+      else if (strm_slot_next < strm_slots) {
+        S->slot = strm_slot_next++;
+        shmstats_stream_init(shm_stats, S->slot, S->name, S->appId);
+      } else S->slot = -1;
     }
+    if (j < 0) continue;
+    freshness_carry(np->fresh, i, old->fresh, j);
+    canon_sel_carry(np->canon_sel, i, old->canon_sel, j);
+    carried++;
+  }
+  //Streams that are gone keep their slot, without a name the manager skips it
+  uint8_t* kept = first && shm_stats ? (uint8_t*)calloc((size_t)strm_slots, 1) : NULL;
+  if (kept) {
+    for (int i=0;i<np->nstrms;i++) if (np->strms[i].slot >= 0) kept[np->strms[i].slot] = 1;
+    for (int j=0;j<old->nstrms;j++)
+      if (old->strms[j].slot >= 0 && !kept[old->strms[j].slot])
+        shmstats_stream_init(shm_stats, old->strms[j].slot, "", 0);
+    free(kept);
+  }
+  return carried;
+}
+
+static void policy_release(Policy* p)
+{
+  policy_free(p);
+  if (p != boot_policy) free(p);
+}
 
-    const uint8_t* outp = pkt; size_t outlen = hdr->caplen;
-    uint8_t* buf = NULL;
+//SIGHUP: load the policy file again and swap it in, all or nothing.
+//Frames being verified finish under the old table, each thread takes the
+//new one before its next frame. same_thread: the caller also runs dirs,
+//so nothing else can be inside the old table
+static void policy_reload(Dir* dirs, int n, bool same_thread)
+{
+  Policy* old = live_policy;
+  Policy* np = (Policy*)calloc(1, sizeof(*np));
+  if (!np || !load_policy(policy_path, np)) {
+    fprintf(stderr, "[reload] cannot load '%s', keeping the running policy\n", policy_path);
+    free(np);
+    return;
+  }
+  policy_keep_engine(np, old);
+  void* filter = NULL;
+  int filter_len = 0;
+  if (strcmp(np->io, "xdp") != 0) {
+    filter_len = prefilter_build(np->by_appId, np->enforce, np->pass_other, &filter);
+    if (filter_len < 0) {
+      fprintf(stderr, "[reload] prefilter: out of memory, keeping the running policy\n");
+      policy_release(np);
+      return;
+    }
+  }
+  int carried = policy_carry(np, old, true);
 
-    if (P->stripTag) {
-      int pos = tag_pos, len = tag_len;
+  //Nobody reads the filter until the generation moves
+  void* old_filter = rx_filter;
+  rx_filter = filter; rx_filter_len = filter_len;
+  __atomic_store_n(&live_policy, np, __ATOMIC_RELEASE);
+  uint64_t g = __atomic_add_fetch(&policy_gen, 1, __ATOMIC_RELEASE);
 
-      //If parser didnt give a tag, try tail fallback (BER-correct)
-      if (!(pos > 0 && len > 0)) {
-        if (find_tail_tlv_as_tag(pkt, hdr->caplen, apdu_off, &pos, &len) == 0)
-          fprintf(stderr, "[tail-fallback] pos=%d len=%d\n", pos, len);
-      }
+  bool quiet = same_thread;
+  if (same_thread) for (int i=0;i<n;i++) dir_sync(&dirs[i]);
+  while (!quiet && running) {
+    quiet = true;
+    for (int i=0;i<n;i++) if (__atomic_load_n(&dirs[i].gen, __ATOMIC_ACQUIRE) != g) quiet = false;
+    if (!quiet) poll(NULL, 0, 1);
+  }
+  free(old_filter);
+  //Stopping before every thread moved: leave the old table to the exit
+  if (!quiet) return;
+  //What in-flight frames did to the old windows since the first pass
+  policy_carry(np, old, false);
+  policy_release(old);
 
-      if (pos > 0 && len > 0) {
-        buf = (uint8_t*) malloc(outlen);
-        memcpy(buf, pkt, outlen);
-        size_t before = outlen;
-        int sr = strip_last_octet_tag(buf, &outlen, pos, len);
-        if (sr == 0) {
-          fprintf(stderr, "[strip] pos=%d len=%d delta=%zd\n",
-                  pos, len, (ssize_t)before - (ssize_t)outlen);
-          outp = buf;
-        } else {
-          fprintf(stderr, "[strip] skipped rc=%d\n", sr);
-          free(buf); buf = NULL;
-        }
-      } else {
-        fprintf(stderr, "[strip] no tag candidate (pos=%d len=%d)\n", pos, len);
+  shmstats_mode(shm_stats, np->mode);
+  fprintf(stderr, "[reload] mode=%s stripTag=%s sqGap=%d maxAge=%dms streams=%d (%d carried over)%s\n",
+          np->mode, np->stripTag ? "true" : "false", np->maxSqGap, np->maxAge_ms, np->nstrms, carried,
+          xguard ? ", XDP guard keeps its start-up appIds and budgets" : "");
+}
+
+static int cpu_for(const Policy* P, int k)
+{
+  return P->ncpus > 0 ? P->cpus[k % P->ncpus] : -1;
+}
+
+//Threaded mode: one RX -> verify -> TX loop per direction
+static void* dir_thread(void* arg)
+{
+  Dir* d = (Dir*)arg;
+  if (d->cpu >= 0) {
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(d->cpu, &cs);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+    if (rc != 0) fprintf(stderr, "[bitw] %s: pin to cpu %d: %s\n", d->name, d->cpu, strerror(rc));
+  }
+  struct pollfd pfd = { .fd = port_fd(d->rx), .events = POLLIN };
+  while (running) {
+    //Frames left over from a partial send are retried every 1ms
+    int tmo = (pfd.fd < 0 || d->txq.n) ? 1 : 100;
+    int n = poll(&pfd, 1, tmo);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "[bitw] %s poll: %s\n", d->name, strerror(errno));
+      running = 0;
+      break;
+    }
+    if (n > 0 || pfd.fd < 0) process_and_forward(d);
+    else if (d->txq.n) txq_flush(d);
+    if (dir_stale(d)) dir_sync(d);
+    dir_report_maybe(d);
+  }
+  return NULL;
+}
+
+//Run one thread per Dir until a signal clears running
+static void run_threads(Dir* dirs, int n)
+{
+  //Workers keep SIGINT/SIGTERM/SIGHUP blocked so the main thread takes them
+  sigset_t ss, old;
+  sigemptyset(&ss); sigaddset(&ss, SIGINT); sigaddset(&ss, SIGTERM); sigaddset(&ss, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &ss, &old);
+  pthread_t th[128];
+  int started = 0;
+  for (; started < n; started++) {
+    int rc = pthread_create(&th[started], NULL, dir_thread, &dirs[started]);
+    if (rc != 0) { fprintf(stderr, "[bitw] pthread_create: %s\n", strerror(rc)); running = 0; break; }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  while (running) {
+    poll(NULL, 0, 200);
+    if (reload_req) { reload_req = 0; policy_reload(dirs, started, false); }
+  }
+  for (int i=0;i<started;i++) pthread_join(th[i], NULL);
+}
+
+//Worker pool: per ingress port, P->workers sockets in one PACKET_FANOUT
+//group, each with its own send-only port on the egress side. The fanout
+//demux keys on appId, so a stream's frames stay in order on one worker
+static int run_pool(const Policy* P, const char* ifA, const char* ifB)
+{
+  int n = P->workers, nd = 2 * n, rc = 0;
+  char errbuf[PCAP_ERRBUF_SIZE] = {0};
+  Port* rxp = (Port*)calloc((size_t)nd, sizeof(Port));
+  Port* txp = (Port*)calloc((size_t)nd, sizeof(Port));
+  Dir*  dirs = (Dir*)aligned_alloc(64, sizeof(Dir) * (size_t)nd);
+  if (!rxp || !txp || !dirs) { free(rxp); free(txp); free(dirs); return 5; }
+  memset(dirs, 0, sizeof(Dir) * (size_t)nd);
+
+  int opened = 0;
+  for (; opened < nd; opened++) {
+    int d = opened / n, w = opened % n;
+    const char* in  = d ? ifB : ifA;
+    const char* out = d ? ifA : ifB;
+    uint16_t group = (uint16_t)(((unsigned)getpid() << 1 | (unsigned)d) & 0xffff);
+    if (!port_open(&rxp[opened], in, P->io, errbuf) ||
+        !port_join_fanout(&rxp[opened], group, errbuf) ||
+        !port_open_txonly(&txp[opened], out, P->io, errbuf)) {
+      fprintf(stderr, "%s worker %s#%d: %s\n", P->io, d ? "B->A" : "A->B", w, errbuf);
+      port_close(&rxp[opened]); port_close(&txp[opened]);
+      rc = 3;
+      break;
+    }
+    Dir* D = &dirs[opened];
+    snprintf(D->name, sizeof(D->name), "%s#%d", d ? "B->A" : "A->B", w);
+    D->rx = &rxp[opened]; D->tx = &txp[opened]; D->P = P;
+    D->cpu = cpu_for(P, opened);
+    D->jr = journal_ring(journal);
+    D->jdir = (uint8_t)d; D->jworker = (uint8_t)w;
+    D->shm = shmstats_dir(shm_stats, opened, D->name);
+    D->shm_strm = shmstats_dir_streams(shm_stats, opened);
+    D->pool = fpool_new(DIR_POOL_BUFS);
+    if (!D->pool || !dir_lat_init(D, opened) || !dir_vq_init(D)) {
+      fprintf(stderr, "[bitw] frame pool for %s: out of memory\n", D->name);
+      port_close(&rxp[opened]); port_close(&txp[opened]);
+      fpool_free(D->pool, NULL); dir_lat_free(D); dir_vq_free(D);
+      rc = 5;
+      break;
+    }
+  }
+
+  if (rc == 0 && journal && journal_start(journal, errbuf, sizeof(errbuf)) != 0) {
+    fprintf(stderr, "[journal] %s\n", errbuf);
+    rc = 5;
+  }
+  if (rc == 0) {
+    fprintf(stderr, "[bitw] %d workers per port (PACKET_FANOUT by appId)\n", n);
+    run_threads(dirs, nd);
+    for (int i=0;i<nd;i++) { txq_flush(&dirs[i]); dir_report(&dirs[i], true); }
+  }
+  for (int i=0;i<opened;i++) {
+    port_close(&rxp[i]); port_close(&txp[i]);
+    fpool_free(dirs[i].pool, dirs[i].name);
+    dir_lat_free(&dirs[i]);
+    dir_vq_free(&dirs[i]);
+  }
+  free(rxp); free(txp); free(dirs);
+  return rc;
+}
+
+//Throughput, per-stage cost and verdict mix of a replay
+static void replay_report(const Dir* d, const char* in, const char* out, uint64_t wall_ns)
+{
+  const Prof* p = d->prof;
+  const DirStats* s = &d->st;
+  double n = s->rx ? (double)s->rx : 1.0;
+  double nt = p->n ? (double)p->n : 1.0;
+  double st[STG_N];
+  for (int i=0;i<STG_N;i++) {
+    st[i] = ((double)p->ns[i] - (double)p->reads[i] * p->clock_ns) / nt;
+    if (st[i] < 0) st[i] = 0;
+  }
+  fprintf(stderr, "[replay] %s: %llu frames in %.6fs, %.0f frames/s, %.1f ns/frame, %llu forwarded to %s\n",
+          in, (unsigned long long)s->rx, (double)wall_ns / 1e9,
+          wall_ns ? (double)s->rx * 1e9 / (double)wall_ns : 0.0, (double)wall_ns / n,
+          (unsigned long long)s->fwd, out ? out : "nowhere");
+  fprintf(stderr, "[replay] ns/frame rx=%.1f decode=%.1f fresh=%.1f mac=%.1f out=%.1f (%llu frames timed)\n",
+          st[STG_RX], st[STG_DECODE], st[STG_FRESH], st[STG_MAC], st[STG_OUT], (unsigned long long)p->n);
+  fprintf(stderr, "[replay] verdicts ok=%llu unknown=%llu malformed=%llu badTag=%llu mac=%llu"
+                  " replay=%llu (stOld=%llu sqDup=%llu sqGap=%llu sqReset=%llu stale=%llu)"
+                  " ptp=%llu other=%llu nonGoose=%llu stripped=%llu\n",
+          (unsigned long long)p->ver[V_OK], (unsigned long long)p->ver[V_UNKNOWN],
+          (unsigned long long)p->ver[V_MALFORMED], (unsigned long long)p->ver[V_BADTAG],
+          (unsigned long long)p->ver[V_MAC], (unsigned long long)p->ver[V_REPLAY],
+          (unsigned long long)p->fresh[0], (unsigned long long)p->fresh[1], (unsigned long long)p->fresh[2],
+          (unsigned long long)p->fresh[3], (unsigned long long)p->fresh[4],
+          (unsigned long long)s->ptp, (unsigned long long)s->other, (unsigned long long)p->nongoose,
+          (unsigned long long)s->stripped);
+}
+
+//--replay: the frames of a capture go through the A->B pipeline as if
+//they had arrived on ifA, and what would be sent is written to out. As
+//fast as the pipeline goes, or paced at the capture's own spacing. The
+//prefilter and the XDP guard live in the kernel and are not in the path,
+//so frames they would stop reach the verifier. Freshness ages run on the
+//wall clock, so only a paced replay sees a stream go stale over a gap
+static int run_replay(const Policy* P, const char* in, const char* out, bool pace)
+{
+  char errbuf[PCAP_ERRBUF_SIZE] = {0};
+  Port A, B;
+  if (!port_open_file(&A, in, pace, &B, out, errbuf)) {
+    fprintf(stderr, "[replay] %s\n", errbuf);
+    return 3;
+  }
+  Prof prof;
+  memset(&prof, 0, sizeof(prof));
+  prof.rng = 0x9E3779B9u;
+  uint64_t c0 = now_ns();
+  for (int i=0;i<1000;i++) (void)now_ns();
+  prof.clock_ns = (double)(now_ns() - c0) / 1000.0;
+  Dir d = { .name = "A->B", .rx = &A, .tx = &B, .P = P, .cpu = -1, .prof = &prof };
+  int rc = 0;
+  d.pool = fpool_new(DIR_POOL_BUFS);
+  if (!d.pool || !dir_lat_init(&d, 0) || !dir_vq_init(&d)) {
+    fprintf(stderr, "[bitw] frame pool: out of memory\n");
+    rc = 5;
+    goto out;
+  }
+  d.jr = journal_ring(journal);
+  d.shm = shmstats_dir(shm_stats, 0, d.name);
+  d.shm_strm = shmstats_dir_streams(shm_stats, 0);
+  if (journal && journal_start(journal, errbuf, sizeof(errbuf)) != 0) {
+    fprintf(stderr, "[journal] %s\n", errbuf);
+    rc = 5;
+    goto out;
+  }
+
+  uint64_t t0 = now_ns();
+  while (running && !A.eof) {
+    if (reload_req) { reload_req = 0; policy_reload(&d, 1, true); }
+    process_and_forward(&d);
+    dir_report_maybe(&d);
+    //Paced: wait for the next frame, in slices so signals are not held up
+    if (A.next) {
+      uint64_t now = now_ns();
+      if (A.due_ns > now) {
+        uint64_t w = A.due_ns - now < 100000000ULL ? A.due_ns - now : 100000000ULL;
+        struct timespec ts = { (time_t)(w / 1000000000ULL), (long)(w % 1000000000ULL) };
+        nanosleep(&ts, NULL);
       }
     }
+  }
+  uint64_t t1 = now_ns();
+  txq_flush(&d);
+  dir_report(&d, true);
+  replay_report(&d, in, out, t1 - t0);
+
+out:
+  fpool_free(d.pool, d.name);
+  dir_lat_free(&d);
+  dir_vq_free(&d);
+  port_close(&A);
+  port_close(&B);
+  return rc;
+}
 
-    int inj = pcap_inject(tx, outp, (int)outlen);
-    if (inj != (int)outlen) fprintf(stderr, "[inject] %s\n", pcap_geterr(tx));
-    if (buf) free(buf);
+//Guard maps from the policy: one budget per appId, the sum of its streams'
+//(any unlimited stream leaves the appId unlimited)
+static void* guard_build(const Policy* P, char* err, size_t errlen)
+{
+  int napp = 0;
+  for (uint32_t a=0;a<65536;a++) if (P->by_appId[a]) napp++;
+  void* g = xguard_new(napp, P->enforce, P->pass_other, err, errlen);
+  if (!g) return NULL;
+  for (uint32_t a=0;a<65536;a++) {
+    if (!P->by_appId[a]) continue;
+    uint64_t rate = 0, burst = 0;
+    bool unlimited = false;
+    for (uint16_t j = P->by_appId[a]; j; j = P->strms[j-1].next) {
+      const Stream* S = &P->strms[j-1];
+      if (S->max_rate <= 0) unlimited = true;
+      rate  += (uint64_t)(S->max_rate > 0 ? S->max_rate : 0);
+      burst += (uint64_t)(S->burst > 0 ? S->burst : 1);
+    }
+    if (rate > UINT32_MAX) rate = UINT32_MAX;
+    if (burst > UINT32_MAX) burst = UINT32_MAX;
+    if (xguard_allow(g, (uint16_t)a, unlimited ? 0 : (uint32_t)rate, (uint32_t)burst, err, errlen) != 0) {
+      xguard_free(g);
+      return NULL;
+    }
   }
+  return g;
+}
+
+static void usage(const char* argv0)
+{
+  fprintf(stderr, "Usage: %s [--io pcap|mmap|xdp] [--threads] [--workers N] [--cpus C0,C1,..] [--stats SEC]\n"
+                  "       [--tx-batch N] [--tx-batch-us US] [--hmac-batch N] [--xdp-guard off|auto|generic]\n"
+                  "       [--journal FILE]\n"
+                  "       <policy.json> <ifA> <ifB>\n"
+                  "   or: %s --replay IN.pcap [--out OUT.pcap] [--pace] [options] <policy.json>\n", argv0, argv0);
 }
 
 int main(int argc, char** argv)
 {
   //Expected by the manager: ./bitw_engine <policy.json> <ifA> <ifB>
-  if (argc < 4) {
-    fprintf(stderr, "Usage: %s <policy.json> <ifA> <ifB>\n", argv[0]);
+  //Options override the policy's "engine" object
+  const char* io_opt = NULL;
+  const char* cpus_opt = NULL;
+  const char* guard_opt = NULL;
+  const char* journal_opt = NULL;
+  const char* replay_opt = NULL;
+  const char* out_opt = NULL;
+  bool pace_opt = false;
+  int threads_opt = -1, stats_opt = -1, workers_opt = -1, batch_opt = -1, batch_us_opt = -1, hmac_opt = -1;
+  static const struct option longopts[] = {
+    { "io",      required_argument, NULL, 'i' },
+    { "threads", no_argument,       NULL, 't' },
+    { "cpus",    required_argument, NULL, 'c' },
+    { "workers", required_argument, NULL, 'w' },
+    { "tx-batch",    required_argument, NULL, 'b' },
+    { "tx-batch-us", required_argument, NULL, 'u' },
+    { "hmac-batch",  required_argument, NULL, 'm' },
+    { "stats",   required_argument, NULL, 's' },
+    { "xdp-guard",   required_argument, NULL, 'g' },
+    { "journal",     required_argument, NULL, 'j' },
+    { "replay",  required_argument, NULL, 'r' },
+    { "out",     required_argument, NULL, 'o' },
+    { "pace",    no_argument,       NULL, 'p' },
+    { "help",    no_argument,       NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+    switch (c) {
+      case 'i': io_opt = optarg; break;
+      case 't': threads_opt = 1; break;
+      case 'c': cpus_opt = optarg; break;
+      case 's': stats_opt = atoi(optarg); break;
+      case 'w': workers_opt = atoi(optarg); break;
+      case 'b': batch_opt = atoi(optarg); break;
+      case 'u': batch_us_opt = atoi(optarg); break;
+      case 'm': hmac_opt = atoi(optarg); break;
+      case 'g': guard_opt = optarg; break;
+      case 'j': journal_opt = optarg; break;
+      case 'r': replay_opt = optarg; break;
+      case 'o': out_opt = optarg; break;
+      case 'p': pace_opt = true; break;
+      default:  usage(argv[0]); return 1;
+    }
+  }
+  if (argc - optind < (replay_opt ? 1 : 3) || ((out_opt || pace_opt) && !replay_opt)) {
+    usage(argv[0]);
     return 1;
   }
-  const char* pol = argv[1];
-  const char* ifA = argv[2];
-  const char* ifB = argv[3];
+  const char* pol = argv[optind];
+  const char* ifA = replay_opt ? replay_opt : argv[optind+1];
+  const char* ifB = replay_opt ? out_opt : argv[optind+2];
 
   Policy P;
   if (!load_policy(pol, &P)) {
     fprintf(stderr, "[bitw] failed to load policy '%s'\n", pol);
     return 2;
   }
-  fprintf(stderr, "[bitw] mode=%s stripTag=%s ttl=%dms sqGap=%d maxAge=%dms appId=%u\n",
+  if (io_opt) snprintf(P.io, sizeof(P.io), "%s", io_opt);
+  if (strcmp(P.io, "pcap") != 0 && strcmp(P.io, "mmap") != 0 && strcmp(P.io, "xdp") != 0) {
+    fprintf(stderr, "[bitw] unknown io backend '%s'\n", P.io);
+    return 1;
+  }
+  if (guard_opt) snprintf(P.xdp_guard, sizeof(P.xdp_guard), "%s", guard_opt);
+  if (journal_opt) snprintf(P.journal, sizeof(P.journal), "%s", journal_opt);
+  if (strcmp(P.xdp_guard, "off") != 0 && strcmp(P.xdp_guard, "auto") != 0 && strcmp(P.xdp_guard, "generic") != 0) {
+    fprintf(stderr, "[bitw] unknown xdpGuard '%s' (off, auto or generic)\n", P.xdp_guard);
+    return 1;
+  }
+  if (threads_opt > 0) P.threads = true;
+  if (stats_opt >= 0) P.stats_s = stats_opt;
+  if (workers_opt > 0) P.workers = workers_opt;
+  if (batch_opt > 0) P.tx_batch = batch_opt;
+  if (batch_us_opt >= 0) P.tx_batch_us = batch_us_opt;
+  if (P.tx_batch < 1) P.tx_batch = 1;
+  if (P.tx_batch > TXQ_MAX) P.tx_batch = TXQ_MAX;
+  if (hmac_opt >= 0) P.hmac_batch = hmac_opt;
+  //Auto: a one-lane kernel (SHA extensions) is no faster in batches, and
+  //batching costs a copy of every frame
+  if (P.hmac_batch <= 0) P.hmac_batch = sha256_mb_lanes() > 1 ? 8 : 1;
+  if (P.hmac_batch > VQ_MAX) P.hmac_batch = VQ_MAX;
+  if (P.hmac_batch > 1) {
+    char herr[200];
+    if (hmac_sha256_batch_selftest(herr, sizeof(herr)) != 0) {
+      fprintf(stderr, "[bitw] HMAC batch self-test failed (%s), verifying one by one\n", herr);
+      P.hmac_batch = 1;
+    }
+  }
+  if (cpus_opt) {
+    P.ncpus = 0;
+    for (const char* q = cpus_opt; *q && P.ncpus < 16; ) {
+      char* e = NULL;
+      P.cpus[P.ncpus++] = (int)strtol(q, &e, 10);
+      if (e == q) { fprintf(stderr, "[bitw] --cpus expects a list like 0,1,2\n"); return 1; }
+      q = (*e == ',') ? e + 1 : e;
+    }
+  }
+  if (replay_opt) {
+    //One pipeline fed from the file: no ports, threads or kernel filters
+    snprintf(P.io, sizeof(P.io), "replay");
+    snprintf(P.xdp_guard, sizeof(P.xdp_guard), "off");
+    P.threads = false;
+    P.workers = 1;
+  }
+  if (P.workers > 1) {
+    if (strcmp(P.io, "xdp") == 0) {
+      fprintf(stderr, "[bitw] workers>1 needs io pcap or mmap (xdp serves queue 0 only)\n");
+      return 1;
+    }
+    if (P.workers > 64) P.workers = 64;
+    P.threads = true;
+  }
+  fprintf(stderr, "[bitw] mode=%s stripTag=%s ttl=%dms sqGap=%d maxAge=%dms devices=%d streams=%d io=%s threads=%s workers=%d txBatch=%d/%dus hmacBatch=%d/%s xdpGuard=%s\n",
           P.mode, P.stripTag ? "true" : "false",
-          P.ttl_ms, P.maxSqGap, P.maxAge_ms, (unsigned)P.strm.appId);
+          P.ttl_ms, P.maxSqGap, P.maxAge_ms, P.ndevs, P.nstrms, P.io, P.threads ? "yes" : "no",
+          P.workers, P.tx_batch, P.tx_batch_us, P.hmac_batch, P.hmac_batch > 1 ? sha256_mb_name() : "off", P.xdp_guard);
+  for (int i=0;i<P.nstrms;i++) {
+    const Stream* S = &P.strms[i];
+    fprintf(stderr, "[bitw]   %s/%s appId=%u gocbRef=%s canon=%s%s", P.devs[S->dev].deviceId, S->name,
+            (unsigned)S->appId, S->gocbRef, canon_name(S->canon), S->allowUnsigned ? " allowUnsigned" : "");
+    if (strcmp(P.xdp_guard, "off") != 0 && S->max_rate > 0) fprintf(stderr, " maxRate=%d/s burst=%d", S->max_rate, S->burst);
+    fputc('\n', stderr);
+  }
+
+  //Monitor forwards GOOSE of any appId, so only enforce filters on it
+  if (strcmp(P.io, "xdp") != 0 && !replay_opt) {
+    rx_filter_len = prefilter_build(P.by_appId, P.enforce, P.pass_other, &rx_filter);
+    if (rx_filter_len < 0) { rx_filter = NULL; rx_filter_len = 0; }
+    else fprintf(stderr, "[bitw] prefilter: %d BPF instructions\n", rx_filter_len);
+  }
+
+  //The guard is asked for explicitly and is the only place budgets are
+  //enforced, so unlike the prefilter a failure to load it is fatal.
+  //io xdp folds it into its redirect program, the others attach it here
+  if (strcmp(P.xdp_guard, "off") != 0) {
+    char gerr[256];
+    xguard_generic = strcmp(P.xdp_guard, "generic") == 0;
+    xguard = guard_build(&P, gerr, sizeof(gerr));
+    if (xguard && strcmp(P.io, "xdp") != 0 &&
+        (xguard_attach(xguard, ifA, xguard_generic, gerr, sizeof(gerr)) != 0 ||
+         xguard_attach(xguard, ifB, xguard_generic, gerr, sizeof(gerr)) != 0)) {
+      xguard_free(xguard); xguard = NULL;
+    }
+    if (!xguard) { fprintf(stderr, "[xguard] %s\n", gerr); return 3; }
+  }
+
+  if (P.journal[0]) {
+    char jerr[300];
+    journal = journal_open(P.journal, (unsigned)(P.journal_recs > 0 ? P.journal_recs : 0), jerr, sizeof(jerr));
+    if (!journal) { fprintf(stderr, "[journal] %s\n", jerr); return 3; }
+  }
+
+  //Only feeds the manager's live monitor, so failing is not fatal.
+  //Stream slots beyond the policy's are for streams a reload adds
+  {
+    char serr[300];
+    strm_slots = P.nstrms + STRM_SPARE_SLOTS;
+    strm_slot_next = P.nstrms;
+    shm_stats = shmstats_open(P.workers > 1 ? 2 * P.workers : 2, strm_slots, P.mode, P.io, serr, sizeof(serr));
+    if (!shm_stats) fprintf(stderr, "[shm] %s (no live stats)\n", serr);
+    for (int i=0;i<P.nstrms;i++) {
+      P.strms[i].slot = i;
+      shmstats_stream_init(shm_stats, i, P.strms[i].name, P.strms[i].appId);
+    }
+    strm_lat = shm_stats ? shmstats_stream_hists(shm_stats) : lathist_new(strm_slots);
+    if (!strm_lat) { fprintf(stderr, "[bitw] latency histograms: out of memory\n"); return 5; }
+  }
+  boot_policy = live_policy = &P;
+  policy_path = pol;
+
+  signal(SIGINT, on_sig);
+  signal(SIGTERM, on_sig);
+  signal(SIGHUP, on_hup);
+  if (P.workers > 1 || replay_opt) {
+    int rc = replay_opt ? run_replay(&P, ifA, ifB, pace_opt) : run_pool(&P, ifA, ifB);
+    journal_close(journal);
+    report_streams(live_policy);
+    if (!shm_stats) free(strm_lat);
+    shmstats_close(shm_stats);
+    xguard_report(xguard);
+    xguard_free(xguard);
+    free(rx_filter);
+    policy_release(live_policy);
+    return rc;
+  }
 
   char errbuf[PCAP_ERRBUF_SIZE] = {0};
-  pcap_t* capA = pcap_open_live(ifA, 65535, 1, 1, errbuf);
-  if (!capA) { fprintf(stderr, "pcap_open_live(%s): %s\n", ifA, errbuf); return 3; }
-  pcap_t* capB = pcap_open_live(ifB, 65535, 1, 1, errbuf);
-  if (!capB) { fprintf(stderr, "pcap_open_live(%s): %s\n", ifB, errbuf); return 4; }
-
-  //Low latency + responsive Ctrl-C
-  if (pcap_setnonblock(capA, 1, errbuf) == -1)
-    fprintf(stderr, "setnonblock(%s): %s\n", ifA, errbuf);
-  if (pcap_setnonblock(capB, 1, errbuf) == -1)
-    fprintf(stderr, "setnonblock(%s): %s\n", ifB, errbuf);
-  pcap_set_immediate_mode(capA, 1);
-  pcap_set_immediate_mode(capB, 1);
+  Port A, B;
+  if (strcmp(P.io, "xdp") == 0) {
+    if (!port_open_xdp(&A, ifA, &B, ifB, errbuf)) { fprintf(stderr, "xdp open(%s, %s): %s\n", ifA, ifB, errbuf); return 3; }
+  } else {
+    if (!port_open(&A, ifA, P.io, errbuf)) { fprintf(stderr, "%s open(%s): %s\n", P.io, ifA, errbuf); return 3; }
+    if (!port_open(&B, ifB, P.io, errbuf)) { fprintf(stderr, "%s open(%s): %s\n", P.io, ifB, errbuf); port_close(&A); return 4; }
+  }
+  if (P.threads && (!port_open_tx(&A, errbuf) || !port_open_tx(&B, errbuf))) {
+    fprintf(stderr, "pcap tx handle: %s\n", errbuf);
+    port_close(&A); port_close(&B);
+    return 4;
+  }
+
+  Dir dirs[2] = {
+    { .name = "A->B", .rx = &A, .tx = &B, .P = &P, .cpu = cpu_for(&P, 0) },
+    { .name = "B->A", .rx = &B, .tx = &A, .P = &P, .cpu = cpu_for(&P, 1) },
+  };
+  for (int i=0;i<2;i++) {
+    dirs[i].pool = fpool_new(DIR_POOL_BUFS);
+    if (!dirs[i].pool || !dir_lat_init(&dirs[i], i) || !dir_vq_init(&dirs[i])) {
+      fprintf(stderr, "[bitw] frame pool: out of memory\n");
+      port_close(&A); port_close(&B);
+      return 5;
+    }
+    dirs[i].jr = journal_ring(journal);
+    dirs[i].jdir = (uint8_t)i;
+    dirs[i].shm = shmstats_dir(shm_stats, i, dirs[i].name);
+    dirs[i].shm_strm = shmstats_dir_streams(shm_stats, i);
+  }
+  if (journal && journal_start(journal, errbuf, sizeof(errbuf)) != 0) {
+    fprintf(stderr, "[journal] %s\n", errbuf);
+    port_close(&A); port_close(&B);
+    return 5;
+  }
+
+  //Wake on whichever port becomes readable. Without a selectable fd we
+  //fall back to a 1 ms poll period instead of the old 5 ms sleep
+  int fdA = port_fd(&A);
+  int fdB = port_fd(&B);
+  int tmo = (fdA < 0 || fdB < 0) ? 1 : 100;
+  if (tmo == 1) fprintf(stderr, "[bitw] no selectable fd, polling every 1ms\n");
+  struct pollfd pfd[2] = { { .fd = fdA, .events = POLLIN }, { .fd = fdB, .events = POLLIN } };
 
   /*
-  NOTE: no BPF filter. We capture all traffic then:
+  NOTE: the XDP guard (if on) drops unknown appIds and over-budget GOOSE
+  before an skb exists, the kernel prefilter only lets PTP, GOOSE of policy
+  appIds (any appId in monitor mode) and, with passOther, everything else
+  through. Then:
      - fast-path PTP (0x88f7) across
      - run strict policy/HMAC on GOOSE (0x88b8)
-     - drop everything else
+     - drop everything else, or bridge it with passOther
   */
 
-  signal(SIGINT, on_sig);
-  signal(SIGTERM, on_sig);
+  if (P.threads) run_threads(dirs, 2);
 
   //No set direction so it can read both ways explicitly
   while (running) {
-    process_and_forward(capA, capB, &P); /* A -> B */
-    process_and_forward(capB, capA, &P); /* B -> A */
-    struct timespec ts = { .tv_sec = 0, .tv_nsec = 5 * 1000 * 1000 };
-    nanosleep(&ts, NULL);
+    if (reload_req) { reload_req = 0; policy_reload(dirs, 2, true); }
+    bool pending = dirs[0].txq.n || dirs[1].txq.n;
+    int n = poll(pfd, 2, pending ? 1 : tmo);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "[bitw] poll: %s\n", strerror(errno));
+      break;
+    }
+    if (n > 0 || tmo == 1) {
+      if (fdA < 0 || (pfd[0].revents & (POLLIN|POLLERR)))
+        process_and_forward(&dirs[0]); /* A -> B */
+      if (fdB < 0 || (pfd[1].revents & (POLLIN|POLLERR)))
+        process_and_forward(&dirs[1]); /* B -> A */
+    }
+    //Retry whatever a partial send left behind
+    if (dirs[0].txq.n) txq_flush(&dirs[0]);
+    if (dirs[1].txq.n) txq_flush(&dirs[1]);
+    dir_report_maybe(&dirs[0]);
+    dir_report_maybe(&dirs[1]);
   }
 
-  pcap_close(capA);
-  pcap_close(capB);
+  txq_flush(&dirs[0]);
+  txq_flush(&dirs[1]);
+  dir_report(&dirs[0], true);
+  dir_report(&dirs[1], true);
+  fpool_free(dirs[0].pool, dirs[0].name);
+  fpool_free(dirs[1].pool, dirs[1].name);
+  dir_lat_free(&dirs[0]);
+  dir_lat_free(&dirs[1]);
+  dir_vq_free(&dirs[0]);
+  dir_vq_free(&dirs[1]);
+  port_close(&A);
+  port_close(&B);
+  journal_close(journal);
+  report_streams(live_policy);
+  if (!shm_stats) free(strm_lat);
+  shmstats_close(shm_stats);
+  xguard_report(xguard);
+  xguard_free(xguard);
+  free(rx_filter);
+  policy_release(live_policy);
   return 0;
 }
@@ -0,0 +1,135 @@
+/*
+Verdict journal decoder
+------------------------
+  - Prints the file written by bitw_engine --journal, oldest record first
+  - Safe to run while the engine is still writing: it reads a snapshot
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Must match journal.c
+#define JRNL_MAGIC "GBJRNL1"
+
+typedef struct {
+  char     magic[8];
+  uint32_t rec_size;
+  uint32_t cap;
+  uint64_t written;
+  uint64_t overflow;
+  uint64_t start_ns;
+  uint8_t  pad[24];
+} JHeader;
+
+typedef struct {
+  uint64_t ts_ns;
+  uint32_t st, sq;
+  uint32_t proc_ns;
+  uint16_t appId;
+  int16_t  delta;
+  uint16_t len;
+  uint8_t  dir;
+  uint8_t  worker;
+  uint8_t  kind;
+  int8_t   code;
+  int8_t   strip_rc;
+  uint8_t  pad;
+} JRec;
+
+//Must match the JK_* order in bitw_engine.c
+enum { JK_FWD, JK_STRIP, JK_TAIL, JK_NOSTRIP, JK_DROP, JK_NONGOOSE, JK_OTHER };
+static const char* const kinds[] = { "fwd", "strip", "strip-tail", "nostrip", "drop", "non-goose", "other" };
+#define NKINDS (int)(sizeof(kinds)/sizeof(kinds[0]))
+
+//Verifier results, see ver_code[] in verdict.c
+static const char* ver_name(int v)
+{
+  if (v == 0)  return "ok";
+  if (v == 10) return "malformed";
+  if (v == 11) return "unknown";
+  if (v == 12) return "bad-tag";
+  if (v == 13) return "mac";
+  if (v > 20 || v < 10) return "replay";   //bare freshness code: unsigned stream
+  return "?";
+}
+
+static void usage(const char* argv0)
+{
+  fprintf(stderr, "Usage: %s [-n N] [--drops] <journal>\n"
+                  "  -n N     only the newest N records\n"
+                  "  --drops  only dropped frames\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+  uint64_t last = 0;
+  bool drops = false;
+  static const struct option longopts[] = {
+    { "drops", no_argument, NULL, 'd' },
+    { "help",  no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "n:h", longopts, NULL)) != -1) {
+    switch (c) {
+      case 'n': last = strtoull(optarg, NULL, 10); break;
+      case 'd': drops = true; break;
+      default:  usage(argv[0]); return 1;
+    }
+  }
+  if (argc - optind < 1) { usage(argv[0]); return 1; }
+  const char* path = argv[optind];
+
+  int fd = open(path, O_RDONLY|O_CLOEXEC);
+  struct stat sb;
+  if (fd < 0 || fstat(fd, &sb) != 0) { fprintf(stderr, "%s: %s\n", path, strerror(errno)); return 2; }
+  if ((size_t)sb.st_size < sizeof(JHeader)) { fprintf(stderr, "%s: not a journal\n", path); return 2; }
+  const uint8_t* m = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) { fprintf(stderr, "%s: %s\n", path, strerror(errno)); return 2; }
+  const JHeader* h = (const JHeader*)m;
+  if (memcmp(h->magic, JRNL_MAGIC, sizeof(JRNL_MAGIC)) != 0 || h->rec_size != sizeof(JRec) ||
+      sizeof(JHeader) + (size_t)h->cap * sizeof(JRec) > (size_t)sb.st_size) {
+    fprintf(stderr, "%s: not a journal (or a different version)\n", path);
+    return 2;
+  }
+  const JRec* recs = (const JRec*)(m + sizeof(JHeader));
+
+  uint64_t written = __atomic_load_n(&h->written, __ATOMIC_ACQUIRE);
+  uint64_t first = written > h->cap ? written - h->cap : 0;
+  if (last && written - first > last) first = written - last;
+  printf("# %s: %llu records written, %llu lost to full rings%s\n", path,
+         (unsigned long long)written, (unsigned long long)h->overflow,
+         written > h->cap ? ", oldest overwritten" : "");
+
+  for (uint64_t i = first; i < written; i++) {
+    JRec r = recs[i % h->cap];
+    if (drops && r.kind != JK_DROP && r.kind != JK_NONGOOSE) continue;
+    time_t sec = (time_t)(r.ts_ns / 1000000000ULL);
+    struct tm tm;
+    char tbuf[32];
+    localtime_r(&sec, &tm);
+    strftime(tbuf, sizeof(tbuf), "%H:%M:%S", &tm);
+    printf("%s.%09llu %s#%u %-10s appId=%u st=%u sq=%u len=%u",
+           tbuf, (unsigned long long)(r.ts_ns % 1000000000ULL), r.dir ? "B->A" : "A->B",
+           (unsigned)r.worker, r.kind < NKINDS ? kinds[r.kind] : "?",
+           (unsigned)r.appId, r.st, r.sq, (unsigned)r.len);
+    if (r.code) printf(" ver=%d(%s)", r.code, ver_name(r.code));
+    if (r.strip_rc) printf(" strip-rc=%d", r.strip_rc);
+    if (r.delta) printf(" delta=%d", r.delta);
+    printf(" proc=%uns\n", r.proc_ns);
+  }
+  munmap((void*)m, (size_t)sb.st_size);
+  close(fd);
+  return 0;
+}
@@ -18,10 +18,12 @@ This is the MAIN USER-FACING PROGRAM
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/mman.h>
 #include <json-c/json.h>
 
 #define ENGINE_BIN    "./bitw_engine"
 #define REGISTRY_PATH "policies/registry.json"
+#define SHM_STATS_FMT "/dev/shm/bitw_stats_%d"
 
 static bool file_exists(const char *p){ struct stat st; return (stat(p,&st)==0 && S_ISREG(st.st_mode)); }
 static bool dir_exists(const char *p){ struct stat st; return (stat(p,&st)==0 && S_ISDIR(st.st_mode)); }
@@ -122,7 +124,7 @@ static void stop_one(const char*arg){
             json_object_object_get_ex(e,"pid",&jp); pid_t pid=(pid_t)json_object_get_int(jp);
             const char *name=""; if (json_object_object_get_ex(e,"name",&jn)) name=json_object_get_string(jn);
             if (proc_alive(pid)){ kill(pid,SIGTERM); for(int k=0;k<30 && proc_alive(pid);++k) usleep(100*1000); if (proc_alive(pid)) kill(pid,SIGKILL); }
-            char pbuf[128]; snprintf(pbuf,sizeof(pbuf),"/tmp/bitw_status_%d.json",(int)pid); unlink(pbuf);
+            char pbuf[128]; snprintf(pbuf,sizeof(pbuf),SHM_STATS_FMT,(int)pid); unlink(pbuf);
             json_object_array_del_idx(reg,i,1); printf("Stopped %s (PID %d)\n", name, (int)pid);
         }
         registry_save(reg); json_object_put(reg); return;
@@ -136,22 +138,214 @@ static void stop_one(const char*arg){
         json_object_object_get_ex(e,"pid",&jp); pid_t pid=(pid_t)json_object_get_int(jp);
         const char *name=""; if (json_object_object_get_ex(e,"name",&jn)) name=json_object_get_string(jn);
         if (proc_alive(pid)){ kill(pid,SIGTERM); for(int k=0;k<30 && proc_alive(pid);++k) usleep(100*1000); if (proc_alive(pid)) kill(pid,SIGKILL); }
-        char pbuf[128]; snprintf(pbuf,sizeof(pbuf),"/tmp/bitw_status_%d.json",(int)pid); unlink(pbuf);
+        char pbuf[128]; snprintf(pbuf,sizeof(pbuf),SHM_STATS_FMT,(int)pid); unlink(pbuf);
         json_object_array_del_idx(reg,idx,1); registry_save(reg); printf("Stopped %s (PID %d)\n", name, (int)pid);
     } else printf("No matching entry.\n");
     json_object_put(reg);
 }
+//Edit the policy file, then reload: the engine swaps it in without dropping traffic
+static void reload_one(const char*arg){
+    struct json_object *reg=registry_load(); registry_prune_dead(reg);
+    char *end=NULL; long p=strtol(arg,&end,10);
+    int idx=-1;
+    if (end && *end=='\0' && p>0) registry_find_by_pid(reg,(pid_t)p,&idx);
+    else registry_find_by_name(reg,arg,&idx);
+    if (idx>=0){
+        struct json_object *e=json_object_array_get_idx(reg,idx), *jp=NULL, *jn=NULL;
+        json_object_object_get_ex(e,"pid",&jp); pid_t pid=(pid_t)json_object_get_int(jp);
+        const char *name=""; if (json_object_object_get_ex(e,"name",&jn)) name=json_object_get_string(jn);
+        if (kill(pid,SIGHUP)==0) printf("Reload sent to %s (PID %d)\n", name, (int)pid);
+        else printf("Reload %s (PID %d): %s\n", name, (int)pid, strerror(errno));
+    } else printf("No matching entry.\n");
+    json_object_put(reg);
+}
+
+//Live stats segment written by bitw_engine (shm_stats.c), must match its layout
+#define SHM_MAGIC   0x57544942u
+#define SHM_VERSION 3
+
+typedef struct {
+    uint32_t magic, version;
+    uint32_t hdr_size, dir_size, strm_size;
+    uint32_t ndirs, nstrms;           //stream slots: ndirs rows of nstrms
+    uint32_t pid;
+    uint64_t start_ns;
+    char     mode[16];
+    char     io[16];
+    uint32_t hist_size;
+    uint32_t pad0;
+    uint8_t  pad[48];
+} ShmHeader;
+
+typedef struct {
+    uint32_t seq, pad;
+    char     name[16];
+    uint64_t rx, fwd, drop;
+    uint64_t stripped, ptp, other;
+    uint64_t bytes_rx, bytes_fwd;
+    uint64_t rej[4];
+    uint64_t updated_ns;
+} ShmDir;
+
+typedef struct {
+    uint32_t seq;
+    uint16_t appId, pad;
+    char     name[40];
+    uint64_t rx, fwd, drop, stripped, bytes;
+    uint64_t rej[3];
+    uint32_t last_st, last_sq;
+    uint64_t last_ns;
+} ShmStrm;
+
+//Residence-time histogram (lat_hist.c), ndirs then nstrms of them after the slots
+#define LH_SUB_BITS 4
+#define LH_SUB      (1 << LH_SUB_BITS)
+#define LH_MAX_EXP  36
+#define LH_NB       ((LH_MAX_EXP - LH_SUB_BITS + 2) * LH_SUB)
+
+typedef struct {
+    uint64_t n, sum_ns, max_ns;
+    uint64_t pad[5];
+    uint64_t b[LH_NB];
+} LatHist;
+
+//p50/p99/p99.9/max in us, from a racy copy: counters only ever grow
+static void lat_fmt(const LatHist *src, char *out, size_t len){
+    static const double q[3]={0.50,0.99,0.999};
+    LatHist h; memcpy(&h,src,sizeof(h));
+    uint64_t tot=0; for(int i=0;i<LH_NB;++i) tot+=h.b[i];
+    if (!tot){ snprintf(out,len,"-"); return; }
+    double v[3]; int k=0; uint64_t acc=0;
+    for(int i=0;i<LH_NB && k<3;++i){
+        acc+=h.b[i];
+        while (k<3 && acc>=(uint64_t)(q[k]*(double)tot+0.999999)){
+            uint64_t up = i<LH_SUB ? (uint64_t)i
+                        : ((uint64_t)(LH_SUB+i%LH_SUB+1)<<(i/LH_SUB-1))-1;
+            v[k++]=(double)(up<h.max_ns ? up : h.max_ns)/1000.0;
+        }
+    }
+    while (k<3) v[k++]=(double)h.max_ns/1000.0;
+    snprintf(out,len,"%.0f/%.0f/%.0f/%.0f",v[0],v[1],v[2],(double)h.max_ns/1000.0);
+}
+
+#define LIVE_MAX_STREAMS 32   //stream lines shown per engine
+
+//Seqlock read: copy the slot, retry while a writer is inside or got in between
+static bool seq_copy(void *dst, const void *src, size_t n){
+    const uint32_t *seq=(const uint32_t*)src;
+    for(int tries=0; tries<1000; ++tries){
+        uint32_t s1=__atomic_load_n(seq,__ATOMIC_ACQUIRE);
+        if (s1&1) continue;
+        memcpy(dst,src,n);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(seq,__ATOMIC_RELAXED)==s1) return true;
+    }
+    return false;
+}
+
+static uint64_t wall_ns(void){ struct timespec ts; clock_gettime(CLOCK_REALTIME,&ts); return (uint64_t)ts.tv_sec*1000000000ULL+(uint64_t)ts.tv_nsec; }
+
+//Previous sample per engine thread, for frame rates
+static struct { pid_t pid; int idx; uint64_t rx, fwd, t; } live_prev[256];
+static int live_nprev=0;
+static void live_rate(pid_t pid, int idx, const ShmDir *d, uint64_t now, double *rx_fps, double *fwd_fps){
+    int k=0;
+    while (k<live_nprev && !(live_prev[k].pid==pid && live_prev[k].idx==idx)) ++k;
+    *rx_fps=*fwd_fps=0;
+    if (k<live_nprev && now>live_prev[k].t){
+        double dt=(double)(now-live_prev[k].t)/1e9;
+        *rx_fps=(double)(d->rx-live_prev[k].rx)/dt; *fwd_fps=(double)(d->fwd-live_prev[k].fwd)/dt;
+    } else if (k==live_nprev){
+        if (live_nprev==256) return;
+        live_nprev++;
+    }
+    live_prev[k].pid=pid; live_prev[k].idx=idx; live_prev[k].rx=d->rx; live_prev[k].fwd=d->fwd; live_prev[k].t=now;
+}
+
+//Stream i summed over the threads' rows; last st/sq from the most recent.
+//False when no row could be read
+static bool strm_sum(ShmStrm *out, const ShmStrm *strms, uint32_t ndirs, uint32_t nstrms, uint32_t i){
+    bool any=false;
+    memset(out,0,sizeof(*out));
+    for(uint32_t t=0;t<ndirs;++t){
+        ShmStrm r; if (!seq_copy(&r,&strms[(size_t)t*nstrms+i],sizeof(r))) continue;
+        if (!any){ memcpy(out->name,r.name,sizeof(out->name)); out->appId=r.appId; any=true; }
+        out->rx+=r.rx; out->fwd+=r.fwd; out->drop+=r.drop; out->stripped+=r.stripped; out->bytes+=r.bytes;
+        for(int k=0;k<3;++k) out->rej[k]+=r.rej[k];
+        if (r.last_ns>out->last_ns){ out->last_st=r.last_st; out->last_sq=r.last_sq; out->last_ns=r.last_ns; }
+    }
+    return any;
+}
+
+//Map the engine's segment read-only and print it. Returns false without one
+static bool live_engine(pid_t pid, const char *name, const char *ifA, const char *ifB){
+    char path[64]; snprintf(path,sizeof(path),SHM_STATS_FMT,(int)pid);
+    int fd=open(path,O_RDONLY|O_CLOEXEC); if (fd<0) return false;
+    struct stat sb; void *m=MAP_FAILED;
+    if (fstat(fd,&sb)==0 && (size_t)sb.st_size>=sizeof(ShmHeader)) m=mmap(NULL,(size_t)sb.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if (m==MAP_FAILED) return false;
+    const ShmHeader *h=(const ShmHeader*)m;
+    bool ok = __atomic_load_n(&h->magic,__ATOMIC_ACQUIRE)==SHM_MAGIC && h->version==SHM_VERSION &&
+              h->hdr_size==sizeof(ShmHeader) && h->dir_size==sizeof(ShmDir) && h->strm_size==sizeof(ShmStrm) &&
+              h->hist_size==sizeof(LatHist) &&
+              sizeof(ShmHeader)+(size_t)h->ndirs*sizeof(ShmDir)+(size_t)h->ndirs*h->nstrms*sizeof(ShmStrm)
+              +(size_t)(h->ndirs+h->nstrms)*sizeof(LatHist)<=(size_t)sb.st_size;
+    if (!ok){ munmap(m,(size_t)sb.st_size); return false; }
+    const ShmDir *dirs=(const ShmDir*)((const uint8_t*)m+sizeof(ShmHeader));
+    const ShmStrm *strms=(const ShmStrm*)((const uint8_t*)m+sizeof(ShmHeader)+(size_t)h->ndirs*sizeof(ShmDir));
+    const LatHist *dlat=(const LatHist*)(strms+(size_t)h->ndirs*h->nstrms), *slat=dlat+h->ndirs;
+    char lat[64];
+    uint64_t now=wall_ns();
+
+    //Slots without a name are spares, or streams a reload removed. Every
+    //thread's row carries the names, the first row is enough to count them
+    unsigned named=0;
+    for(uint32_t i=0;i<h->nstrms;++i) if (strms[i].name[0]) ++named;
+    printf("%-6d %-18s %s <-> %s  mode=%s io=%s up=%llus streams=%u\n",(int)pid,name,ifA,ifB,h->mode,h->io,
+           (unsigned long long)((now-h->start_ns)/1000000000ULL),named);
+    printf("    %-9s %10s %10s %8s %8s %8s %7s %9s %9s  %-32s  %s\n","thread","rx","fwd","drop","strip","ptp","other","rx/s","fwd/s","rej unknown/malformed/replay/mac","lat p50/p99/p99.9/max us");
+    for(uint32_t i=0;i<h->ndirs;++i){
+        ShmDir d; if (!seq_copy(&d,&dirs[i],sizeof(d)) || !d.name[0]) continue;
+        double rxr,fwr; live_rate(pid,(int)i,&d,now,&rxr,&fwr);
+        char rej[64]; lat_fmt(&dlat[i],lat,sizeof(lat));
+        snprintf(rej,sizeof(rej),"%llu/%llu/%llu/%llu",
+                 (unsigned long long)d.rej[0],(unsigned long long)d.rej[1],(unsigned long long)d.rej[2],(unsigned long long)d.rej[3]);
+        printf("    %-9s %10llu %10llu %8llu %8llu %8llu %7llu %9.0f %9.0f  %-32s  %s\n",d.name,
+               (unsigned long long)d.rx,(unsigned long long)d.fwd,(unsigned long long)d.drop,(unsigned long long)d.stripped,
+               (unsigned long long)d.ptp,(unsigned long long)d.other,rxr,fwr,rej,lat);
+    }
+    printf("    %-20s %6s %10s %10s %8s %8s %12s %8s  %-24s  %s\n","stream","appId","rx","fwd","drop","strip","last st/sq","age","rej malformed/replay/mac","lat p50/p99/p99.9/max us");
+    unsigned shown=0;
+    for(uint32_t i=0;i<h->nstrms && shown<LIVE_MAX_STREAMS;++i){
+        ShmStrm t; if (!strm_sum(&t,strms,h->ndirs,h->nstrms,i) || !t.name[0]) continue;
+        ++shown;
+        char sqbuf[24]="-", age[16]="-";
+        if (t.last_ns){
+            snprintf(sqbuf,sizeof(sqbuf),"%u/%u",t.last_st,t.last_sq);
+            double a=now>t.last_ns ? (double)(now-t.last_ns)/1e9 : 0;
+            snprintf(age,sizeof(age),"%.1fs",a);
+        }
+        char rej[64]; lat_fmt(&slat[i],lat,sizeof(lat));
+        snprintf(rej,sizeof(rej),"%llu/%llu/%llu",(unsigned long long)t.rej[0],(unsigned long long)t.rej[1],(unsigned long long)t.rej[2]);
+        printf("    %-20.20s %6u %10llu %10llu %8llu %8llu %12s %8s  %-24s  %s\n",t.name,(unsigned)t.appId,
+               (unsigned long long)t.rx,(unsigned long long)t.fwd,(unsigned long long)t.drop,(unsigned long long)t.stripped,
+               sqbuf,age,rej,lat);
+    }
+    if (named>shown) printf("    ... %u more streams\n",named-shown);
+    munmap(m,(size_t)sb.st_size);
+    return true;
+}
 
-//Live status monitor
+//Live status monitor: reads each engine's /dev/shm segment, never touches the engine
 static volatile sig_atomic_t live_exit=0;
 static void on_sigint(int s){ (void)s; live_exit=1; }
 static void live_monitor(void){
+    live_exit=0;
     signal(SIGINT,on_sigint);
     while(!live_exit){
-        (void)!system("clear");
+        printf("\033[H\033[2J");
         printf("Live Monitor (Ctrl+C to exit)\n\n");
-        printf("%-6s %-18s %-10s %-10s %-19s %-6s %-8s\n","PID","Name","IfA","IfB","Last Packet (UTC)","Strips","#Streams");
-        printf("------ ------------------ ---------- ---------- ------------------- ------ --------\n");
 
         struct json_object *reg=registry_load();
         int len=json_object_array_length(reg);
@@ -163,28 +357,15 @@ static void live_monitor(void){
             if (json_object_object_get_ex(e,"ifA",&ja)) ifA=json_object_get_string(ja);
             if (json_object_object_get_ex(e,"ifB",&jb)) ifB=json_object_get_string(jb);
             if (json_object_object_get_ex(e,"policy",&jpol)) policy=json_object_get_string(jpol);
-            char pbuf[128]; snprintf(pbuf,sizeof(pbuf),"/tmp/bitw_status_%d.json",(int)pid);
-            char tsbuf[20]=""; int strips=0; int streams=0;
-            if (file_exists(pbuf)){
-                struct json_object *st=json_object_from_file(pbuf);
-                if (st){
-                    struct json_object *t=NULL,*s=NULL,*n=NULL;
-                    if (json_object_object_get_ex(st,"lastPacketUtc",&t)){
-                        time_t tt=(time_t)json_object_get_int64(t); struct tm tm; gmtime_r(&tt,&tm);
-                        strftime(tsbuf,sizeof(tsbuf),"%Y-%m-%d %H:%M:%S",&tm);
-                    }
-                    if (json_object_object_get_ex(st,"stripped",&s)) strips=json_object_get_int(s);
-                    if (json_object_object_get_ex(st,"streams",&n))  streams=json_object_get_int(n);
-                    json_object_put(st);
-                }
-            }
-            printf("%-6d %-18s %-10s %-10s %-19s %-6d %-8d\n",(int)pid,name,ifA,ifB,tsbuf, strips, streams);
-            printf("    policy: %s%s\n", policy, proc_alive(pid)?"":"  [DEAD]");
+            if (!live_engine(pid,name,ifA,ifB))
+                printf("%-6d %-18s %s <-> %s  (no live stats)\n",(int)pid,name,ifA,ifB);
+            printf("    policy: %s%s\n\n", policy, proc_alive(pid)?"":"  [DEAD]");
         }
         json_object_put(reg);
         fflush(stdout);
-        usleep(250000);
+        usleep(100000);
     }
+    signal(SIGINT,SIG_DFL);
     printf("Live monitor closed.\n");
 }
 
@@ -195,7 +376,8 @@ static void print_menu(void){
     printf("2) Stop policy (name|pid|all)\n");
     printf("3) List once\n");
     printf("4) Live monitor (Ctrl+C to exit)\n");
-    printf("5) Quit\n");
+    printf("5) Reload policy (name|pid)\n");
+    printf("6) Quit\n");
 }
 static void list_once(void){
     struct json_object *reg=registry_load(); registry_prune_dead(reg);
@@ -229,7 +411,9 @@ int main(void){
             char arg[64]={0}; printf("Name, PID, or 'all': "); if (!fgets(arg,sizeof(arg),stdin)) continue; arg[strcspn(arg,"\r\n")]=0; if (arg[0]) stop_one(arg);
         } else if (c=='3'){ list_once();
         } else if (c=='4'){ live_monitor();
-        } else if (c=='5' || c=='q' || c=='Q'){ break; }
+        } else if (c=='5'){
+            char arg[64]={0}; printf("Name or PID: "); if (!fgets(arg,sizeof(arg),stdin)) continue; arg[strcspn(arg,"\r\n")]=0; if (arg[0]) reload_one(arg);
+        } else if (c=='6' || c=='q' || c=='Q'){ break; }
     }
     return 0;
 }
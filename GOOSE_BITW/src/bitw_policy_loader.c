@@ -6,6 +6,10 @@
 #include <stdint.h>
 #include <json-c/json.h>
 
+//Verdicts and the actions they compile to, must match bitw_engine.c and verdict.c
+enum { V_OK, V_UNKNOWN, V_MALFORMED, V_BADTAG, V_REPLAY, V_MAC, V_N };
+enum { ACT_DROP, ACT_FWD, ACT_STRIP };
+
 //This headerless declaration must match bitw_engine.c's Policy
 typedef struct {
   char deviceId[64];
@@ -18,20 +22,91 @@ typedef struct {
   uint16_t appId;
   char  goID[128];
   char  gocbRef[128];
+  uint8_t dstMac[6];
+  bool  hasDstMac;
   bool  allowUnsigned;
+  //Per-stream settings, defaulting to the top-level ones
+  bool  stripTag;
+  int   ttl_ms;
+  int   maxSqGap;
+  int   maxAge_ms;
+  int   canon;       //MAC input form: -1 = learn, else pinned (auth_canon.c)
+  int   max_rate;    //XDP guard budget in frames/s, 0 = unlimited
+  int   burst;       //... and how many frames may arrive back to back
+  uint16_t dev;      //index into Policy.devs
+  uint16_t next;     //next stream with the same appId (1-based, 0 = end)
+  int   slot;        //live stats and latency slot, -1 = none (set by the engine)
+  uint8_t act[V_N];  //what each verdict does to a frame of this stream (ACT_*)
+  //HKDF output for this stream, derived once at load time
+  uint8_t okm[32];
+  void*   mac_key;   //HMAC midstate keyed with okm
+  void*   mac_pre;   //... plus the constant canonical prefix
 } Stream;
 
+#define POLICY_MAX_STREAMS 65535
+
 typedef struct {
   //Mode of "monitor" or "enforce"
   char mode[16];
+  bool enforce;      //compiled from mode
+  uint8_t act[V_N];  //actions for frames that match no stream
+  //Top-level defaults, copied into each stream unless it overrides them
   bool stripTag;
   int  ttl_ms;
   int  maxSqGap;
   int  maxAge_ms;
-  Device dev;
-  Stream strm;
+  int  canon;
+  int  canon_learn;  //failed signed frames a stream tries every form on before probing
+  bool pass_other;   //bridge ethertypes other than GOOSE/PTP instead of dropping them
+  int  max_rate;
+  int  burst;
+  //Immutable after load_policy()
+  Device*   devs;
+  int       ndevs;
+  Stream*   strms;
+  int       nstrms;
+  uint16_t* by_appId;   //65536 entries, 1-based index into strms, 0 = none
+  void*     fresh;      //per-stream freshness windows (freshness.c), indexed like strms
+  void*     canon_sel;  //per-stream MAC form selectors (auth_canon.c), indexed like strms
+  //Optional "engine" object (runtime knobs, no policy semantics)
+  char io[16];     //"pcap", "mmap" or "xdp"
+  bool threads;    //one pinned thread per direction
+  int  workers;    //PACKET_FANOUT workers per ingress port (>1 implies threads)
+  int  cpus[16];   //CPUs handed out to threads in order, round robin
+  int  ncpus;      //0 = threads are not pinned
+  int  stats_s;    //per-direction stats period, 0 = only at exit
+  int  tx_batch;   //frames per TX flush (1 = flush every frame)
+  int  tx_batch_us;//oldest queued frame waits at most this long
+  int  hmac_batch; //GOOSE frames whose HMACs are computed together (1 = one by one, 0 = auto)
+  char xdp_guard[16];//"off", "auto" (native XDP, generic fallback) or "generic"
+  char journal[256];  //verdict journal file, "" = off
+  int  journal_recs;  //records kept in it
 } Policy;
 
+//From auth_hmac.c
+extern void hkdf_sha256_extract(const uint8_t *salt, size_t salt_len,
+                                const uint8_t *ikm, size_t ikm_len,
+                                uint8_t *prk, size_t prk_len);
+extern void hkdf_sha256_expand(const uint8_t *prk, size_t prk_len,
+                               const uint8_t *info, size_t info_len,
+                               uint8_t *okm, size_t okm_len);
+extern void* hmac_sha256_prefix_new(const uint8_t *key, size_t key_len,
+                                    const uint8_t *prefix, size_t prefix_len);
+extern void  hmac_sha256_prefix_free(void *pre);
+
+//From freshness.c
+extern void* freshness_new(int n);
+extern void  freshness_free(void* tab);
+
+//From auth_canon.c
+extern size_t auth_canon_prefix(uint8_t *out, size_t out_max,
+                                const char* goID, const char* gocbRef, uint16_t appId);
+extern int    canon_parse(const char* s);
+extern void*  canon_sel_new(int n, int learn);
+extern void   canon_sel_free(void* tab);
+//From verdict.c
+extern void   verdict_actions(uint8_t act[V_N], bool enforce, bool stripTag);
+
 static bool hex2bin(const char* h, uint8_t* out, size_t n){
   if (!h) return false;
   size_t L = strlen(h);
@@ -44,6 +119,13 @@ static bool hex2bin(const char* h, uint8_t* out, size_t n){
   return true;
 }
 
+static bool mac_parse(const char* s, uint8_t mac[6]){
+  unsigned v[6];
+  if (!s || sscanf(s, "%x:%x:%x:%x:%x:%x", &v[0],&v[1],&v[2],&v[3],&v[4],&v[5]) != 6) return false;
+  for (int i=0;i<6;i++){ if (v[i] > 0xFF) return false; mac[i] = (uint8_t)v[i]; }
+  return true;
+}
+
 static const char* sget(struct json_object* o, const char* key){
   struct json_object *x=NULL;
   if (json_object_object_get_ex(o, key, &x) && json_object_is_type(x, json_type_string))
@@ -63,16 +145,219 @@ static bool bget(struct json_object* o, const char* key, bool defv){
   return defv;
 }
 
+static void build_info_simple(char *out, size_t n, const char* fmt,
+                              const char* goID, const char* gocbRef, uint16_t appId)
+{
+  size_t u=0;
+  while (*fmt && u+1<n) {
+    if (fmt[0]=='{' && strncmp(fmt,"{goID}",6)==0)    { u+=snprintf(out+u, n-u, "%s", goID);    fmt+=6; continue; }
+    if (fmt[0]=='{' && strncmp(fmt,"{gocbRef}",9)==0) { u+=snprintf(out+u, n-u, "%s", gocbRef); fmt+=9; continue; }
+    if (fmt[0]=='{' && strncmp(fmt,"{appId}",8)==0)   { u+=snprintf(out+u, n-u, "%u", (unsigned)appId); fmt+=8; continue; }
+    out[u++] = *fmt++;
+  }
+  out[u] = '\0';
+}
+
+//Per-stream key cache: the engine never runs HKDF on the packet path
+static bool derive_stream_key(const Device* D, Stream* S)
+{
+  char info[256];
+  build_info_simple(info, sizeof(info), D->kdfInfoFmt, S->goID, S->gocbRef, S->appId);
+  uint8_t prk[32]={0};
+  hkdf_sha256_extract(NULL, 0, D->k_device, 32, prk, 32);
+  hkdf_sha256_expand(prk, 32, (const uint8_t*)info, strlen(info), S->okm, 32);
+  memset(prk, 0, sizeof(prk));
+
+  uint8_t pre[512];
+  size_t pre_len = auth_canon_prefix(pre, sizeof(pre), S->goID, S->gocbRef, S->appId);
+  S->mac_key = hmac_sha256_prefix_new(S->okm, 32, NULL, 0);
+  S->mac_pre = hmac_sha256_prefix_new(S->okm, 32, pre, pre_len);
+  return S->mac_key && S->mac_pre;
+}
+
+//Stream settings: top-level defaults, then per-stream overrides
+static bool stream_settings(const Policy* P, struct json_object* sj, Stream* S)
+{
+  S->stripTag  = P->stripTag;
+  S->ttl_ms    = P->ttl_ms;
+  S->maxSqGap  = P->maxSqGap;
+  S->maxAge_ms = P->maxAge_ms;
+  S->canon     = P->canon;
+  S->max_rate  = iget(sj, "maxRate_pps", P->max_rate);
+  S->burst     = iget(sj, "burst", P->burst);
+  S->allowUnsigned = bget(sj, "allowUnsigned", false);
+  S->stripTag  = bget(sj, "stripTag", S->stripTag);
+  S->ttl_ms    = iget(sj, "timeAllowedToLive_ms", S->ttl_ms);
+  struct json_object* win=NULL;
+  if (json_object_object_get_ex(sj, "window", &win) && json_object_is_type(win, json_type_object)){
+    S->maxSqGap  = iget(win, "maxSqGap", S->maxSqGap);
+    S->maxAge_ms = iget(win, "maxAge_ms", S->maxAge_ms);
+  }
+  const char* cf = sget(sj, "canon");
+  if (cf && (S->canon = canon_parse(cf)) < -1) {
+    fprintf(stderr, "[policy] bad canon '%s' (auto, pub, allData or seq)\n", cf);
+    return false;
+  }
+  return true;
+}
+
+//Match fields shared by both schemas
+static bool stream_match(struct json_object* m, Stream* S)
+{
+  S->appId = (uint16_t)iget(m,"appId",0);
+  const char* go  = sget(m,"goID");
+  const char* cb  = sget(m,"gocbRef");
+  if (go) snprintf(S->goID,   sizeof(S->goID),   "%s", go);
+  if (cb) snprintf(S->gocbRef,sizeof(S->gocbRef),"%s", cb);
+  const char* mac = sget(m,"dstMac");
+  if (mac) {
+    if (!mac_parse(mac, S->dstMac)) {
+      fprintf(stderr, "[policy] bad dstMac '%s'\n", mac);
+      return false;
+    }
+    S->hasDstMac = true;
+  }
+  return S->appId != 0 && S->goID[0] && S->gocbRef[0];
+}
+
+static bool parse_device(struct json_object* dj, Device* D)
+{
+  snprintf(D->kdfInfoFmt, sizeof(D->kdfInfoFmt), "GOOSE|{goID}|{gocbRef}|{appId}");
+  const char* id = sget(dj,"deviceId");
+  if (id) snprintf(D->deviceId, sizeof(D->deviceId), "%s", id);
+  const char* fmt = sget(dj,"kdfInfoFmt");
+  if (fmt) snprintf(D->kdfInfoFmt, sizeof(D->kdfInfoFmt), "%s", fmt);
+  const char* khex = sget(dj,"k_device_hex");
+  if (!khex || !hex2bin(khex, D->k_device, 32)){
+    fprintf(stderr, "[policy] bad k_device_hex%s%s\n", id ? " in " : "", id ? id : "");
+    return false;
+  }
+  return true;
+}
+
+//Chain streams by appId. Streams sharing an appId must differ in dstMac or gocbRef
+static bool build_index(Policy* P)
+{
+  P->by_appId = (uint16_t*)calloc(65536, sizeof(uint16_t));
+  if (!P->by_appId) return false;
+  for (int i=P->nstrms-1; i>=0; i--) {
+    Stream* S = &P->strms[i];
+    for (uint16_t j = P->by_appId[S->appId]; j; j = P->strms[j-1].next) {
+      const Stream* O = &P->strms[j-1];
+      bool same_mac = !S->hasDstMac || !O->hasDstMac || memcmp(S->dstMac, O->dstMac, 6) == 0;
+      if (same_mac && strcmp(S->gocbRef, O->gocbRef) == 0) {
+        fprintf(stderr, "[policy] streams '%s' and '%s' both match appId=%u gocbRef=%s\n",
+                S->name, O->name, (unsigned)S->appId, S->gocbRef);
+        return false;
+      }
+    }
+    S->next = P->by_appId[S->appId];
+    P->by_appId[S->appId] = (uint16_t)(i + 1);
+  }
+  return true;
+}
+
+void policy_free(Policy* P)
+{
+  for (int i=0; P->strms && i<P->nstrms; i++) {
+    hmac_sha256_prefix_free(P->strms[i].mac_key);
+    hmac_sha256_prefix_free(P->strms[i].mac_pre);
+    memset(P->strms[i].okm, 0, sizeof(P->strms[i].okm));
+  }
+  if (P->devs) memset(P->devs, 0, sizeof(Device) * (size_t)P->ndevs);
+  free(P->devs); free(P->strms); free(P->by_appId);
+  freshness_free(P->fresh);
+  canon_sel_free(P->canon_sel);
+  P->devs = NULL; P->strms = NULL; P->by_appId = NULL; P->fresh = NULL; P->canon_sel = NULL;
+  P->ndevs = P->nstrms = 0;
+}
+
+static bool load_devices(Policy* P, struct json_object* devs)
+{
+  size_t nd = json_object_array_length(devs), ns = 0;
+  for (size_t d=0; d<nd; d++) {
+    struct json_object *dj = json_object_array_get_idx(devs, d), *arr=NULL;
+    if (!(dj && json_object_object_get_ex(dj,"streams",&arr) && json_object_is_type(arr,json_type_array) && json_object_array_length(arr)>0)){
+      fprintf(stderr, "[policy] no streams[] in devices[%zu]\n", d);
+      return false;
+    }
+    ns += json_object_array_length(arr);
+  }
+  if (nd > POLICY_MAX_STREAMS || ns > POLICY_MAX_STREAMS) {
+    fprintf(stderr, "[policy] too many streams (%zu)\n", ns);
+    return false;
+  }
+  P->devs  = (Device*)calloc(nd, sizeof(Device));
+  P->strms = (Stream*)calloc(ns, sizeof(Stream));
+  if (!P->devs || !P->strms) return false;
+
+  for (size_t d=0; d<nd; d++) {
+    struct json_object *dj = json_object_array_get_idx(devs, d), *arr=NULL;
+    Device* D = &P->devs[P->ndevs++];
+    if (!parse_device(dj, D)) return false;
+    json_object_object_get_ex(dj,"streams",&arr);
+
+    for (size_t k=0; k<json_object_array_length(arr); k++) {
+      struct json_object *sj = json_object_array_get_idx(arr, k), *match=NULL;
+      Stream* S = &P->strms[P->nstrms++];
+      S->dev = (uint16_t)d;
+      const char* nm = sget(sj,"name");
+      if (nm) snprintf(S->name,sizeof(S->name),"%s",nm);
+      if (!stream_settings(P, sj, S)) return false;
+      if (!(json_object_object_get_ex(sj, "match", &match) && json_object_is_type(match, json_type_object))){
+        fprintf(stderr, "[policy] devices[%zu].streams[%zu].match missing\n", d, k);
+        return false;
+      }
+      if (!stream_match(match, S)) {
+        fprintf(stderr, "[policy] devices[%zu].streams[%zu]: appId, goID and gocbRef are required\n", d, k);
+        return false;
+      }
+      if (!derive_stream_key(D, S)) return false;
+    }
+  }
+  return true;
+}
+
+//FALLBACK: old flat schema, one device with one stream
+static bool load_flat(Policy* P, struct json_object* root)
+{
+  P->devs  = (Device*)calloc(1, sizeof(Device));
+  P->strms = (Stream*)calloc(1, sizeof(Stream));
+  if (!P->devs || !P->strms) return false;
+  P->ndevs = P->nstrms = 1;
+  Device* D = &P->devs[0];
+  Stream* S = &P->strms[0];
+  snprintf(D->kdfInfoFmt, sizeof(D->kdfInfoFmt), "GOOSE|{goID}|{gocbRef}|{appId}");
+  const char* khex = sget(root, "k_device_hex");
+  if (khex && hex2bin(khex, D->k_device, 32)){
+    const char* fmt = sget(root, "kdfInfoFmt");
+    if (fmt) snprintf(D->kdfInfoFmt, sizeof(D->kdfInfoFmt), "%s", fmt);
+  }
+  if (!stream_settings(P, root, S)) return false;
+  if (!stream_match(root, S)) return false;
+  return derive_stream_key(D, S);
+}
+
 bool load_policy(const char* path, Policy* P)
 {
   memset(P, 0, sizeof(*P));
   //Defaults
   snprintf(P->mode, sizeof(P->mode), "enforce");
+  P->enforce = true;
   P->stripTag = true;
   P->ttl_ms   = 2000;
   P->maxSqGap = 8;
   P->maxAge_ms= 5000;
-  snprintf(P->dev.kdfInfoFmt, sizeof(P->dev.kdfInfoFmt), "GOOSE|{goID}|{gocbRef}|{appId}");
+  P->canon    = -1;
+  P->canon_learn = 32;
+  P->burst    = 32;
+  snprintf(P->io, sizeof(P->io), "pcap");
+  P->workers = 1;
+  P->tx_batch = 32;
+  P->tx_batch_us = 100;
+  P->hmac_batch = 0;
+  snprintf(P->xdp_guard, sizeof(P->xdp_guard), "off");
+  P->journal_recs = 1 << 20;
 
   struct json_object* root = json_object_from_file(path);
   if (!root){
@@ -84,6 +369,12 @@ bool load_policy(const char* path, Policy* P)
   {
     const char* m = sget(root, "mode");
     if (m) snprintf(P->mode, sizeof(P->mode), "%s", m);
+    if (strcmp(P->mode, "enforce") != 0 && strcmp(P->mode, "monitor") != 0) {
+      fprintf(stderr, "[policy] bad mode '%s' (monitor or enforce)\n", P->mode);
+      json_object_put(root);
+      return false;
+    }
+    P->enforce = strcmp(P->mode, "enforce") == 0;
     P->stripTag = bget(root, "stripTag", P->stripTag);
     P->ttl_ms   = iget(root, "timeAllowedToLive_ms", P->ttl_ms);
 
@@ -92,65 +383,56 @@ bool load_policy(const char* path, Policy* P)
       P->maxSqGap = iget(win, "maxSqGap", P->maxSqGap);
       P->maxAge_ms= iget(win, "maxAge_ms", P->maxAge_ms);
     }
-  }
-
-  //Prefer new schema devices[0].streams[0].match
-  struct json_object *devs=NULL;
-  if (json_object_object_get_ex(root, "devices", &devs) && json_object_is_type(devs, json_type_array) && json_object_array_length(devs) > 0){
-    struct json_object* dj = json_object_array_get_idx(devs, 0);
-    if (!dj){ json_object_put(root); return false; }
-    const char* id = sget(dj,"deviceId");
-    if (id) snprintf(P->dev.deviceId, sizeof(P->dev.deviceId), "%s", id);
-    const char* fmt = sget(dj,"kdfInfoFmt");
-    if (fmt) snprintf(P->dev.kdfInfoFmt, sizeof(P->dev.kdfInfoFmt), "%s", fmt);
-    const char* khex = sget(dj,"k_device_hex");
-    if (!khex || !hex2bin(khex, P->dev.k_device, 32)){
-      fprintf(stderr, "[policy] bad k_device_hex\n");
-      json_object_put(root); return false;
-    }
-
-    struct json_object *arr=NULL;
-    if (!(json_object_object_get_ex(dj,"streams",&arr) && json_object_is_type(arr,json_type_array) && json_object_array_length(arr)>0)){
-      fprintf(stderr, "[policy] no streams[] in devices[0]\n");
-      json_object_put(root); return false;
+    const char* cf = sget(root, "canon");
+    if (cf && (P->canon = canon_parse(cf)) < -1) {
+      fprintf(stderr, "[policy] bad canon '%s' (auto, pub, allData or seq)\n", cf);
+      json_object_put(root);
+      return false;
     }
-    struct json_object *sj = json_object_array_get_idx(arr, 0);
-    if (!sj){ json_object_put(root); return false; }
-
-    P->strm.allowUnsigned = bget(sj,"allowUnsigned", false);
-    const char* nm = sget(sj,"name");
-    if (nm) snprintf(P->strm.name,sizeof(P->strm.name),"%s",nm);
+    P->canon_learn = iget(root, "canonLearn", P->canon_learn);
+    P->pass_other  = bget(root, "passOther", P->pass_other);
+    P->max_rate    = iget(root, "maxRate_pps", P->max_rate);
+    P->burst       = iget(root, "burst", P->burst);
 
-    struct json_object *match=NULL;
-    if (!(json_object_object_get_ex(sj, "match", &match) && json_object_is_type(match, json_type_object))){
-      fprintf(stderr, "[policy] stream.match missing\n");
-      json_object_put(root); return false;
+    struct json_object* eng=NULL;
+    if (json_object_object_get_ex(root, "engine", &eng) && json_object_is_type(eng, json_type_object)){
+      const char* io = sget(eng, "io");
+      if (io) snprintf(P->io, sizeof(P->io), "%s", io);
+      P->threads = bget(eng, "threads", P->threads);
+      P->workers = iget(eng, "workers", P->workers);
+      P->tx_batch    = iget(eng, "txBatch", P->tx_batch);
+      P->tx_batch_us = iget(eng, "txBatchUs", P->tx_batch_us);
+      P->hmac_batch  = iget(eng, "hmacBatch", P->hmac_batch);
+      P->stats_s = iget(eng, "statsInterval_s", P->stats_s);
+      const char* xg = sget(eng, "xdpGuard");
+      if (xg) snprintf(P->xdp_guard, sizeof(P->xdp_guard), "%s", xg);
+      const char* jf = sget(eng, "journal");
+      if (jf) snprintf(P->journal, sizeof(P->journal), "%s", jf);
+      P->journal_recs = iget(eng, "journalRecords", P->journal_recs);
+      struct json_object* cpus=NULL;
+      if (json_object_object_get_ex(eng, "cpus", &cpus) && json_object_is_type(cpus, json_type_array)){
+        for (size_t i=0; i<16 && i<json_object_array_length(cpus); i++)
+          P->cpus[P->ncpus++] = json_object_get_int(json_object_array_get_idx(cpus, i));
+      }
     }
-    P->strm.appId = (uint16_t)iget(match,"appId",0);
-    const char* go  = sget(match,"goID");
-    const char* cb  = sget(match,"gocbRef");
-    if (go) snprintf(P->strm.goID,   sizeof(P->strm.goID),   "%s", go);
-    if (cb) snprintf(P->strm.gocbRef,sizeof(P->strm.gocbRef),"%s", cb);
-
-    json_object_put(root);
-    return (P->strm.appId != 0 && P->strm.goID[0] && P->strm.gocbRef[0]);
   }
 
-  //FALLBACK: old flat schema
-  {
-    const char* khex = sget(root, "k_device_hex");
-    if (khex && hex2bin(khex, P->dev.k_device, 32)){
-      const char* fmt = sget(root, "kdfInfoFmt");
-      if (fmt) snprintf(P->dev.kdfInfoFmt, sizeof(P->dev.kdfInfoFmt), "%s", fmt);
-    }
-    P->strm.appId = (uint16_t)iget(root,"appId",0);
-    const char* go  = sget(root,"goID");
-    const char* cb  = sget(root,"gocbRef");
-    if (go) snprintf(P->strm.goID,   sizeof(P->strm.goID),   "%s", go);
-    if (cb) snprintf(P->strm.gocbRef,sizeof(P->strm.gocbRef),"%s", cb);
-    P->strm.allowUnsigned = bget(root,"allowUnsigned", false);
-
-    json_object_put(root);
-    return (P->strm.appId != 0 && P->strm.goID[0] && P->strm.gocbRef[0] && P->dev.k_device[0] + 1);
+  //Prefer new schema devices[].streams[].match, every device and stream is loaded
+  struct json_object *devs=NULL;
+  bool ok;
+  if (json_object_object_get_ex(root, "devices", &devs) && json_object_is_type(devs, json_type_array) && json_object_array_length(devs) > 0)
+    ok = load_devices(P, devs);
+  else
+    ok = load_flat(P, root);
+  json_object_put(root);
+
+  if (ok) ok = build_index(P);
+  if (ok) {
+    verdict_actions(P->act, P->enforce, P->stripTag);
+    for (int i=0;i<P->nstrms;i++) verdict_actions(P->strms[i].act, P->enforce, P->strms[i].stripTag);
   }
+  if (ok) ok = (P->fresh = freshness_new(P->nstrms)) != NULL;
+  if (ok) ok = (P->canon_sel = canon_sel_new(P->nstrms, P->canon_learn)) != NULL;
+  if (!ok) policy_free(P);
+  return ok;
 }
@@ -0,0 +1,145 @@
+/*
+Thin bpf(2) wrappers (no libbpf dependency)
+--------------------------------------------
+  - map create / update / lookup
+  - XDP program load from a raw instruction array
+  - XDP attach through a BPF link (driver mode first, generic as fallback)
+  - Possible CPU count, for sizing per-CPU map values
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+
+static int sys_bpf(int cmd, union bpf_attr* attr)
+{
+  return (int)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+int bpf_map_create_simple(uint32_t type, uint32_t key_size, uint32_t value_size,
+                          uint32_t max_entries, const char* name)
+{
+  union bpf_attr a;
+  memset(&a, 0, sizeof(a));
+  a.map_type    = type;
+  a.key_size    = key_size;
+  a.value_size  = value_size;
+  a.max_entries = max_entries;
+  if (name) snprintf(a.map_name, sizeof(a.map_name), "%s", name);
+  return sys_bpf(BPF_MAP_CREATE, &a);
+}
+
+int bpf_map_update(int fd, const void* key, const void* value)
+{
+  union bpf_attr a;
+  memset(&a, 0, sizeof(a));
+  a.map_fd = (uint32_t)fd;
+  a.key    = (uint64_t)(uintptr_t)key;
+  a.value  = (uint64_t)(uintptr_t)value;
+  a.flags  = BPF_ANY;
+  return sys_bpf(BPF_MAP_UPDATE_ELEM, &a);
+}
+
+int bpf_map_lookup(int fd, const void* key, void* value)
+{
+  union bpf_attr a;
+  memset(&a, 0, sizeof(a));
+  a.map_fd = (uint32_t)fd;
+  a.key    = (uint64_t)(uintptr_t)key;
+  a.value  = (uint64_t)(uintptr_t)value;
+  return sys_bpf(BPF_MAP_LOOKUP_ELEM, &a);
+}
+
+//Load an XDP program. On failure the verifier log lands in err
+int bpf_xdp_prog_load(const struct bpf_insn* insns, size_t n, const char* name,
+                      char* err, size_t errlen)
+{
+  static char log[16384];
+  union bpf_attr a;
+  memset(&a, 0, sizeof(a));
+  a.prog_type = BPF_PROG_TYPE_XDP;
+  a.expected_attach_type = BPF_XDP;
+  a.insns     = (uint64_t)(uintptr_t)insns;
+  a.insn_cnt  = (uint32_t)n;
+  a.license   = (uint64_t)(uintptr_t)"GPL";
+  if (name) snprintf(a.prog_name, sizeof(a.prog_name), "%s", name);
+  int fd = sys_bpf(BPF_PROG_LOAD, &a);
+  if (fd >= 0) return fd;
+
+  //Retry with the verifier log so the reason is visible
+  int e = errno;
+  log[0] = '\0';
+  a.log_buf   = (uint64_t)(uintptr_t)log;
+  a.log_size  = sizeof(log);
+  a.log_level = 1;
+  fd = sys_bpf(BPF_PROG_LOAD, &a);
+  if (fd >= 0) return fd;
+  snprintf(err, errlen, "prog load: %s%s%.200s", strerror(e), log[0] ? "\n" : "", log);
+  return -1;
+}
+
+//Attach through a BPF link so the program goes away with the process.
+//Tries native (driver) XDP first and falls back to generic (skb) mode;
+//*generic set on entry skips straight to generic
+int bpf_xdp_attach(int prog_fd, int ifindex, bool* generic, char* err, size_t errlen)
+{
+  static const uint32_t modes[2] = { XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE };
+  int e = 0;
+  for (int i = (generic && *generic) ? 1 : 0; i<2; i++) {
+    union bpf_attr a;
+    memset(&a, 0, sizeof(a));
+    a.link_create.prog_fd       = (uint32_t)prog_fd;
+    a.link_create.target_ifindex= (uint32_t)ifindex;
+    a.link_create.attach_type   = BPF_XDP;
+    a.link_create.flags         = modes[i];
+    int fd = sys_bpf(BPF_LINK_CREATE, &a);
+    if (fd >= 0) { if (generic) *generic = (i == 1); return fd; }
+    e = errno;
+  }
+  snprintf(err, errlen, "xdp attach: %s", strerror(e));
+  return -1;
+}
+
+//Per-CPU maps hold one value per possible CPU, not per online one
+int bpf_num_possible_cpus(void)
+{
+  static int n = 0;
+  if (n) return n;
+  FILE* f = fopen("/sys/devices/system/cpu/possible", "r");
+  if (f) {
+    //"0-3" or "0,2-5": ranges "a-b" or single ids, comma separated; the
+    //highest id decides the array length
+    char buf[128] = {0};
+    if (fgets(buf, sizeof(buf), f)) {
+      long hi = -1;
+      for (char* q = buf; *q; ) {
+        char* e;
+        long a = strtol(q, &e, 10), b = a;
+        if (e == q) break;
+        if (*e == '-') {
+          q = e + 1;
+          b = strtol(q, &e, 10);
+          if (e == q) break;
+        }
+        if (b > hi) hi = b;
+        if (*e != ',') break;
+        q = e + 1;
+      }
+      n = (int)(hi + 1);
+    }
+    fclose(f);
+  }
+  //Never size the per-CPU buffers below what the kernel may copy
+  int conf = (int)sysconf(_SC_NPROCESSORS_CONF);
+  if (n < conf) n = conf;
+  if (n <= 0) n = 1;
+  return n;
+}
@@ -0,0 +1,88 @@
+/*
+Fixed pool of frame buffers for bitw_engine
+--------------------------------------------
+  - One pool per forwarding thread, so get/put need no locking
+  - All buffers live in a single mapping allocated at startup: explicit
+    hugepages when available, else normal pages with a THP hint
+  - Buffers are 64-byte aligned and FPOOL_BUF_SIZE long (any GOOSE frame)
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define FPOOL_BUF_SIZE  2048
+#define HUGE_2M         (2u << 20)
+
+typedef struct {
+  uint8_t*  mem;
+  size_t    mem_len;
+  bool      huge;
+  unsigned  nbufs;
+  unsigned  nfree;
+  unsigned  low;        //fewest free buffers seen
+  uint64_t  empty;      //fpool_get() calls that found nothing
+  uint8_t** free_list;
+} FramePool;
+
+void* fpool_new(unsigned nbufs)
+{
+  FramePool* F = (FramePool*)calloc(1, sizeof(*F));
+  if (!F) return NULL;
+  F->free_list = (uint8_t**)calloc(nbufs, sizeof(uint8_t*));
+  if (!F->free_list) { free(F); return NULL; }
+
+  size_t want = (size_t)nbufs * FPOOL_BUF_SIZE;
+  F->mem_len = (want + HUGE_2M - 1) & ~((size_t)HUGE_2M - 1);
+  F->mem = mmap(NULL, F->mem_len, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE, -1, 0);
+  if (F->mem != MAP_FAILED) {
+    F->huge = true;
+  } else {
+    //No reserved hugepages: regular pages, let THP back them if it can
+    F->mem_len = want;
+    F->mem = mmap(NULL, F->mem_len, PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+    if (F->mem == MAP_FAILED) { free(F->free_list); free(F); return NULL; }
+    madvise(F->mem, F->mem_len, MADV_HUGEPAGE);
+  }
+
+  F->nbufs = nbufs;
+  for (unsigned i=0;i<nbufs;i++) F->free_list[F->nfree++] = F->mem + (size_t)i * FPOOL_BUF_SIZE;
+  F->low = F->nfree;
+  return F;
+}
+
+size_t fpool_buf_size(void) { return FPOOL_BUF_SIZE; }
+
+//A free buffer, or NULL when every buffer is in flight
+uint8_t* fpool_get(void* pool)
+{
+  FramePool* F = (FramePool*)pool;
+  if (F->nfree == 0) { F->empty++; return NULL; }
+  uint8_t* b = F->free_list[--F->nfree];
+  if (F->nfree < F->low) F->low = F->nfree;
+  return b;
+}
+
+void fpool_put(void* pool, uint8_t* buf)
+{
+  FramePool* F = (FramePool*)pool;
+  if (buf && F->nfree < F->nbufs) F->free_list[F->nfree++] = buf;
+}
+
+void fpool_free(void* pool, const char* name)
+{
+  FramePool* F = (FramePool*)pool;
+  if (!F) return;
+  if (name)
+    fprintf(stderr, "[pool %s] bufs=%u %s low=%u empty=%llu\n", name, F->nbufs,
+            F->huge ? "hugepages" : "4k pages", F->low, (unsigned long long)F->empty);
+  munmap(F->mem, F->mem_len);
+  free(F->free_list);
+  free(F);
+}
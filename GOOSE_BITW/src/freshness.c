@@ -1,42 +1,133 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <stdio.h>
 
-//Very small per-stream state (single stream MVP)
+//Per-stream freshness window, one cache line each so workers on
+//different streams never share a line. The lock word only serialises
+//frames of the same stream
 typedef struct {
+  uint32_t lock;
   uint32_t lastSt;
   uint32_t lastSq;
+  uint32_t _pad;
   uint64_t lastSeenMs;
-} Win;
+  uint64_t accepted;
+  uint32_t rejected[5];   //by return code 1..5
+} __attribute__((aligned(64))) Win;
 
-static Win W={0,0,0};
+_Static_assert(sizeof(Win) == 64, "Win must fill exactly one cache line");
 
 static uint64_t now_ms(void){
   struct timespec ts; clock_gettime(CLOCK_REALTIME,&ts);
   return (uint64_t)ts.tv_sec*1000ULL + ts.tv_nsec/1000000ULL;
 }
 
-//Return 0 = fresh, else nonzero (reject)
-int freshness_check(uint32_t st, uint32_t sq, int ttl_ms, int maxSqGap, int maxAge_ms) {
-  uint64_t t = now_ms();
-  if (W.lastSeenMs==0) { W.lastSt=st; W.lastSq=sq; W.lastSeenMs=t; return 0; }
+static inline void cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
 
-  if (st < W.lastSt) return 1;
-  if (st == W.lastSt) {
-    if (sq <= W.lastSq) return 2;
-    if (sq - W.lastSq > (uint32_t)maxSqGap) return 3;
+static inline void win_lock(Win* w){
+  while (__atomic_exchange_n(&w->lock, 1, __ATOMIC_ACQUIRE))
+    while (__atomic_load_n(&w->lock, __ATOMIC_RELAXED)) cpu_relax();
+}
+static inline void win_unlock(Win* w){ __atomic_store_n(&w->lock, 0, __ATOMIC_RELEASE); }
+
+//Table of n windows, indexed like Policy.strms
+void* freshness_new(int n){
+  if (n <= 0) n = 1;
+  Win* t = (Win*)aligned_alloc(64, sizeof(Win) * (size_t)n);
+  if (t) memset(t, 0, sizeof(Win) * (size_t)n);
+  return t;
+}
+
+void freshness_free(void* tab){ free(tab); }
+
+static int window_step(Win* w, uint32_t st, uint32_t sq, int maxSqGap, int maxAge_ms, uint64_t t){
+  if (w->lastSeenMs==0) { w->lastSt=st; w->lastSq=sq; w->lastSeenMs=t; return 0; }
+
+  if (st < w->lastSt) return 1;
+  if (st == w->lastSt) {
+    if (sq <= w->lastSq) return 2;
+    if (sq - w->lastSq > (uint32_t)maxSqGap) return 3;
   } else {
     //Allow reset of sqNum on new state
     if (sq > (uint32_t)maxSqGap) return 4;
   }
 
-  if ((int)(t - W.lastSeenMs) > maxAge_ms) return 5;
-  W.lastSt = st; W.lastSq = sq; W.lastSeenMs = t;
+  if ((int)(t - w->lastSeenMs) > maxAge_ms) return 5;
+  w->lastSt = st; w->lastSq = sq; w->lastSeenMs = t;
   return 0;
 }
 
+//Return 0 = fresh, else nonzero (reject)
+int freshness_check(void* tab, int idx, uint32_t st, uint32_t sq, int ttl_ms, int maxSqGap, int maxAge_ms) {
+  (void)ttl_ms;
+  Win* w = (Win*)tab + idx;
+  uint64_t t = now_ms();
+  win_lock(w);
+  int rc = window_step(w, st, sq, maxSqGap, maxAge_ms, t);
+  if (rc == 0) w->accepted++;
+  else w->rejected[rc-1]++;
+  win_unlock(w);
+  return rc;
+}
+
+//Same verdict as freshness_check() without moving the window, so stale
+//and replayed frames are turned away before anyone pays for a MAC.
+//Rejections are counted here; a frame that passes still goes through
+//freshness_check() once it has been authenticated. held: frames of this
+//stream ahead of this one are still to be committed. They can only move
+//the window forward, so an older state or a repeated sqNum stays a replay;
+//a gap, a new state or an aged window may not, and those pass uncounted
+//for freshness_check() to decide after them
+int freshness_peek(void* tab, int idx, uint32_t st, uint32_t sq, int maxSqGap, int maxAge_ms, bool held) {
+  Win* w = (Win*)tab + idx;
+  uint64_t t = now_ms();
+  win_lock(w);
+  Win tmp = *w;
+  int rc = window_step(&tmp, st, sq, maxSqGap, maxAge_ms, t);
+  if (held && rc > 2) rc = 0;
+  if (rc) w->rejected[rc-1]++;
+  win_unlock(w);
+  return rc;
+}
+
+//A policy reload carries stream si of src over as stream di of dst: dst
+//takes src's position unless it has already moved past it, and src's
+//counters move across. Called again once src is out of use to pick up
+//what in-flight frames did meanwhile, so both tables may be live
+void freshness_carry(void* dst, int di, void* src, int si){
+  Win* d = (Win*)dst + di;
+  Win* s = (Win*)src + si;
+  win_lock(s);
+  win_lock(d);
+  if (s->lastSeenMs && (!d->lastSeenMs || s->lastSt > d->lastSt ||
+                        (s->lastSt == d->lastSt && s->lastSq > d->lastSq))) {
+    d->lastSt = s->lastSt; d->lastSq = s->lastSq;
+    if (s->lastSeenMs > d->lastSeenMs) d->lastSeenMs = s->lastSeenMs;
+  }
+  d->accepted += s->accepted; s->accepted = 0;
+  for (int i=0;i<5;i++) { d->rejected[i] += s->rejected[i]; s->rejected[i] = 0; }
+  win_unlock(d);
+  win_unlock(s);
+}
+
+void freshness_report(void* tab, int idx, const char* name){
+  Win* w = (Win*)tab + idx;
+  win_lock(w);
+  fprintf(stderr, "[fresh %s] st=%u sq=%u ok=%llu stOld=%u sqDup=%u sqGap=%u sqReset=%u stale=%u\n",
+          name, w->lastSt, w->lastSq, (unsigned long long)w->accepted,
+          w->rejected[0], w->rejected[1], w->rejected[2], w->rejected[3], w->rejected[4]);
+  win_unlock(w);
+}
+
 int ttl_check(uint64_t ingress_ms, int ttl_ms) {
   uint64_t t = now_ms();
   return ((int)(t - ingress_ms) > ttl_ms) ? 1 : 0;
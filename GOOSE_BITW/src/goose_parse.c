@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -39,17 +40,131 @@ static void ber_len_write_same(uint8_t* b, size_t pos, size_t newLen, size_t nLe
     }
 }
 
-//Advance over a TLV using BER (short/long)
-//Returns next pos or 0 on error/out-of-bounds
-static size_t tlv_next_ber(const uint8_t* b, size_t end, size_t pos)
+//One TLV inside the frame: tag byte at off, value at off+hdr, total hdr+len.
+//hdr == 0 means the element was not present
+typedef struct {
+  uint16_t off;
+  uint16_t len;
+  uint8_t  hdr;
+  uint8_t  tag;
+} Span;
+
+#define GOOSE_MAX_ELEMS 64
+
+//Flat descriptor of one GOOSE frame, filled by a single walk of the APDU
+//in goose_decode() and reused by lookup, verify, strip and logging.
+//bitw_engine.c mirrors this layout, keep both in sync
+typedef struct {
+  uint16_t appId;
+  uint16_t apdu_off;     //22, or 26 behind an 802.1Q tag
+  uint32_t stNum;
+  uint32_t sqNum;
+  Span     seq;          //goosePdu SEQUENCE (0x61)
+  Span     gocbRef, ttl, datSet, goID, t;
+  Span     st, sq;       //TLVs stNum/sqNum were read from
+  Span     simulation, confRev, ndsCom, numEntries;
+  Span     all;          //allData (0xAB)
+  Span     tag;          //last allData element, the tag candidate
+  int      nelem;        //allData elements, the first GOOSE_MAX_ELEMS kept
+  Span     elem[GOOSE_MAX_ELEMS];
+} GooseFrame;
+
+static inline void span_set(Span* s, size_t off, size_t hdr, size_t len, uint8_t tag)
+{
+    s->off = (uint16_t)off; s->hdr = (uint8_t)hdr; s->len = (uint16_t)len; s->tag = tag;
+}
+
+static inline uint32_t span_u32(const uint8_t* f, const Span* s)
 {
-    if (pos + 2 > end) return 0;
-    size_t L, nL;
-    if (!ber_len_read(b, end, pos+1, &L, &nL)) return 0;
-    size_t nx = pos + 1 + nL + L;
-    return (nx <= end) ? nx : 0;
+    uint32_t v = 0;
+    for (size_t k=0;k<s->len;k++) v = (v<<8) | f[s->off + s->hdr + k];
+    return v;
 }
 
+//Walk the APDU once. Returns 0 when stNum/sqNum were found, <0 otherwise;
+//on -4 the spans that were reached before the walk gave up stay filled
+int goose_decode(const uint8_t* frame, size_t flen, GooseFrame* G)
+{
+    //elem[] is only valid up to nelem, no need to clear it
+    memset(G, 0, offsetof(GooseFrame, elem));
+    if (flen < 42) return -1;
+    if (flen > 0xFFFF) return -1;
+
+    //EtherType and offsets
+    uint16_t et = be16(frame + 12);
+    if (et == 0x8100) {
+        if (be16(frame+16) != 0x88b8) return -2;
+        G->appId = be16(frame + 18);
+        G->apdu_off = 26;
+    } else if (et == 0x88b8) {
+        G->appId = be16(frame + 14);
+        G->apdu_off = 22;
+    } else return -3;
+
+    //Outer SEQUENCE (0x61)
+    size_t a = G->apdu_off;
+    if (a + 2 > flen || frame[a] != 0x61) return -4;
+    size_t seq_L=0, seq_nL=0;
+    if (!ber_len_read(frame, flen, a+1, &seq_L, &seq_nL)) return -4;
+    size_t seq_V = a + 1 + seq_nL;
+    size_t seq_E = seq_V + seq_L;
+    if (seq_E > flen) return -4;
+    span_set(&G->seq, a, 1 + seq_nL, seq_L, 0x61);
+
+    //PDU fields by context tag. stNum/sqNum keep the older, looser rule
+    //(first short 0x85/0x87/0x02, then 0x86/0x88/0x02) so publishers
+    //with shifted tags still decode
+    int foundSt=0, foundSq=0;
+    for (size_t i = seq_V; i + 2 <= seq_E; ) {
+        uint8_t T = frame[i];
+        size_t L,nL; if (!ber_len_read(frame, seq_E, i+1, &L, &nL)) break;
+        size_t hdr = 1 + nL, nx = i + hdr + L;
+        if (nx > seq_E) break;
+
+        Span* s = NULL;
+        switch (T) {
+        case 0x80: s = &G->gocbRef;    break;
+        case 0x81: s = &G->ttl;        break;
+        case 0x82: s = &G->datSet;     break;
+        case 0x83: s = &G->goID;       break;
+        case 0x84: s = &G->t;          break;
+        case 0x87: s = &G->simulation; break;
+        case 0x88: s = &G->confRev;    break;
+        case 0x89: s = &G->ndsCom;     break;
+        case 0x8A: s = &G->numEntries; break;
+        case 0xAB: s = &G->all;        break;
+        }
+        if (s && !s->hdr) span_set(s, i, hdr, L, T);
+
+        if (L <= 4) {
+            if (!foundSt && (T==0x85 || T==0x87 || T==0x02)) {
+                span_set(&G->st, i, hdr, L, T); foundSt=1;
+            } else if (foundSt && !foundSq && (T==0x86 || T==0x88 || T==0x02)) {
+                span_set(&G->sq, i, hdr, L, T); foundSq=1;
+            }
+        }
+        i = nx;
+    }
+    if (!foundSt || !foundSq) return -4;
+    G->stNum = span_u32(frame, &G->st);
+    G->sqNum = span_u32(frame, &G->sq);
+
+    //allData elements; the LAST one (whatever its tag) is the tag candidate
+    if (!G->all.hdr || !G->all.len) return 0;
+    size_t all_V = G->all.off + G->all.hdr, all_E = all_V + G->all.len;
+    for (size_t p = all_V; p + 2 <= all_E; ) {
+        size_t L,nL; if (!ber_len_read(frame, all_E, p+1, &L, &nL)) break;
+        size_t nx = p + 1 + nL + L;
+        if (nx > all_E) break;
+        if (G->nelem < GOOSE_MAX_ELEMS) span_set(&G->elem[G->nelem], p, 1 + nL, L, frame[p]);
+        G->nelem++;
+        span_set(&G->tag, p, 1 + nL, L, frame[p]);
+        p = nx;
+    }
+    return 0;
+}
+
+//Older entry point, kept for callers that only want the header fields
 typedef struct {
   uint16_t appId;
   uint32_t stNum;
@@ -58,143 +173,143 @@ typedef struct {
   int      tag_len;
 } GooseMeta;
 
-//Meta extraction
 int goose_extract_meta(const uint8_t* frame, size_t flen, GooseMeta* M)
 {
-  memset(M, 0, sizeof(*M));
-  M->tag_pos = -1; M->tag_len = 0;
-  if (flen < 42) return -1;
-
-  //EtherType and offsets
-  uint16_t et = be16(frame + 12);
-  size_t apdu_off = 0;
-  if (et == 0x8100) {
-    if (flen < 26 || be16(frame+16) != 0x88b8) return -2;
-    M->appId = be16(frame + 18);
-    apdu_off = 26;
-  } else if (et == 0x88b8) {
-    M->appId = be16(frame + 14);
-    apdu_off = 22;
-  } else return -3;
-
-  //Dive into outer SEQUENCE (0x61)
-  if (apdu_off + 2 > flen || frame[apdu_off] != 0x61) return -4;
-  size_t seq_L=0, seq_nL=0;
-  if (!ber_len_read(frame, flen, apdu_off+1, &seq_L, &seq_nL)) return -4;
-  size_t seq_V = apdu_off + 1 + seq_nL;
-  size_t seq_E = seq_V + seq_L;
-  if (seq_E > flen) return -4;
-
-  //Scan SEQUENCE to find stNum/sqNum with flexible tags
-  int foundSt=0, foundSq=0;
-  for (size_t i = seq_V; i + 2 <= seq_E; ) {
-    uint8_t T = frame[i];
-    size_t L,nL; if (!ber_len_read(frame, seq_E, i+1, &L, &nL)) break;
-    if (L <= 4) {
-      if (!foundSt && (T==0x85 || T==0x87 || T==0x02)) {
-        uint32_t v=0; for (size_t k=0;k<L;k++) v=(v<<8)|frame[i+1+nL+k];
-        M->stNum = v; foundSt=1;
-      } else if (foundSt && !foundSq && (T==0x86 || T==0x88 || T==0x02)) {
-        uint32_t v=0; for (size_t k=0;k<L;k++) v=(v<<8)|frame[i+1+nL+k];
-        M->sqNum = v; foundSq=1;
-      }
-    }
-    size_t nx = i + 1 + nL + L; if (nx<=i) break; i = nx;
-    if (foundSt && foundSq) break;
-  }
-  if (!foundSt || !foundSq) return -4;
-
-  //Find allData (0xAB) using full BER stepping
-  size_t all_Lpos=0, all_Vpos=0, all_end=0, all_nL=0, all_Lval=0;
-  for (size_t i = seq_V; i + 2 <= seq_E; ) {
-    if (frame[i] == 0xAB) {
-      if (!ber_len_read(frame, seq_E, i+1, &all_Lval, &all_nL)) break;
-      all_Lpos = i+1; all_Vpos = i+1+all_nL; all_end = all_Vpos + all_Lval;
-      break;
+    GooseFrame G;
+    int rc = goose_decode(frame, flen, &G);
+    memset(M, 0, sizeof(*M));
+    M->tag_pos = -1; M->tag_len = 0;
+    if (rc != 0) return rc;
+    M->appId = G.appId; M->stNum = G.stNum; M->sqNum = G.sqNum;
+    if (G.tag.hdr) { M->tag_pos = G.tag.off; M->tag_len = G.tag.hdr + G.tag.len; }
+    return 0;
+}
+
+//Where the length fields that cover a tag live, taken from the descriptor
+typedef struct {
+  size_t app_len_off;
+  size_t seq_tag, seq_L, seq_nL;
+  bool   have_all;
+  size_t all_Lpos, all_nL, all_Lval;
+} StripPlan;
+
+static int strip_plan(const GooseFrame* G, size_t flen, int tag_pos, int tag_len, StripPlan* S)
+{
+  if (!G || flen < 42 || tag_pos <= 0 || tag_len < 2) return -1;
+  if (!G->apdu_off) return -3;
+  if (!G->seq.hdr) return -5;
+  memset(S, 0, sizeof(*S));
+
+  //APPID length sits 6 bytes into the GOOSE header
+  S->app_len_off = (size_t)G->apdu_off - 6;
+  if ((size_t)tag_pos < G->apdu_off || (size_t)(tag_pos + tag_len) > flen) return -4;
+
+  //Outer SEQUENCE (0x61) and, when the tag sits inside it, allData
+  S->seq_tag = G->seq.off;
+  S->seq_L   = G->seq.len;
+  S->seq_nL  = (size_t)G->seq.hdr - 1;
+  if (G->all.hdr) {
+    size_t V = (size_t)G->all.off + G->all.hdr, E = V + G->all.len;
+    if ((size_t)tag_pos >= V && (size_t)(tag_pos + tag_len) <= E) {
+      S->all_Lpos = (size_t)G->all.off + 1; S->all_nL = (size_t)G->all.hdr - 1; S->all_Lval = G->all.len;
+      S->have_all = true;
     }
-    size_t nx = tlv_next_ber(frame, seq_E, i); if (!nx) break; i = nx;
   }
-  if (!all_Vpos || all_end > seq_E || all_end <= all_Vpos) return 0;
-
-  //Inside allData select the LAST TLV (whatever its tag)
-  int last_pos=-1, last_len=0;
-  for (size_t p = all_Vpos; p + 2 <= all_end; ) {
-    size_t L,nL; if (!ber_len_read(frame, all_end, p+1, &L, &nL)) break;
-    size_t tlv_total = 1 + nL + L; size_t nx = p + tlv_total;
-    if (nx > all_end) break;
-    last_pos = (int)p; last_len = (int)tlv_total;
-    p = nx;
-  }
-  if (last_pos >= 0) { M->tag_pos = last_pos; M->tag_len = last_len; }
   return 0;
 }
 
-//Strip the last TLV & fix lengths
-int strip_last_octet_tag(uint8_t* frame, size_t* p_flen, int tag_pos, int tag_len)
+//Every length field sits before the tag, so this works on the source frame
+//(after the memmove) or on a copy that left the tag out
+static void strip_fix_lengths(uint8_t* frame, const StripPlan* S, int tag_len)
 {
-  if (!frame || !p_flen || *p_flen < 42 || tag_pos <= 0 || tag_len < 2) return -1;
-  size_t flen = *p_flen;
+  //Shrink allData length (if we found it)
+  if (S->have_all)
+    ber_len_write_same(frame, S->all_Lpos, S->all_Lval - (size_t)tag_len, S->all_nL);
 
-  //EtherType and offsets
-  uint16_t et = be16(frame + 12);
-  size_t app_len_off = 0, apdu_off = 0;
-  if (et == 0x8100) {
-    if (flen < 26 || be16(frame+16) != 0x88b8) return -2;
-    app_len_off = 20;
-    apdu_off    = 26;
-  } else if (et == 0x88b8) {
-    app_len_off = 16;
-    apdu_off    = 22;
-  } else return -3;
-
-  if ((size_t)tag_pos < apdu_off || (size_t)(tag_pos + tag_len) > flen) return -4;
-
-  //Locate outer SEQUENCE (0x61) first to fix its BER length later
-  size_t seq_tag = apdu_off;
-  size_t seq_L = 0, seq_nL = 0;
-  if (!ber_len_read(frame, flen, seq_tag+1, &seq_L, &seq_nL)) return -5;
-  size_t seq_V = seq_tag + 1 + seq_nL;
-
-  //Re-find allData using full BER and choose the one that contains the tag
-  size_t all_Lpos=0, all_Vpos=0, all_end=0, all_nL=0, all_Lval=0;
-  bool   have_all=false;
-  for (size_t i = seq_V; i + 2 <= flen; ) {
-    if (frame[i] == 0xAB) {
-      size_t L,nL; if (!ber_len_read(frame, flen, i+1, &L, &nL)) return -6;
-      size_t V = i+1+nL, E = V + L;
-      if (E > flen) return -7;
-      if ((size_t)tag_pos >= V && (size_t)(tag_pos + tag_len) <= E) {
-        all_Lpos = i+1; all_Vpos = V; all_end = E; all_nL = nL; all_Lval = L;
-        have_all = true;
-        break;
-      }
-      i = i + 1 + nL + L;
-      continue;
-    }
-    size_t nx = tlv_next_ber(frame, flen, i); if (!nx) break; i = nx;
-  }
+  //Shrink outer SEQUENCE(0x61) BER length unconditionally
+  ber_len_write_same(frame, S->seq_tag+1, S->seq_L - (size_t)tag_len, S->seq_nL);
+
+  //Shrink APPID Length (2-byte BE)
+  uint16_t app_len = be16(frame + S->app_len_off);
+  app_len = (uint16_t)(app_len - (uint16_t)tag_len);
+  set_be16(frame + S->app_len_off, app_len);
+}
+
+//Strip the last TLV & fix lengths, in place
+int strip_last_octet_tag(uint8_t* frame, size_t* p_flen, const GooseFrame* G,
+                         int tag_pos, int tag_len)
+{
+  if (!p_flen) return -1;
+  StripPlan S;
+  int rc = strip_plan(G, *p_flen, tag_pos, tag_len, &S);
+  if (rc != 0) return rc;
 
-  //1) Remove the final TLV with one memmove
+  //Remove the final TLV with one memmove
+  size_t flen = *p_flen;
   size_t tail_src = (size_t)tag_pos + (size_t)tag_len;
-  size_t tail_len = flen - tail_src;
-  memmove(frame + tag_pos, frame + tail_src, tail_len);
-  flen -= (size_t)tag_len;
-
-  //2) Shrink allData length (if we found it)
-  if (have_all) {
-    size_t new_all_L = all_Lval - (size_t)tag_len;
-    ber_len_write_same(frame, all_Lpos, new_all_L, all_nL);
-  }
+  memmove(frame + tag_pos, frame + tail_src, flen - tail_src);
+  strip_fix_lengths(frame, &S, tag_len);
 
-  //3) Shrink outer SEQUENCE(0x61) BER length unconditionally
-  size_t new_seq_L = seq_L - (size_t)tag_len;
-  ber_len_write_same(frame, seq_tag+1, new_seq_L, seq_nL);
+  *p_flen = flen - (size_t)tag_len;
+  return 0;
+}
 
-  //4) Shrink APPID Length (2-byte BE)
-  uint16_t app_len = be16(frame + app_len_off);
-  app_len = (uint16_t)(app_len - (uint16_t)tag_len);
-  set_be16(frame + app_len_off, app_len);
+//Copy src into dst without the tag TLV and fix lengths there. Used to
+//build the stripped frame straight in a TX slot or pool buffer
+int strip_tag_copy(uint8_t* dst, size_t dst_cap, const uint8_t* src, size_t flen,
+                   const GooseFrame* G, int tag_pos, int tag_len, size_t* out_len)
+{
+  StripPlan S;
+  int rc = strip_plan(G, flen, tag_pos, tag_len, &S);
+  if (rc != 0) return rc;
+  size_t out = flen - (size_t)tag_len;
+  if (out > dst_cap) return -8;
 
-  *p_flen = flen;
+  size_t tail_src = (size_t)tag_pos + (size_t)tag_len;
+  memcpy(dst, src, (size_t)tag_pos);
+  memcpy(dst + tag_pos, src + tail_src, flen - tail_src);
+  strip_fix_lengths(dst, &S, tag_len);
+
+  *out_len = out;
   return 0;
 }
+
+//Dataset canonicalization matching the publisher's auth_dataset_bytes_from_cfg():
+//one entry per allData element (tag excluded), in a single pass.
+//  boolean (0x83)          -> 01 01 b
+//  integer (0x85)          -> 02 04 value sign-extended to 32 bits
+//  unsigned (0x86)         -> 02 04 value
+//  anything else           -> 02 04 00000000 (publisher has no value for it)
+//The publisher's blob length is one byte, so stop before 255
+size_t make_dataset_canon_from_frame(uint8_t *out, size_t out_max,
+                                     const uint8_t* f, const GooseFrame* G)
+{
+    size_t w=0;
+    int n = G->nelem - 1;   //last element is the tag
+    if (n > GOOSE_MAX_ELEMS) n = GOOSE_MAX_ELEMS;
+    if (out_max > 255) out_max = 255;
+    for (int idx=0; idx<n; idx++) {
+        const Span* e = &G->elem[idx];
+        const uint8_t* val = f + e->off + e->hdr;
+        size_t L = e->len;
+
+        if (e->tag == 0x83) {
+            if (w+3 > out_max) break;
+            out[w++] = 0x01; out[w++] = 0x01;
+            out[w++] = (L>0 && val[L-1]!=0) ? 1 : 0;
+            continue;
+        }
+        if (w+6 > out_max) break;
+        uint32_t u=0;
+        if (e->tag == 0x85 || e->tag == 0x86) {
+            if (e->tag == 0x85 && L>0 && (val[0] & 0x80)) u = 0xFFFFFFFFu;
+            for (size_t k=0;k<L;k++) u=(u<<8)|val[k];
+        }
+        out[w++] = 0x02; out[w++] = 0x04;
+        out[w++] = (uint8_t)(u>>24);
+        out[w++] = (uint8_t)(u>>16);
+        out[w++] = (uint8_t)(u>>8);
+        out[w++] = (uint8_t)(u);
+    }
+    return w;
+}
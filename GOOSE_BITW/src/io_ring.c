@@ -0,0 +1,409 @@
+/*
+PACKET_MMAP I/O backend for bitw_engine
+----------------------------------------
+  - RX: TPACKET_V3 block ring, frames are read in place until the block is released
+  - TX: TPACKET_V2 frame ring on a second socket, kicked once per batch
+  - PACKET_QDISC_BYPASS on TX, outgoing frames ignored on RX
+  - Optional PACKET_FANOUT membership that spreads RX by GOOSE appId
+  - Classic BPF prefilter built from the policy, for rings and libpcap alike
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+//RX: 64 x 128 KiB blocks, retired after 1 ms so a sparse stream is not held back
+#define RX_BLOCK_SIZE  (1u << 17)
+#define RX_BLOCK_NR    64
+#define RX_FRAME_SIZE  2048
+#define RX_BLOCK_TOV   1
+
+//TX: 2 KiB slots, enough for any GOOSE frame plus the V2 header
+#define TX_FRAME_SIZE  2048
+#define TX_FRAME_NR    512
+#define TX_BLOCK_SIZE  (1u << 16)
+
+typedef struct {
+  char     ifname[IFNAMSIZ];
+  int      ifindex;
+
+  int      rx_fd;
+  uint8_t* rx_map;
+  size_t   rx_map_len;
+  unsigned rx_block;      //current block index
+  unsigned rx_left;       //frames still unread in the current block
+  struct tpacket3_hdr* rx_next;
+
+  int      tx_fd;
+  uint8_t* tx_map;
+  size_t   tx_map_len;
+  unsigned tx_head;       //next slot to fill
+  unsigned tx_pending;    //filled but not yet kicked
+
+  uint64_t rx_frames, tx_frames, tx_full, tx_errors;
+} Ring;
+
+static inline struct tpacket_block_desc* rx_block_at(Ring* R, unsigned i){
+  return (struct tpacket_block_desc*)(R->rx_map + (size_t)i * RX_BLOCK_SIZE);
+}
+static inline struct tpacket2_hdr* tx_slot_at(Ring* R, unsigned i){
+  return (struct tpacket2_hdr*)(R->tx_map + (size_t)i * TX_FRAME_SIZE);
+}
+static inline uint8_t* tx_data(struct tpacket2_hdr* h){
+  return (uint8_t*)h + TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+}
+
+static int rx_setup(Ring* R, char* err, size_t errlen)
+{
+  R->rx_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+  if (R->rx_fd < 0) { snprintf(err, errlen, "rx socket: %s", strerror(errno)); return -1; }
+
+  int v = TPACKET_V3;
+  if (setsockopt(R->rx_fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) < 0) {
+    snprintf(err, errlen, "PACKET_VERSION v3: %s", strerror(errno)); return -1;
+  }
+  //Headroom to re-insert an offloaded 802.1Q tag in place
+  unsigned reserve = 4;
+  setsockopt(R->rx_fd, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(reserve));
+#ifdef PACKET_IGNORE_OUTGOING
+  //Our own TX socket on this port must not loop back into RX
+  int one = 1;
+  setsockopt(R->rx_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+  struct tpacket_req3 req;
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = RX_BLOCK_SIZE;
+  req.tp_block_nr   = RX_BLOCK_NR;
+  req.tp_frame_size = RX_FRAME_SIZE;
+  req.tp_frame_nr   = (RX_BLOCK_SIZE / RX_FRAME_SIZE) * RX_BLOCK_NR;
+  req.tp_retire_blk_tov = RX_BLOCK_TOV;
+  if (setsockopt(R->rx_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+    snprintf(err, errlen, "PACKET_RX_RING: %s", strerror(errno)); return -1;
+  }
+  R->rx_map_len = (size_t)RX_BLOCK_SIZE * RX_BLOCK_NR;
+  R->rx_map = mmap(NULL, R->rx_map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, R->rx_fd, 0);
+  if (R->rx_map == MAP_FAILED) {
+    R->rx_map = NULL;
+    snprintf(err, errlen, "rx mmap: %s", strerror(errno)); return -1;
+  }
+
+  struct sockaddr_ll sll;
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family   = AF_PACKET;
+  sll.sll_protocol = htons(ETH_P_ALL);
+  sll.sll_ifindex  = R->ifindex;
+  if (bind(R->rx_fd, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
+    snprintf(err, errlen, "rx bind: %s", strerror(errno)); return -1;
+  }
+
+  struct packet_mreq mr;
+  memset(&mr, 0, sizeof(mr));
+  mr.mr_ifindex = R->ifindex;
+  mr.mr_type    = PACKET_MR_PROMISC;
+  if (setsockopt(R->rx_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) < 0) {
+    snprintf(err, errlen, "promisc: %s", strerror(errno)); return -1;
+  }
+  return 0;
+}
+
+static int tx_setup(Ring* R, char* err, size_t errlen)
+{
+  //Protocol 0: this socket only transmits
+  R->tx_fd = socket(AF_PACKET, SOCK_RAW, 0);
+  if (R->tx_fd < 0) { snprintf(err, errlen, "tx socket: %s", strerror(errno)); return -1; }
+
+  int v = TPACKET_V2;
+  if (setsockopt(R->tx_fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) < 0) {
+    snprintf(err, errlen, "PACKET_VERSION v2: %s", strerror(errno)); return -1;
+  }
+#ifdef PACKET_QDISC_BYPASS
+  int one = 1;
+  setsockopt(R->tx_fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+#endif
+
+  struct tpacket_req req;
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = TX_BLOCK_SIZE;
+  req.tp_frame_size = TX_FRAME_SIZE;
+  req.tp_frame_nr   = TX_FRAME_NR;
+  req.tp_block_nr   = (TX_FRAME_NR * TX_FRAME_SIZE) / TX_BLOCK_SIZE;
+  if (setsockopt(R->tx_fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+    snprintf(err, errlen, "PACKET_TX_RING: %s", strerror(errno)); return -1;
+  }
+  R->tx_map_len = (size_t)TX_FRAME_NR * TX_FRAME_SIZE;
+  R->tx_map = mmap(NULL, R->tx_map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, R->tx_fd, 0);
+  if (R->tx_map == MAP_FAILED) {
+    R->tx_map = NULL;
+    snprintf(err, errlen, "tx mmap: %s", strerror(errno)); return -1;
+  }
+
+  struct sockaddr_ll sll;
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family  = AF_PACKET;
+  sll.sll_ifindex = R->ifindex;
+  if (bind(R->tx_fd, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
+    snprintf(err, errlen, "tx bind: %s", strerror(errno)); return -1;
+  }
+  return 0;
+}
+
+void ring_close(void* r)
+{
+  Ring* R = (Ring*)r;
+  if (!R) return;
+  if (R->rx_map) munmap(R->rx_map, R->rx_map_len);
+  if (R->tx_map) munmap(R->tx_map, R->tx_map_len);
+  if (R->rx_fd >= 0) close(R->rx_fd);
+  if (R->tx_fd >= 0) close(R->tx_fd);
+  fprintf(stderr, "[ring %s] rx=%llu tx=%llu tx_full=%llu tx_err=%llu\n", R->ifname,
+          (unsigned long long)R->rx_frames, (unsigned long long)R->tx_frames,
+          (unsigned long long)R->tx_full, (unsigned long long)R->tx_errors);
+  free(R);
+}
+
+//Either side can be left out: a worker that only transmits on a port
+//should not also drain a copy of that port's traffic
+void* ring_open_dir(const char* ifname, bool rx, bool tx, char* err, size_t errlen)
+{
+  Ring* R = (Ring*)calloc(1, sizeof(*R));
+  if (!R) { snprintf(err, errlen, "out of memory"); return NULL; }
+  R->rx_fd = R->tx_fd = -1;
+  snprintf(R->ifname, sizeof(R->ifname), "%s", ifname);
+  R->ifindex = (int)if_nametoindex(ifname);
+  if (R->ifindex == 0) {
+    snprintf(err, errlen, "no such interface");
+    free(R); return NULL;
+  }
+  if ((rx && rx_setup(R, err, errlen) != 0) || (tx && tx_setup(R, err, errlen) != 0)) {
+    ring_close(R);
+    return NULL;
+  }
+  return R;
+}
+
+void* ring_open(const char* ifname, char* err, size_t errlen)
+{
+  return ring_open_dir(ifname, true, true, err, errlen);
+}
+
+int ring_fd(void* r) { return ((Ring*)r)->rx_fd; }
+
+//Join fd (any bound AF_PACKET socket, ring or libpcap) to fanout group.
+//The classic BPF demux returns the GOOSE appId, so a stream always lands
+//on the same member; everything else (PTP etc.) goes to member 0 in order.
+//Offsets are from the MAC header since skb->data is past it at this point
+int packet_fanout_join(int fd, uint16_t group, char* err, size_t errlen)
+{
+  static struct sock_filter demux[] = {
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, SKF_LL_OFF + 12),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x88b8, 0, 2),
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, SKF_LL_OFF + 14),
+    BPF_STMT(BPF_RET|BPF_A, 0),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x8100, 0, 4),
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, SKF_LL_OFF + 16),
+    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x88b8, 0, 2),
+    BPF_STMT(BPF_LD|BPF_H|BPF_ABS, SKF_LL_OFF + 18),
+    BPF_STMT(BPF_RET|BPF_A, 0),
+    BPF_STMT(BPF_RET|BPF_K, 0),
+  };
+  struct sock_fprog prog = { .len = sizeof(demux)/sizeof(demux[0]), .filter = demux };
+
+#ifdef PACKET_IGNORE_OUTGOING
+  //Every worker's send-only port on this interface would otherwise feed
+  //the group too. libpcap members drop them (PCAP_D_IN), but only after
+  //the kernel copied each one in; skip that for both backends
+  int one = 1;
+  setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+  int arg = group | (PACKET_FANOUT_CBPF << 16);
+  if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+    snprintf(err, errlen, "PACKET_FANOUT: %s", strerror(errno)); return -1;
+  }
+  if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT_DATA, &prog, sizeof(prog)) < 0) {
+    snprintf(err, errlen, "PACKET_FANOUT_DATA: %s", strerror(errno)); return -1;
+  }
+  return 0;
+}
+
+//Next received frame, valid until the following ring_rx_next() call.
+//Returns 1 with a frame, 0 when no retired block is waiting
+int ring_rx_next(void* r, const uint8_t** pkt, size_t* len, uint64_t* ts_ns)
+{
+  Ring* R = (Ring*)r;
+  for (;;) {
+    if (R->rx_left == 0 && R->rx_next) {
+      //Current block fully consumed: hand it back and move on
+      struct tpacket_block_desc* bd = rx_block_at(R, R->rx_block);
+      __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+      R->rx_block = (R->rx_block + 1) % RX_BLOCK_NR;
+      R->rx_next  = NULL;
+    }
+    if (!R->rx_next) {
+      struct tpacket_block_desc* bd = rx_block_at(R, R->rx_block);
+      uint32_t st = __atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE);
+      if (!(st & TP_STATUS_USER)) return 0;
+      R->rx_left = bd->hdr.bh1.num_pkts;
+      R->rx_next = (struct tpacket3_hdr*)((uint8_t*)bd + bd->hdr.bh1.offset_to_first_pkt);
+      if (R->rx_left == 0) continue;
+    }
+
+    struct tpacket3_hdr* h = R->rx_next;
+    R->rx_next = (struct tpacket3_hdr*)((uint8_t*)h + h->tp_next_offset);
+    R->rx_left--;
+
+    const struct sockaddr_ll* sll =
+      (const struct sockaddr_ll*)((uint8_t*)h + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    if (sll->sll_pkttype == PACKET_OUTGOING) continue;
+
+    uint8_t* p = (uint8_t*)h + h->tp_mac;
+    size_t   L = h->tp_snaplen;
+
+    //NIC stripped the 802.1Q tag: put it back so parsing matches the wire
+    if ((h->tp_status & TP_STATUS_VLAN_VALID) && L >= 12) {
+      uint16_t tpid = (h->tp_status & TP_STATUS_VLAN_TPID_VALID) ? h->hv1.tp_vlan_tpid : ETH_P_8021Q;
+      memmove(p - 4, p, 12);
+      p -= 4;
+      p[12] = (uint8_t)(tpid >> 8);               p[13] = (uint8_t)tpid;
+      p[14] = (uint8_t)(h->hv1.tp_vlan_tci >> 8); p[15] = (uint8_t)h->hv1.tp_vlan_tci;
+      L += 4;
+    }
+
+    R->rx_frames++;
+    *pkt = p; *len = L;
+    if (ts_ns) *ts_ns = (uint64_t)h->tp_sec * 1000000000ULL + h->tp_nsec;
+    return 1;
+  }
+}
+
+//Kick the kernel to transmit every slot marked SEND_REQUEST
+int ring_tx_flush(void* r)
+{
+  Ring* R = (Ring*)r;
+  if (!R->tx_pending) return 0;
+  ssize_t rc = sendto(R->tx_fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+  R->tx_pending = 0;
+  if (rc < 0 && errno != EAGAIN && errno != ENOBUFS) {
+    R->tx_errors++;
+    return -1;
+  }
+  return 0;
+}
+
+//Free TX slot to build a frame into, or NULL when the ring is full
+uint8_t* ring_tx_slot(void* r, size_t* cap)
+{
+  Ring* R = (Ring*)r;
+  struct tpacket2_hdr* h = tx_slot_at(R, R->tx_head);
+  uint32_t st = __atomic_load_n(&h->tp_status, __ATOMIC_ACQUIRE);
+  if (st == TP_STATUS_WRONG_FORMAT) {
+    R->tx_errors++;
+    st = TP_STATUS_AVAILABLE;
+  }
+  if (st != TP_STATUS_AVAILABLE) {
+    //Kernel still owns it: push what we have and try once more
+    ring_tx_flush(R);
+    st = __atomic_load_n(&h->tp_status, __ATOMIC_ACQUIRE);
+    if (st != TP_STATUS_AVAILABLE && st != TP_STATUS_WRONG_FORMAT) { R->tx_full++; return NULL; }
+  }
+  *cap = TX_FRAME_SIZE - TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+  return tx_data(h);
+}
+
+//Hand the slot returned by ring_tx_slot() to the kernel
+void ring_tx_commit(void* r, size_t len)
+{
+  Ring* R = (Ring*)r;
+  struct tpacket2_hdr* h = tx_slot_at(R, R->tx_head);
+  h->tp_len = (uint32_t)len;
+  __atomic_store_n(&h->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+  R->tx_head = (R->tx_head + 1) % TX_FRAME_NR;
+  R->tx_frames++;
+  if (++R->tx_pending >= TX_FRAME_NR / 4) ring_tx_flush(R);
+}
+
+int ring_tx_send(void* r, const uint8_t* pkt, size_t len)
+{
+  size_t cap = 0;
+  uint8_t* slot = ring_tx_slot(r, &cap);
+  if (!slot) return -1;
+  if (len > cap) { ((Ring*)r)->tx_errors++; return -1; }
+  memcpy(slot, pkt, len);
+  ring_tx_commit(r, len);
+  return 0;
+}
+
+//Receive prefilter: PTP and GOOSE (plain or 802.1Q) are let through, GOOSE
+//only for the given appIds when check_appId is set, anything else only
+//when pass_other is set. Offsets are from the MAC header (socket filters
+//run with skb->data there); X holds the VLAN shift for the appId load.
+//appIds are tested as sorted ranges, four short jumps each, so there are
+//no long branches; past BPF_MAXINSNS the appId test is left to userspace.
+//Returns the instruction count and a malloc'd program in *out, or -1
+#define PF_ACCEPT 0xFFFF
+
+int prefilter_build(const uint16_t* by_appId, bool check_appId, bool pass_other, void** out)
+{
+  int nr = 0;
+  for (unsigned a = 0; check_appId && a < 65536; a++)
+    if (by_appId[a] && (a == 0 || !by_appId[a-1])) nr++;
+  if (10 + 4 * nr + 1 > BPF_MAXINSNS) {
+    fprintf(stderr, "[prefilter] %d appId ranges do not fit, appIds checked in userspace only\n", nr);
+    check_appId = false; nr = 0;
+  }
+
+  struct sock_filter* f = (struct sock_filter*)calloc((size_t)(10 + 4 * nr + 1), sizeof(*f));
+  if (!f) return -1;
+  int n = 0;
+  f[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 12);
+  f[n++] = (struct sock_filter)BPF_STMT(BPF_LDX|BPF_IMM, 0);
+  f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_8021Q, 0, 2);
+  f[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 16);
+  f[n++] = (struct sock_filter)BPF_STMT(BPF_LDX|BPF_IMM, 4);
+  f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x88f7, 2, 0);
+  f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x88b8, 2, 0);
+  f[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, pass_other ? PF_ACCEPT : 0);
+  f[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, PF_ACCEPT);
+  if (!check_appId) {
+    //GOOSE jumps here too
+    f[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, PF_ACCEPT);
+    *out = f;
+    return n;
+  }
+  f[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_IND, 14);
+  for (unsigned a = 0; a < 65536; a++) {
+    if (!by_appId[a]) continue;
+    unsigned lo = a;
+    while (a + 1 < 65536 && by_appId[a+1]) a++;
+    //A > hi: next range; A >= lo: accept; else below every later range: drop
+    f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JGT|BPF_K, a, 3, 0);
+    f[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, lo, 0, 1);
+    f[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, PF_ACCEPT);
+    f[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, 0);
+  }
+  f[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, 0);
+  *out = f;
+  return n;
+}
+
+int packet_set_filter(int fd, const void* insns, int len, char* err, size_t errlen)
+{
+  struct sock_fprog prog = { .len = (unsigned short)len, .filter = (struct sock_filter*)insns };
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+    snprintf(err, errlen, "SO_ATTACH_FILTER: %s", strerror(errno)); return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,433 @@
+/*
+AF_XDP bridge backend for bitw_engine
+--------------------------------------
+  - One XSK socket per port (queue 0), both on a single shared UMEM. Ports
+    with more than one RX queue are refused: RSS would steer frames to
+    queues nothing reads, and they would pass to the stack unbridged
+  - A verified frame is forwarded by posting its UMEM address to the
+    other port's TX ring, so the payload is never copied
+  - Zero-copy bind is tried first, copy mode (generic XDP, veth) is the fallback
+  - Each port owns half the UMEM for the frames it receives. Those frames
+    come back through the peer's completion ring, so one direction
+    (A rx/fill, B tx/completion, A's pool) never touches the other's state
+    and the two directions can run on separate threads
+  - Needs Linux >= 5.10 (shared UMEM across devices, XDP links)
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/if_xdp.h>
+#include <linux/sockios.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+//From bpf_sys.c
+extern int bpf_map_create_simple(uint32_t type, uint32_t key_size, uint32_t value_size,
+                                 uint32_t max_entries, const char* name);
+extern int bpf_map_update(int fd, const void* key, const void* value);
+extern int bpf_xdp_prog_load(const struct bpf_insn* insns, size_t n, const char* name,
+                             char* err, size_t errlen);
+extern int bpf_xdp_attach(int prog_fd, int ifindex, bool* generic, char* err, size_t errlen);
+//From xdp_guard.c
+extern int xguard_prog_load(void* guard, int xsk_map_fd, char* err, size_t errlen);
+
+#define UMEM_FRAMES    4096
+#define UMEM_FRAME_SZ  2048
+#define RING_SZ        1024   //rx/tx/fill/completion, power of two
+
+typedef struct {
+  uint32_t *prod, *cons, *flags;
+  void     *ring;
+  void     *map; size_t map_len;
+  uint32_t  mask;
+} XRing;
+
+typedef struct XPair XPair;
+
+typedef struct XPort {
+  XPair*   pair;
+  char     ifname[IFNAMSIZ];
+  int      ifindex;
+  int      fd;
+  int      map_fd, prog_fd, link_fd;
+  bool     generic;
+  XRing    rx, tx, fq, cq;
+  uint64_t cur;          //UMEM address of the frame last returned by rx
+  bool     cur_valid;
+  bool     cur_taken;    //cur was handed to a TX ring
+  uint32_t tx_pending;
+  uint64_t rx_frames, tx_frames, tx_full, tx_copies;
+  //Free frames for this port's RX (and for copies sent the same direction)
+  uint64_t free_addr[UMEM_FRAMES/2];
+  uint32_t nfree;
+  struct XPort* peer;
+} XPort;
+
+struct XPair {
+  uint8_t* umem;
+  size_t   umem_len;
+  bool     zerocopy;
+  XPort    port[2];
+};
+
+static inline uint64_t frame_base(uint64_t a) { return a & ~((uint64_t)UMEM_FRAME_SZ - 1); }
+
+//Producer-side helpers (fill, tx)
+static inline uint32_t prod_free(XRing* r) {
+  uint32_t c = __atomic_load_n(r->cons, __ATOMIC_ACQUIRE);
+  return (r->mask + 1) - (*r->prod - c);
+}
+static inline void prod_publish(XRing* r, uint32_t n) {
+  __atomic_store_n(r->prod, *r->prod + n, __ATOMIC_RELEASE);
+}
+//Consumer-side helpers (rx, completion)
+static inline uint32_t cons_avail(XRing* r) {
+  uint32_t p = __atomic_load_n(r->prod, __ATOMIC_ACQUIRE);
+  return p - *r->cons;
+}
+static inline void cons_release(XRing* r, uint32_t n) {
+  __atomic_store_n(r->cons, *r->cons + n, __ATOMIC_RELEASE);
+}
+
+static void free_push(XPort* p, uint64_t addr) {
+  if (p->nfree < UMEM_FRAMES/2) p->free_addr[p->nfree++] = frame_base(addr);
+}
+
+//Everything on tx's TX ring came from the peer's pool, so that is where
+//completed buffers go back to. Only the thread transmitting on tx calls this
+static void reap_cq(XPort* tx)
+{
+  uint32_t n = cons_avail(&tx->cq);
+  uint64_t* a = (uint64_t*)tx->cq.ring;
+  for (uint32_t i=0;i<n;i++) free_push(tx->peer, a[(*tx->cq.cons + i) & tx->cq.mask]);
+  if (n) cons_release(&tx->cq, n);
+}
+
+static void refill_fq(XPort* p)
+{
+  uint32_t n = prod_free(&p->fq);
+  if (n > p->nfree) n = p->nfree;
+  uint64_t* a = (uint64_t*)p->fq.ring;
+  for (uint32_t i=0;i<n;i++) a[(*p->fq.prod + i) & p->fq.mask] = p->free_addr[--p->nfree];
+  if (n) prod_publish(&p->fq, n);
+}
+
+static int map_ring(int fd, XRing* r, uint64_t pgoff, const struct xdp_ring_offset* off,
+                    size_t desc_sz, char* err, size_t errlen)
+{
+  r->map_len = off->desc + (size_t)RING_SZ * desc_sz;
+  r->map = mmap(NULL, r->map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, (off_t)pgoff);
+  if (r->map == MAP_FAILED) {
+    r->map = NULL;
+    snprintf(err, errlen, "ring mmap: %s", strerror(errno));
+    return -1;
+  }
+  r->prod  = (uint32_t*)((uint8_t*)r->map + off->producer);
+  r->cons  = (uint32_t*)((uint8_t*)r->map + off->consumer);
+  r->flags = (uint32_t*)((uint8_t*)r->map + off->flags);
+  r->ring  = (uint8_t*)r->map + off->desc;
+  r->mask  = RING_SZ - 1;
+  return 0;
+}
+
+static int xsk_socket(XPort* p, const XPair* X, bool first, char* err, size_t errlen)
+{
+  p->fd = socket(AF_XDP, SOCK_RAW, 0);
+  if (p->fd < 0) { snprintf(err, errlen, "AF_XDP socket: %s", strerror(errno)); return -1; }
+
+  if (first) {
+    struct xdp_umem_reg mr;
+    memset(&mr, 0, sizeof(mr));
+    mr.addr = (uint64_t)(uintptr_t)X->umem;
+    mr.len  = X->umem_len;
+    mr.chunk_size = UMEM_FRAME_SZ;
+    if (setsockopt(p->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) < 0) {
+      snprintf(err, errlen, "XDP_UMEM_REG: %s", strerror(errno)); return -1;
+    }
+  }
+  //Each device needs its own fill/completion pair, even with a shared UMEM
+  int sz = RING_SZ;
+  if (setsockopt(p->fd, SOL_XDP, XDP_UMEM_FILL_RING, &sz, sizeof(sz)) < 0 ||
+      setsockopt(p->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &sz, sizeof(sz)) < 0 ||
+      setsockopt(p->fd, SOL_XDP, XDP_RX_RING, &sz, sizeof(sz)) < 0 ||
+      setsockopt(p->fd, SOL_XDP, XDP_TX_RING, &sz, sizeof(sz)) < 0) {
+    snprintf(err, errlen, "xsk ring setup: %s", strerror(errno)); return -1;
+  }
+
+  struct xdp_mmap_offsets off;
+  socklen_t ol = sizeof(off);
+  if (getsockopt(p->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &ol) < 0) {
+    snprintf(err, errlen, "XDP_MMAP_OFFSETS: %s", strerror(errno)); return -1;
+  }
+  if (map_ring(p->fd, &p->rx, XDP_PGOFF_RX_RING, &off.rx, sizeof(struct xdp_desc), err, errlen) ||
+      map_ring(p->fd, &p->tx, XDP_PGOFF_TX_RING, &off.tx, sizeof(struct xdp_desc), err, errlen) ||
+      map_ring(p->fd, &p->fq, XDP_UMEM_PGOFF_FILL_RING, &off.fr, sizeof(uint64_t), err, errlen) ||
+      map_ring(p->fd, &p->cq, XDP_UMEM_PGOFF_COMPLETION_RING, &off.cr, sizeof(uint64_t), err, errlen))
+    return -1;
+  return 0;
+}
+
+static int xsk_bind(XPort* p, XPair* X, int shared_fd, char* err, size_t errlen)
+{
+  struct sockaddr_xdp sx;
+  memset(&sx, 0, sizeof(sx));
+  sx.sxdp_family   = AF_XDP;
+  sx.sxdp_ifindex  = (uint32_t)p->ifindex;
+  sx.sxdp_queue_id = 0;
+  if (shared_fd >= 0) {
+    //Mode is inherited from the UMEM owner
+    sx.sxdp_flags = XDP_SHARED_UMEM;
+    sx.sxdp_shared_umem_fd = (uint32_t)shared_fd;
+    if (bind(p->fd, (struct sockaddr*)&sx, sizeof(sx)) == 0) return 0;
+  } else {
+    sx.sxdp_flags = XDP_ZEROCOPY;
+    if (bind(p->fd, (struct sockaddr*)&sx, sizeof(sx)) == 0) { X->zerocopy = true; return 0; }
+    sx.sxdp_flags = XDP_COPY;
+    if (bind(p->fd, (struct sockaddr*)&sx, sizeof(sx)) == 0) { X->zerocopy = false; return 0; }
+  }
+  snprintf(err, errlen, "xsk bind: %s", strerror(errno));
+  return -1;
+}
+
+//XDP program: redirect every frame on queue N to xskmap[N], pass otherwise
+//  r2 = ctx->rx_queue_index; r1 = &xskmap; r3 = XDP_PASS; return bpf_redirect_map()
+//With a guard, its filter runs first and ends in the same redirect
+static int load_redirect_prog(XPort* p, void* guard, char* err, size_t errlen)
+{
+  p->map_fd = bpf_map_create_simple(BPF_MAP_TYPE_XSKMAP, 4, 4, 64, "bitw_xsk");
+  if (p->map_fd < 0) { snprintf(err, errlen, "xskmap: %s", strerror(errno)); return -1; }
+
+  struct bpf_insn prog[] = {
+    { .code = BPF_LDX|BPF_MEM|BPF_W, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_1,
+      .off = (int16_t)offsetof(struct xdp_md, rx_queue_index) },
+    { .code = BPF_LD|BPF_DW|BPF_IMM, .dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD,
+      .imm = p->map_fd },
+    { 0 },
+    { .code = BPF_ALU64|BPF_MOV|BPF_K, .dst_reg = BPF_REG_3, .imm = XDP_PASS },
+    { .code = BPF_JMP|BPF_CALL, .imm = BPF_FUNC_redirect_map },
+    { .code = BPF_JMP|BPF_EXIT },
+  };
+  p->prog_fd = guard ? xguard_prog_load(guard, p->map_fd, err, errlen)
+                     : bpf_xdp_prog_load(prog, sizeof(prog)/sizeof(prog[0]), "bitw_xsk", err, errlen);
+  if (p->prog_fd < 0) return -1;
+
+  uint32_t q = 0, v = (uint32_t)p->fd;
+  if (bpf_map_update(p->map_fd, &q, &v) < 0) {
+    snprintf(err, errlen, "xskmap update: %s", strerror(errno)); return -1;
+  }
+  p->link_fd = bpf_xdp_attach(p->prog_fd, p->ifindex, &p->generic, err, errlen);
+  return p->link_fd < 0 ? -1 : 0;
+}
+
+//RX queues the NIC spreads frames over: its ethtool channels, or the
+//rx-N entries in sysfs for drivers without channel support
+static int rx_queues(const char* ifname)
+{
+  struct ethtool_channels ch;
+  struct ifreq ifr;
+  memset(&ch, 0, sizeof(ch));
+  memset(&ifr, 0, sizeof(ifr));
+  ch.cmd = ETHTOOL_GCHANNELS;
+  snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+  ifr.ifr_data = (char*)&ch;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0), n = -1;
+  if (fd >= 0) {
+    if (ioctl(fd, SIOCETHTOOL, &ifr) == 0) n = (int)(ch.combined_count + ch.rx_count);
+    close(fd);
+  }
+  if (n > 0) return n;
+
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/class/net/%s/queues", ifname);
+  DIR* d = opendir(path);
+  if (!d) return 1;
+  struct dirent* e;
+  n = 0;
+  while ((e = readdir(d))) if (strncmp(e->d_name, "rx-", 3) == 0) n++;
+  closedir(d);
+  return n > 0 ? n : 1;
+}
+
+static void xport_close(XPort* p)
+{
+  XRing* rs[4] = { &p->rx, &p->tx, &p->fq, &p->cq };
+  for (int i=0;i<4;i++) if (rs[i]->map) munmap(rs[i]->map, rs[i]->map_len);
+  if (p->link_fd >= 0) close(p->link_fd);
+  if (p->prog_fd >= 0) close(p->prog_fd);
+  if (p->map_fd  >= 0) close(p->map_fd);
+  if (p->fd      >= 0) close(p->fd);
+}
+
+void xdp_close(void* pair)
+{
+  XPair* X = (XPair*)pair;
+  if (!X) return;
+  for (int i=0;i<2;i++) {
+    XPort* p = &X->port[i];
+    if (p->ifname[0])
+      fprintf(stderr, "[xdp %s] rx=%llu tx=%llu tx_full=%llu tx_copies=%llu\n", p->ifname,
+              (unsigned long long)p->rx_frames, (unsigned long long)p->tx_frames,
+              (unsigned long long)p->tx_full, (unsigned long long)p->tx_copies);
+  }
+  //Sockets that share the UMEM go first, the owner last
+  xport_close(&X->port[1]);
+  xport_close(&X->port[0]);
+  if (X->umem) munmap(X->umem, X->umem_len);
+  free(X);
+}
+
+//Open both bridge ports on one UMEM. Port 0 owns it, port 1 shares it.
+//guard (xdp_guard.c) may be NULL; generic skips the native XDP attempt
+void* xdp_open(const char* ifA, const char* ifB, void* guard, bool generic, char* err, size_t errlen)
+{
+  XPair* X = (XPair*)calloc(1, sizeof(*X));
+  if (!X) { snprintf(err, errlen, "out of memory"); return NULL; }
+  const char* names[2] = { ifA, ifB };
+  for (int i=0;i<2;i++) {
+    XPort* p = &X->port[i];
+    p->pair = X;
+    p->peer = &X->port[1-i];
+    p->fd = p->map_fd = p->prog_fd = p->link_fd = -1;
+    p->generic = generic;
+    snprintf(p->ifname, sizeof(p->ifname), "%s", names[i]);
+    p->ifindex = (int)if_nametoindex(names[i]);
+    if (!p->ifindex) { snprintf(err, errlen, "%s: no such interface", names[i]); xdp_close(X); return NULL; }
+    int nq = rx_queues(names[i]);
+    if (nq > 1) {
+      snprintf(err, errlen, "%s has %d RX queues and only queue 0 is bridged; "
+               "run 'ethtool -L %s combined 1' first", names[i], nq, names[i]);
+      xdp_close(X); return NULL;
+    }
+  }
+
+  X->umem_len = (size_t)UMEM_FRAMES * UMEM_FRAME_SZ;
+  X->umem = mmap(NULL, X->umem_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+  if (X->umem == MAP_FAILED) {
+    X->umem = NULL;
+    snprintf(err, errlen, "umem mmap: %s", strerror(errno));
+    xdp_close(X); return NULL;
+  }
+  for (uint32_t i=0;i<UMEM_FRAMES;i++) {
+    XPort* p = &X->port[i % 2];
+    p->free_addr[p->nfree++] = (uint64_t)i * UMEM_FRAME_SZ;
+  }
+
+  for (int i=0;i<2;i++) {
+    XPort* p = &X->port[i];
+    if (xsk_socket(p, X, i == 0, err, errlen) != 0) { xdp_close(X); return NULL; }
+    //RING_SZ frames go on the fill ring, the rest covers frames in flight
+    refill_fq(p);
+    if (xsk_bind(p, X, i == 0 ? -1 : X->port[0].fd, err, errlen) != 0 ||
+        load_redirect_prog(p, guard, err, errlen) != 0) {
+      xdp_close(X); return NULL;
+    }
+  }
+  fprintf(stderr, "[xdp] %s <-> %s bound, %s, %s XDP\n", ifA, ifB,
+          X->zerocopy ? "zero-copy" : "copy mode",
+          X->port[0].generic ? "generic" : "native");
+  return X;
+}
+
+void* xdp_port(void* pair, int idx) { return &((XPair*)pair)->port[idx]; }
+int   xdp_fd(void* port)            { return ((XPort*)port)->fd; }
+
+//Return the previous RX buffer to the pool unless it went out on TX
+static void release_cur(XPort* p)
+{
+  if (p->cur_valid && !p->cur_taken) free_push(p, p->cur);
+  p->cur_valid = p->cur_taken = false;
+}
+
+//Next received frame, writable in place and valid until the next call.
+//Returns 1 with a frame, 0 when the RX ring is empty
+int xdp_rx_next(void* port, uint8_t** pkt, size_t* len)
+{
+  XPort* p = (XPort*)port;
+  release_cur(p);
+  if (cons_avail(&p->rx) == 0) {
+    reap_cq(p->peer);
+    refill_fq(p);
+    return 0;
+  }
+  const struct xdp_desc* d = &((struct xdp_desc*)p->rx.ring)[*p->rx.cons & p->rx.mask];
+  p->cur = d->addr;
+  *len   = d->len;
+  cons_release(&p->rx, 1);
+  p->cur_valid = true;
+  p->rx_frames++;
+  *pkt = p->pair->umem + p->cur;
+  //Keep the fill ring topped up while the frames are flowing
+  if ((p->rx_frames & 63) == 0) refill_fq(p);
+  return 1;
+}
+
+static int tx_post(XPort* tx, uint64_t addr, size_t len)
+{
+  if (prod_free(&tx->tx) == 0) {
+    reap_cq(tx);
+    if (prod_free(&tx->tx) == 0) { tx->tx_full++; return -1; }
+  }
+  struct xdp_desc* d = &((struct xdp_desc*)tx->tx.ring)[*tx->tx.prod & tx->tx.mask];
+  d->addr = addr; d->len = (uint32_t)len; d->options = 0;
+  prod_publish(&tx->tx, 1);
+  tx->tx_frames++;
+  tx->tx_pending++;
+  return 0;
+}
+
+//Forward the frame last returned by xdp_rx_next() on rx, without copying
+int xdp_tx_forward(void* rxport, void* txport, const uint8_t* pkt, size_t len)
+{
+  XPort* rx = (XPort*)rxport; XPort* tx = (XPort*)txport;
+  uint64_t addr = (uint64_t)(pkt - rx->pair->umem);
+  if (!rx->cur_valid || frame_base(addr) != frame_base(rx->cur)) return -1;
+  if (tx_post(tx, addr, len) != 0) return -1;
+  rx->cur_taken = true;
+  return 0;
+}
+
+//Copy an arbitrary frame into a free UMEM buffer and queue it
+int xdp_tx_send(void* txport, const uint8_t* pkt, size_t len)
+{
+  XPort* tx = (XPort*)txport; XPort* src = tx->peer;
+  if (len > UMEM_FRAME_SZ) return -1;
+  if (src->nfree == 0) reap_cq(tx);
+  if (src->nfree == 0) { tx->tx_full++; return -1; }
+  uint64_t a = src->free_addr[--src->nfree];
+  memcpy(tx->pair->umem + a, pkt, len);
+  if (tx_post(tx, a, len) != 0) { free_push(src, a); return -1; }
+  tx->tx_copies++;
+  return 0;
+}
+
+int xdp_tx_flush(void* txport)
+{
+  XPort* tx = (XPort*)txport;
+  if (tx->tx_pending) {
+    tx->tx_pending = 0;
+    if (sendto(tx->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+        errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+      return -1;
+  }
+  reap_cq(tx);
+  return 0;
+}
@@ -0,0 +1,191 @@
+/*
+Binary verdict journal for bitw_engine
+---------------------------------------
+  - One single-producer ring per forwarding thread: the hot path copies a
+    32-byte record and bumps an index, no locks, no syscalls, no formatting
+  - A full ring never blocks the sender; the record is dropped and counted
+  - A background thread drains all rings into a memory-mapped file used as
+    a circular flight recorder (the newest `cap` records survive)
+  - bitw_journal (bitw_journal.c) decodes the file
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+//File layout, must match bitw_journal.c: a 64-byte header, then cap records
+#define JRNL_MAGIC "GBJRNL1"
+
+typedef struct {
+  char     magic[8];
+  uint32_t rec_size;
+  uint32_t cap;         //records in the file, slot of record i is i % cap
+  uint64_t written;     //records ever written (published last)
+  uint64_t overflow;    //records lost to full rings
+  uint64_t start_ns;
+  uint8_t  pad[24];
+} JHeader;
+
+//One verdict, must match bitw_engine.c and bitw_journal.c
+typedef struct {
+  uint64_t ts_ns;       //kernel RX time (CLOCK_REALTIME)
+  uint32_t st, sq;
+  uint32_t proc_ns;     //RX hand-over to verdict
+  uint16_t appId;
+  int16_t  delta;       //bytes removed by strip
+  uint16_t len;         //frame length as received
+  uint8_t  dir;         //0 = A->B, 1 = B->A
+  uint8_t  worker;
+  uint8_t  kind;        //JK_* in bitw_engine.c
+  int8_t   code;        //verifier result
+  int8_t   strip_rc;    //strip error, 0 = none
+  uint8_t  pad;
+} JRec;
+
+_Static_assert(sizeof(JHeader) == 64, "JHeader must stay 64 bytes");
+_Static_assert(sizeof(JRec) == 32, "JRec must stay 32 bytes");
+
+#define JRING_SZ    4096          //records per thread, power of two
+#define JRNL_MAX    130           //rings: 64 workers per direction + spare
+
+typedef struct {
+  uint64_t head __attribute__((aligned(64)));   //producer
+  uint64_t overflow;                            //producer, read relaxed
+  uint64_t tail __attribute__((aligned(64)));   //writer thread
+  JRec     rec[JRING_SZ];
+} JRing;
+
+typedef struct {
+  int       fd;
+  JHeader*  hdr;
+  JRec*     recs;
+  size_t    map_len;
+  uint64_t  written;
+  JRing*    rings[JRNL_MAX];
+  int       nrings;         //set before the writer starts, then fixed
+  pthread_t th;
+  bool      started;
+  volatile int stop;
+  char      path[256];
+} Journal;
+
+static uint64_t jnow_ns(void)
+{
+  struct timespec ts; clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//Create (or truncate) path and map it for cap records
+void* journal_open(const char* path, unsigned cap, char* err, size_t errlen)
+{
+  if (cap < JRING_SZ) cap = JRING_SZ;
+  Journal* J = (Journal*)calloc(1, sizeof(*J));
+  if (!J) { snprintf(err, errlen, "out of memory"); return NULL; }
+  snprintf(J->path, sizeof(J->path), "%s", path);
+  J->fd = open(path, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+  if (J->fd < 0) { snprintf(err, errlen, "%s: %s", path, strerror(errno)); free(J); return NULL; }
+  J->map_len = sizeof(JHeader) + (size_t)cap * sizeof(JRec);
+  void* m = MAP_FAILED;
+  if (ftruncate(J->fd, (off_t)J->map_len) == 0)
+    m = mmap(NULL, J->map_len, PROT_READ|PROT_WRITE, MAP_SHARED, J->fd, 0);
+  if (m == MAP_FAILED) {
+    snprintf(err, errlen, "%s: %s", path, strerror(errno));
+    close(J->fd); free(J);
+    return NULL;
+  }
+  J->hdr = (JHeader*)m;
+  J->recs = (JRec*)((uint8_t*)m + sizeof(JHeader));
+  memcpy(J->hdr->magic, JRNL_MAGIC, sizeof(JRNL_MAGIC));
+  J->hdr->rec_size = sizeof(JRec);
+  J->hdr->cap = cap;
+  J->hdr->start_ns = jnow_ns();
+  return J;
+}
+
+//A ring for one forwarding thread. Call before journal_start()
+void* journal_ring(void* journal)
+{
+  Journal* J = (Journal*)journal;
+  if (!J || J->nrings == JRNL_MAX) return NULL;
+  JRing* r = (JRing*)aligned_alloc(64, sizeof(JRing));
+  if (!r) return NULL;
+  memset(r, 0, sizeof(*r));
+  J->rings[J->nrings++] = r;
+  return r;
+}
+
+//Producer side, called from the forwarding thread that owns the ring
+void journal_put(void* ring, const JRec* rec)
+{
+  JRing* r = (JRing*)ring;
+  uint64_t h = r->head;
+  if (h - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= JRING_SZ) {
+    __atomic_store_n(&r->overflow, r->overflow + 1, __ATOMIC_RELAXED);
+    return;
+  }
+  r->rec[h & (JRING_SZ - 1)] = *rec;
+  __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+}
+
+//Copy whatever the rings hold into the file. Returns records moved
+static unsigned drain(Journal* J)
+{
+  unsigned moved = 0;
+  uint64_t lost = 0;
+  uint32_t cap = J->hdr->cap;
+  for (int i=0;i<J->nrings;i++) {
+    JRing* r = J->rings[i];
+    uint64_t t = r->tail, h = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    for (; t != h; t++, moved++) J->recs[J->written++ % cap] = r->rec[t & (JRING_SZ - 1)];
+    __atomic_store_n(&r->tail, t, __ATOMIC_RELEASE);
+    lost += __atomic_load_n(&r->overflow, __ATOMIC_RELAXED);
+  }
+  J->hdr->overflow = lost;
+  __atomic_store_n(&J->hdr->written, J->written, __ATOMIC_RELEASE);
+  return moved;
+}
+
+static void* writer(void* arg)
+{
+  Journal* J = (Journal*)arg;
+  struct timespec idle = { 0, 1000000 };
+  while (!J->stop)
+    if (drain(J) == 0) nanosleep(&idle, NULL);
+  drain(J);
+  return NULL;
+}
+
+int journal_start(void* journal, char* err, size_t errlen)
+{
+  Journal* J = (Journal*)journal;
+  int rc = pthread_create(&J->th, NULL, writer, J);
+  if (rc != 0) { snprintf(err, errlen, "journal thread: %s", strerror(rc)); return -1; }
+  J->started = true;
+  return 0;
+}
+
+//Stop the writer after a last drain, flush the file and print a summary
+void journal_close(void* journal)
+{
+  Journal* J = (Journal*)journal;
+  if (!J) return;
+  if (J->started) { J->stop = 1; pthread_join(J->th, NULL); }
+  else drain(J);
+  fprintf(stderr, "[journal] %s records=%llu overflow=%llu%s\n", J->path,
+          (unsigned long long)J->written, (unsigned long long)J->hdr->overflow,
+          J->written > J->hdr->cap ? " (wrapped, oldest overwritten)" : "");
+  msync(J->hdr, J->map_len, MS_SYNC);
+  munmap(J->hdr, J->map_len);
+  close(J->fd);
+  for (int i=0;i<J->nrings;i++) free(J->rings[i]);
+  free(J);
+}
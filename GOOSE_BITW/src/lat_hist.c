@@ -0,0 +1,105 @@
+/*
+Log-linear latency histograms for bitw_engine
+----------------------------------------------
+  - Each power of two is split into 16 linear buckets, so a value lands in
+    a bucket at most 1/16 (6.25%) wide, from 1 ns up to 2^37 ns (~137 s);
+    anything longer goes in the last bucket
+  - Recording is a count leading zeros, a shift and three adds: cheap
+    enough to leave on for every frame
+  - lathist_add() is for a histogram with a single writer, lathist_add_shared()
+    for one that several threads record into (relaxed atomics)
+  - Percentiles report the upper edge of the bucket, capped at the maximum
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Layout, must match shm_stats.c and bitw_manager.c
+#define LH_SUB_BITS 4
+#define LH_SUB      (1 << LH_SUB_BITS)
+#define LH_MAX_EXP  36
+#define LH_NB       ((LH_MAX_EXP - LH_SUB_BITS + 2) * LH_SUB)
+
+typedef struct {
+  uint64_t n, sum_ns, max_ns;
+  uint64_t pad[5];
+  uint64_t b[LH_NB];
+} LatHist;
+
+_Static_assert(sizeof(LatHist) % 64 == 0, "LatHist must be whole cache lines");
+
+static inline unsigned lh_index(uint64_t v)
+{
+  if (v < LH_SUB) return (unsigned)v;
+  unsigned e = 63u - (unsigned)__builtin_clzll(v);
+  if (e > LH_MAX_EXP) return LH_NB - 1;
+  return (e - LH_SUB_BITS + 1) * LH_SUB + (unsigned)((v >> (e - LH_SUB_BITS)) & (LH_SUB - 1));
+}
+
+//Largest value that falls in bucket i
+static uint64_t lh_upper(unsigned i)
+{
+  if (i < LH_SUB) return i;
+  unsigned e = i / LH_SUB + LH_SUB_BITS - 1, sub = i % LH_SUB;
+  return ((uint64_t)(LH_SUB + sub + 1) << (e - LH_SUB_BITS)) - 1;
+}
+
+size_t lathist_size(void) { return sizeof(LatHist); }
+
+//n zeroed histograms in one block, for when there is no shared segment
+void* lathist_new(int n)
+{
+  return calloc((size_t)(n > 0 ? n : 1), sizeof(LatHist));
+}
+
+void* lathist_at(void* base, int i) { return (LatHist*)base + i; }
+
+void lathist_copy(void* dst, const void* src) { memcpy(dst, src, sizeof(LatHist)); }
+
+void lathist_add(void* hist, uint64_t ns)
+{
+  LatHist* h = (LatHist*)hist;
+  h->b[lh_index(ns)]++;
+  h->n++;
+  h->sum_ns += ns;
+  if (ns > h->max_ns) h->max_ns = ns;
+}
+
+void lathist_add_shared(void* hist, uint64_t ns)
+{
+  LatHist* h = (LatHist*)hist;
+  __atomic_fetch_add(&h->b[lh_index(ns)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->n, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+  uint64_t m = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+  while (ns > m && !__atomic_compare_exchange_n(&h->max_ns, &m, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+//Value at quantile q (0..1) of what cur recorded since prev (NULL = all).
+//max caps the answer, since a bucket's upper edge can lie above it
+uint64_t lathist_pct(const void* cur, const void* prev, double q, uint64_t max)
+{
+  const LatHist* c = (const LatHist*)cur;
+  const LatHist* p = (const LatHist*)prev;
+  uint64_t n = c->n - (p ? p->n : 0);
+  if (!n) return 0;
+  uint64_t want = (uint64_t)(q * (double)n + 0.999999);
+  if (want < 1) want = 1;
+  uint64_t acc = 0;
+  for (unsigned i = 0; i < LH_NB; i++) {
+    acc += c->b[i] - (p ? p->b[i] : 0);
+    if (acc >= want) {
+      uint64_t v = lh_upper(i);
+      return v < max ? v : max;
+    }
+  }
+  return max;
+}
+
+uint64_t lathist_count(const void* hist) { return ((const LatHist*)hist)->n; }
+uint64_t lathist_max(const void* hist)   { return ((const LatHist*)hist)->max_ns; }
+uint64_t lathist_sum(const void* hist)   { return ((const LatHist*)hist)->sum_ns; }
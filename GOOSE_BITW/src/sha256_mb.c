@@ -0,0 +1,229 @@
+/*
+Multi-buffer SHA-256 compression for bitw_engine
+-------------------------------------------------
+  - Runs the block function over several independent messages at once, for
+    batches of short HMACs where one message alone leaves the core idle
+  - Kernels:
+      shani    one message after another on the SHA extensions. Those are
+               throughput-bound, so where the CPU has them this is the
+               fastest path (two messages in lockstep measured slower)
+      avx2     eight messages, one per 32-bit lane
+      sse2     four messages, one per 32-bit lane
+      scalar   the same rounds one message at a time, for CPUs with none
+               of the above; sha256_blocks() also builds the midstates
+  - The caller hands over padded whole blocks and the chaining state; the
+    padding, the HMAC midstates and the order of results are auth_hmac.c's
+  - No libcrypto here: its block function and SHA256_CTX layout are not
+    public API
+  - sha256_mb_use() forces a kernel (the self-test checks each one)
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define MB_X86 1
+#endif
+
+//One message, must match auth_hmac.c
+typedef struct {
+  uint32_t       h[8];    //chaining state, updated in place
+  const uint8_t* data;    //nblk whole 64-byte blocks
+  unsigned       nblk;
+} ShaJob;
+
+enum { K_SCALAR, K_SHANI, K_SSE2, K_AVX2, K_N };
+static const char* const k_names[K_N] = { "scalar", "shani", "sse2", "avx2" };
+
+static const uint32_t K256[64] = {
+  0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+  0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+  0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+  0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+  0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+  0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+  0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+  0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+static inline uint32_t ld_be32(const uint8_t* p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+//Lane-parallel kernels: the scalar rounds on GCC vector types, one message
+//per lane, all lanes one block at a time. Lanes whose message has ended
+//hash a dummy block; their state was taken out when they finished
+#define VROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define SHA256_LANES(NAME, VT, L, ATTR)                                              \
+typedef uint32_t VT __attribute__((vector_size(4 * L)));                             \
+ATTR static void NAME(ShaJob* j, int n)                                              \
+{                                                                                    \
+  static const uint8_t dummy[64];                                                    \
+  VT s[8];                                                                           \
+  unsigned most = 0;                                                                 \
+  for (int r=0;r<8;r++)                                                              \
+    for (int l=0;l<L;l++) s[r][l] = l < n ? j[l].h[r] : 0;                           \
+  for (int l=0;l<n;l++) if (j[l].nblk > most) most = j[l].nblk;                      \
+  for (unsigned blk=0; blk<most; blk++) {                                            \
+    const uint8_t* p[L];                                                             \
+    for (int l=0;l<L;l++)                                                            \
+      p[l] = (l < n && blk < j[l].nblk) ? j[l].data + 64*blk : dummy;                \
+    VT w[16];                                                                        \
+    for (int t=0;t<16;t++)                                                           \
+      for (int l=0;l<L;l++) w[t][l] = ld_be32(p[l] + 4*t);                           \
+    VT a=s[0], b=s[1], c=s[2], d=s[3], e=s[4], f=s[5], g=s[6], hh=s[7];              \
+    for (int t=0;t<64;t++) {                                                         \
+      VT wt;                                                                         \
+      if (t < 16) wt = w[t];                                                         \
+      else {                                                                         \
+        VT x = w[(t-15)&15], y = w[(t-2)&15];                                        \
+        VT s0 = VROR(x, 7) ^ VROR(x, 18) ^ (x >> 3);                                 \
+        VT s1 = VROR(y, 17) ^ VROR(y, 19) ^ (y >> 10);                               \
+        wt = w[t&15] = w[t&15] + s0 + w[(t-7)&15] + s1;                              \
+      }                                                                              \
+      VT t1 = hh + (VROR(e,6) ^ VROR(e,11) ^ VROR(e,25)) + ((e & f) ^ (~e & g))      \
+            + K256[t] + wt;                                                          \
+      VT t2 = (VROR(a,2) ^ VROR(a,13) ^ VROR(a,22)) + ((a & b) ^ (a & c) ^ (b & c)); \
+      hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;            \
+    }                                                                                \
+    s[0]+=a; s[1]+=b; s[2]+=c; s[3]+=d; s[4]+=e; s[5]+=f; s[6]+=g; s[7]+=hh;         \
+    for (int l=0;l<n;l++)                                                            \
+      if (j[l].nblk == blk + 1)                                                      \
+        for (int r=0;r<8;r++) j[l].h[r] = s[r][l];                                   \
+  }                                                                                  \
+}
+
+SHA256_LANES(sha256_x1_scalar, v1u32, 1, )
+
+#ifdef MB_X86
+SHA256_LANES(sha256_x4_sse2, v4u32, 4, __attribute__((target("sse2"))))
+SHA256_LANES(sha256_x8_avx2, v8u32, 8, __attribute__((target("avx2"))))
+
+//SHA extensions: the state lives as ABEF/CDGH, sha256rnds2 does two rounds
+//and msg1/msg2 extend the schedule four words at a time
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t h[8], const uint8_t* p, unsigned nblk)
+{
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+  __m128i t  = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[0]), 0xB1);  //CDAB
+  __m128i s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[4]), 0x1B);  //HGFE
+  __m128i s0 = _mm_alignr_epi8(t, s1, 8);                                         //ABEF
+  s1 = _mm_blend_epi16(s1, t, 0xF0);                                              //CDGH
+
+  for (; nblk; nblk--, p += 64) {
+    __m128i abef = s0, cdgh = s1, w[4];
+    for (int i=0;i<4;i++) w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16*i)), bswap);
+#pragma GCC unroll 16
+    for (int g=0; g<16; g++) {
+      if (g >= 4) {
+        __m128i x = _mm_sha256msg1_epu32(w[g&3], w[(g+1)&3]);
+        x = _mm_add_epi32(x, _mm_alignr_epi8(w[(g+3)&3], w[(g+2)&3], 4));
+        w[g&3] = _mm_sha256msg2_epu32(x, w[(g+3)&3]);
+      }
+      __m128i m = _mm_add_epi32(w[g&3], _mm_loadu_si128((const __m128i*)&K256[4*g]));
+      s1 = _mm_sha256rnds2_epu32(s1, s0, m);
+      s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(m, 0x0E));
+    }
+    s0 = _mm_add_epi32(s0, abef);
+    s1 = _mm_add_epi32(s1, cdgh);
+  }
+
+  t  = _mm_shuffle_epi32(s0, 0x1B);                                               //FEBA
+  s1 = _mm_shuffle_epi32(s1, 0xB1);                                               //DCHG
+  _mm_storeu_si128((__m128i*)&h[0], _mm_blend_epi16(t, s1, 0xF0));                //DCBA
+  _mm_storeu_si128((__m128i*)&h[4], _mm_alignr_epi8(s1, t, 8));                   //HGFE
+}
+#endif
+
+//One message, portable: builds the HMAC midstates once per stream
+void sha256_blocks(uint32_t h[8], const uint8_t* p, unsigned nblk)
+{
+  ShaJob j;
+  memcpy(j.h, h, sizeof(j.h));
+  j.data = p; j.nblk = nblk;
+  sha256_x1_scalar(&j, 1);
+  memcpy(h, j.h, sizeof(j.h));
+}
+
+static int k_sel = -1;   //-1 = pick the best on first use
+
+//SHA extensions are CPUID.7.0:EBX bit 29; their kernel also needs SSE4.1
+static bool k_avail(int k)
+{
+#ifdef MB_X86
+  if (k == K_AVX2) return __builtin_cpu_supports("avx2");
+  if (k == K_SHANI) {
+    unsigned a, b, c, d;
+    return __builtin_cpu_supports("sse4.1") &&
+           __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 29));
+  }
+  return k == K_SCALAR || k == K_SSE2;
+#else
+  return k == K_SCALAR;
+#endif
+}
+
+//SHA extensions beat any lane count
+static int k_best(void)
+{
+#ifdef MB_X86
+  if (k_avail(K_SHANI)) return K_SHANI;
+  return k_avail(K_AVX2) ? K_AVX2 : K_SSE2;
+#else
+  return K_SCALAR;
+#endif
+}
+
+//Force a kernel by name ("auto" = best available). 0 ok, -1 not here
+int sha256_mb_use(const char* name)
+{
+  if (strcmp(name, "auto") == 0) { k_sel = k_best(); return 0; }
+  for (int k=0;k<K_N;k++)
+    if (strcmp(name, k_names[k]) == 0) {
+      if (!k_avail(k)) return -1;
+      k_sel = k;
+      return 0;
+    }
+  return -1;
+}
+
+const char* sha256_mb_name(void)
+{
+  if (k_sel < 0) k_sel = k_best();
+  return k_names[k_sel];
+}
+
+//Messages at once for the selected kernel, for callers sizing a batch
+int sha256_mb_lanes(void)
+{
+  static const int lanes[K_N] = { 1, 1, 4, 8 };
+  if (k_sel < 0) k_sel = k_best();
+  return lanes[k_sel];
+}
+
+//Runs every job's blocks; each h[] ends up as if hashed on its own
+void sha256_mb(ShaJob* j, int n)
+{
+  if (k_sel < 0) k_sel = k_best();
+  switch (k_sel) {
+#ifdef MB_X86
+  case K_AVX2:
+    for (int i=0;i<n;i+=8) sha256_x8_avx2(j + i, n - i < 8 ? n - i : 8);
+    return;
+  case K_SSE2:
+    for (int i=0;i<n;i+=4) sha256_x4_sse2(j + i, n - i < 4 ? n - i : 4);
+    return;
+  case K_SHANI:
+    for (int i=0;i<n;i++) sha256_blocks_shani(j[i].h, j[i].data, j[i].nblk);
+    return;
+#endif
+  default:
+    for (int i=0;i<n;i++) sha256_x1_scalar(j + i, 1);
+  }
+}
@@ -0,0 +1,234 @@
+/*
+Live statistics segment for bitw_engine
+----------------------------------------
+  - /dev/shm/bitw_stats_<pid>, read by bitw_manager's live monitor
+  - Header, then one slot per forwarding thread, then per thread a row of
+    one slot per stream (ndirs x nstrms); readers sum a stream's rows
+  - Every slot is a seqlock: the sequence is odd while a writer is inside,
+    so a reader copies the slot and retries if the sequence moved.
+    Readers never write, so watching costs the engine nothing
+  - Every slot has one writer, the thread that owns it, so writers just
+    step the sequence: no lock and no cache line shared between workers.
+    Thread slots are published once per RX drain from the thread's own
+    counters, stream slots on each frame
+  - Residence-time histograms (lat_hist.c) follow the slots: one per thread,
+    then one per stream. They are plain counters, never torn in a way that
+    matters, so readers just copy them
+  - The layout is versioned; bump SHM_VERSION on any change
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+//Layout, must match bitw_manager.c
+#define SHM_MAGIC   0x57544942u   //"BITW"
+#define SHM_VERSION 3
+
+typedef struct {
+  uint32_t magic, version;
+  uint32_t hdr_size, dir_size, strm_size;
+  uint32_t ndirs, nstrms;           //stream slots: ndirs rows of nstrms
+  uint32_t pid;
+  uint64_t start_ns;
+  char     mode[16];
+  char     io[16];
+  uint32_t hist_size;               //bytes per histogram, after the stream slots
+  uint32_t pad0;
+  uint8_t  pad[48];
+} ShmHeader;
+
+typedef struct {
+  uint32_t seq, pad;
+  char     name[16];
+  uint64_t rx, fwd, drop;
+  uint64_t stripped, ptp, other;    //other = bridged non-GOOSE (passOther)
+  uint64_t bytes_rx, bytes_fwd;
+  uint64_t rej[4];                  //unknown, malformed, replay, mac
+  uint64_t updated_ns;
+} ShmDir;
+
+typedef struct {
+  uint32_t seq;
+  uint16_t appId, pad;
+  char     name[40];
+  uint64_t rx, fwd, drop, stripped, bytes;
+  uint64_t rej[3];                  //malformed, replay, mac
+  uint32_t last_st, last_sq;        //last verified frame
+  uint64_t last_ns;
+} ShmStrm;
+
+_Static_assert(sizeof(ShmHeader) == 128, "ShmHeader must stay 128 bytes");
+_Static_assert(sizeof(ShmDir) == 128, "ShmDir must stay 128 bytes");
+_Static_assert(sizeof(ShmStrm) == 128, "ShmStrm must stay 128 bytes");
+
+//What the engine hands over per thread, must match bitw_engine.c
+typedef struct {
+  uint64_t rx, fwd, drop;
+  uint64_t stripped, ptp, other;
+  uint64_t bytes_rx, bytes_fwd;
+  uint64_t rej[4];
+} ShmDirCounters;
+
+typedef struct {
+  uint8_t*  map;
+  size_t    len;
+  ShmDir*   dirs;
+  ShmStrm*  strms;                  //row of thread t at strms + t*nstrms
+  uint8_t*  hists;                  //ndirs thread histograms, then nstrms stream ones
+  int       ndirs, nstrms;
+  char      path[64];
+} ShmStats;
+
+extern size_t lathist_size(void);
+
+static uint64_t snow_ns(void)
+{
+  struct timespec ts; clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void* shmstats_open(int ndirs, int nstrms, const char* mode, const char* io, char* err, size_t errlen)
+{
+  ShmStats* S = (ShmStats*)calloc(1, sizeof(*S));
+  if (!S) { snprintf(err, errlen, "out of memory"); return NULL; }
+  snprintf(S->path, sizeof(S->path), "/dev/shm/bitw_stats_%d", (int)getpid());
+  size_t slots = sizeof(ShmHeader) + (size_t)ndirs * sizeof(ShmDir) +
+                 (size_t)ndirs * nstrms * sizeof(ShmStrm);
+  S->len = slots + (size_t)(ndirs + nstrms) * lathist_size();
+  int fd = open(S->path, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+  void* m = MAP_FAILED;
+  if (fd >= 0 && ftruncate(fd, (off_t)S->len) == 0)
+    m = mmap(NULL, S->len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) {
+    snprintf(err, errlen, "%s: %s", S->path, strerror(errno));
+    if (fd >= 0) { close(fd); unlink(S->path); }
+    free(S);
+    return NULL;
+  }
+  close(fd);
+  S->map = (uint8_t*)m;
+  S->dirs = (ShmDir*)(S->map + sizeof(ShmHeader));
+  S->strms = (ShmStrm*)(S->map + sizeof(ShmHeader) + (size_t)ndirs * sizeof(ShmDir));
+  S->hists = S->map + slots;
+  S->ndirs = ndirs; S->nstrms = nstrms;
+
+  ShmHeader* h = (ShmHeader*)S->map;
+  h->version = SHM_VERSION;
+  h->hdr_size = sizeof(ShmHeader); h->dir_size = sizeof(ShmDir); h->strm_size = sizeof(ShmStrm);
+  h->ndirs = (uint32_t)ndirs; h->nstrms = (uint32_t)nstrms;
+  h->hist_size = (uint32_t)lathist_size();
+  h->pid = (uint32_t)getpid();
+  h->start_ns = snow_ns();
+  snprintf(h->mode, sizeof(h->mode), "%s", mode);
+  snprintf(h->io, sizeof(h->io), "%s", io);
+  //Magic last: a reader that sees it sees a complete header
+  __atomic_store_n(&h->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  return S;
+}
+
+//Slot for one forwarding thread
+void* shmstats_dir(void* stats, int idx, const char* name)
+{
+  ShmStats* S = (ShmStats*)stats;
+  if (!S || idx < 0 || idx >= S->ndirs) return NULL;
+  snprintf(S->dirs[idx].name, sizeof(S->dirs[idx].name), "%s", name);
+  return &S->dirs[idx];
+}
+
+//Stream slots of thread idx, for shmstats_stream_frame()
+void* shmstats_dir_streams(void* stats, int idx)
+{
+  ShmStats* S = (ShmStats*)stats;
+  if (!S || idx < 0 || idx >= S->ndirs) return NULL;
+  return S->strms + (size_t)idx * S->nstrms;
+}
+
+//Residence-time histogram of thread idx
+void* shmstats_dir_hist(void* stats, int idx)
+{
+  ShmStats* S = (ShmStats*)stats;
+  if (!S || idx < 0 || idx >= S->ndirs) return NULL;
+  return S->hists + (size_t)idx * lathist_size();
+}
+
+//The nstrms stream histograms, contiguous like lathist_new(nstrms)
+void* shmstats_stream_hists(void* stats)
+{
+  ShmStats* S = (ShmStats*)stats;
+  if (!S) return NULL;
+  return S->hists + (size_t)S->ndirs * lathist_size();
+}
+
+//Names stream idx in every thread's row
+void shmstats_stream_init(void* stats, int idx, const char* name, uint16_t appId)
+{
+  ShmStats* S = (ShmStats*)stats;
+  if (!S || idx < 0 || idx >= S->nstrms) return;
+  for (int t=0;t<S->ndirs;t++) {
+    ShmStrm* m = &S->strms[(size_t)t * S->nstrms + idx];
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    m->appId = appId;
+  }
+}
+
+//Mode shown in the header, after a reload switched it
+void shmstats_mode(void* stats, const char* mode)
+{
+  ShmStats* S = (ShmStats*)stats;
+  if (!S) return;
+  ShmHeader* h = (ShmHeader*)S->map;
+  snprintf(h->mode, sizeof(h->mode), "%s", mode);
+}
+
+//Single writer: the thread that owns the slot
+void shmstats_dir_publish(void* slot, const ShmDirCounters* c)
+{
+  ShmDir* d = (ShmDir*)slot;
+  uint32_t s = d->seq;
+  __atomic_store_n(&d->seq, s + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  d->rx = c->rx; d->fwd = c->fwd; d->drop = c->drop;
+  d->stripped = c->stripped; d->ptp = c->ptp; d->other = c->other;
+  d->bytes_rx = c->bytes_rx; d->bytes_fwd = c->bytes_fwd;
+  memcpy(d->rej, c->rej, sizeof(d->rej));
+  d->updated_ns = snow_ns();
+  __atomic_store_n(&d->seq, s + 2, __ATOMIC_RELEASE);
+}
+
+//One frame of stream idx, in the calling thread's row (shmstats_dir_streams).
+//rej: 0 none, else 1 malformed, 2 replay, 3 mac. Single writer, like the
+//thread slots
+void shmstats_stream_frame(void* row, int idx, uint32_t len, int rej, bool fwd, bool stripped,
+                           uint32_t st, uint32_t sq, uint64_t ts_ns)
+{
+  ShmStrm* m = (ShmStrm*)row + idx;
+  uint32_t s = m->seq;
+  __atomic_store_n(&m->seq, s + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  m->rx++;
+  m->bytes += len;
+  if (fwd) m->fwd++; else m->drop++;
+  if (stripped) m->stripped++;
+  if (rej) m->rej[rej - 1]++;
+  else { m->last_st = st; m->last_sq = sq; m->last_ns = ts_ns; }
+  __atomic_store_n(&m->seq, s + 2, __ATOMIC_RELEASE);
+}
+
+//Unmap and remove the segment
+void shmstats_close(void* stats)
+{
+  ShmStats* S = (ShmStats*)stats;
+  if (!S) return;
+  munmap(S->map, S->len);
+  unlink(S->path);
+  free(S);
+}
@@ -0,0 +1,43 @@
+/*
+Verdict -> action for bitw_engine
+----------------------------------
+  - What happens to a frame once the verifier is done with it: forwarded,
+    forwarded with the tag stripped, or dropped
+  - load_policy() compiles a table per stream (and one for frames that
+    match no stream) from mode and stripTag; per frame it is one lookup
+  - Also maps a verdict to its journal code and the reject stage it is
+    counted under
+  - Its own TU so bench_decide measures the code the engine runs
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//Must match bitw_engine.c and bitw_policy_loader.c
+enum { V_OK, V_UNKNOWN, V_MALFORMED, V_BADTAG, V_REPLAY, V_MAC, V_N };
+enum { ACT_DROP, ACT_FWD, ACT_STRIP };
+enum { REJ_UNKNOWN, REJ_MALFORMED, REJ_REPLAY, REJ_MAC, REJ_N };
+
+//Journal/report code of a verdict: 0 ok, 10 malformed, 11 unknown,
+//12 bad tag, 13 mac, 20 + freshness code for a replay
+static const int8_t ver_code[V_N] = { 0, 11, 10, 12, 20, 13 };
+
+//Reject stage a verdict is counted under, -1 = not rejected
+static const int8_t ver_rej[V_N] = { -1, REJ_UNKNOWN, REJ_MALFORMED, REJ_MALFORMED, REJ_REPLAY, REJ_MAC };
+
+//Enforce forwards only verified frames, monitor forwards everything;
+//stripTag decides how a forwarded frame leaves
+void verdict_actions(uint8_t act[V_N], bool enforce, bool stripTag)
+{
+  for (int v=0; v<V_N; v++)
+    act[v] = (enforce && v != V_OK) ? ACT_DROP : stripTag ? ACT_STRIP : ACT_FWD;
+}
+
+//Action for verdict v from a compiled table. fr is the freshness code of
+//a replay. Sets the journal code and the reject stage (-1 = none)
+int verdict_decide(const uint8_t act[V_N], int v, int fr, int* ver, int* rej)
+{
+  *ver = ver_code[v] + (v == V_REPLAY ? fr : 0);
+  *rej = ver_rej[v];
+  return act[v];
+}
@@ -0,0 +1,320 @@
+/*
+XDP early-drop guard for bitw_engine
+-------------------------------------
+  - Runs on each bridge port before the kernel allocates an skb
+  - Ethertype allowlist: PTP and GOOSE (plain or 802.1Q), anything else
+    only with passOther
+  - GOOSE appId must be in the policy and within its packet budget: a
+    token bucket per appId per CPU, so no locks and no atomics
+  - Per-reason counters in a per-CPU array map, summed by the engine
+  - Accepted frames go up the stack (XDP_PASS) or, with io "xdp", straight
+    to the AF_XDP socket through the caller's XSKMAP
+  - In monitor mode unknown and over-budget GOOSE is counted, not dropped
+  - Hand-assembled, loaded through bpf_sys.c (no libbpf, no clang)
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+
+//From bpf_sys.c
+extern int bpf_map_create_simple(uint32_t type, uint32_t key_size, uint32_t value_size,
+                                 uint32_t max_entries, const char* name);
+extern int bpf_map_update(int fd, const void* key, const void* value);
+extern int bpf_map_lookup(int fd, const void* key, void* value);
+extern int bpf_xdp_prog_load(const struct bpf_insn* insns, size_t n, const char* name,
+                             char* err, size_t errlen);
+extern int bpf_xdp_attach(int prog_fd, int ifindex, bool* generic, char* err, size_t errlen);
+extern int bpf_num_possible_cpus(void);
+
+//Counter slots in the stats map
+enum { XG_PASS, XG_ETHERTYPE, XG_SHORT, XG_UNKNOWN, XG_RATE, XG_N };
+static const char* const xg_names[XG_N] = { "pass", "ethertype", "short", "unknown", "rate" };
+
+//Budget map value, one copy per CPU. Credit is kept in nanoseconds so
+//the program needs no division: a frame costs cost_ns, time adds credit
+typedef struct {
+  uint64_t cost_ns;     //1e9 / rate, 0 = no budget
+  uint64_t cap_ns;      //burst * cost_ns
+  uint64_t tokens_ns;
+  uint64_t last_ns;
+} Bucket;
+
+#define XG_MAX_LINKS 8
+
+typedef struct {
+  bool     enforce;
+  bool     pass_other;
+  int      budget_fd;   //PERCPU_HASH appId -> Bucket
+  int      stats_fd;    //PERCPU_ARRAY reason -> u64
+  int      ncpu;
+  int      nlinks;
+  int      link_fd[XG_MAX_LINKS];
+  int      prog_fd[XG_MAX_LINKS];
+  char     ifname[XG_MAX_LINKS][IFNAMSIZ];
+  bool     generic[XG_MAX_LINKS];
+} XGuard;
+
+void* xguard_new(int max_appids, bool enforce, bool pass_other, char* err, size_t errlen)
+{
+  XGuard* g = (XGuard*)calloc(1, sizeof(*g));
+  if (!g) { snprintf(err, errlen, "out of memory"); return NULL; }
+  g->enforce = enforce;
+  g->pass_other = pass_other;
+  g->ncpu = bpf_num_possible_cpus();
+  g->budget_fd = bpf_map_create_simple(BPF_MAP_TYPE_PERCPU_HASH, 4, sizeof(Bucket),
+                                       (uint32_t)(max_appids > 0 ? max_appids : 1), "bitw_guard_bud");
+  g->stats_fd  = bpf_map_create_simple(BPF_MAP_TYPE_PERCPU_ARRAY, 4, 8, XG_N, "bitw_guard_st");
+  if (g->budget_fd < 0 || g->stats_fd < 0) {
+    snprintf(err, errlen, "guard maps: %s", strerror(errno));
+    if (g->budget_fd >= 0) close(g->budget_fd);
+    if (g->stats_fd >= 0) close(g->stats_fd);
+    free(g);
+    return NULL;
+  }
+  return g;
+}
+
+//Let appId through, at most rate_pps frames/s per CPU with bursts of
+//`burst` (rate 0 = no budget)
+int xguard_allow(void* guard, uint16_t appId, uint32_t rate_pps, uint32_t burst,
+                 char* err, size_t errlen)
+{
+  XGuard* g = (XGuard*)guard;
+  Bucket b;
+  memset(&b, 0, sizeof(b));
+  if (rate_pps) {
+    if (burst < 1) burst = 1;
+    b.cost_ns = 1000000000ull / rate_pps;
+    if (!b.cost_ns) b.cost_ns = 1;
+    b.cap_ns = (uint64_t)burst * b.cost_ns;
+    b.tokens_ns = b.cap_ns;
+  }
+  Bucket* v = (Bucket*)calloc((size_t)g->ncpu, sizeof(Bucket));
+  if (!v) { snprintf(err, errlen, "out of memory"); return -1; }
+  for (int i=0;i<g->ncpu;i++) v[i] = b;
+  uint32_t k = appId;
+  int rc = bpf_map_update(g->budget_fd, &k, v);
+  free(v);
+  if (rc < 0) { snprintf(err, errlen, "guard appId %u: %s", (unsigned)appId, strerror(errno)); return -1; }
+  return 0;
+}
+
+//Tiny assembler: forward jumps go to labels patched at the end
+enum { L_SHORT, L_TYPE, L_GOOSE, L_UNKNOWN, L_RATE, L_PASS, L_COUNT, L_ACCEPT, L_N };
+
+typedef struct {
+  struct bpf_insn i[96];
+  int n;
+  int label[L_N];
+  int fix_at[32], fix_to[32], nfix;
+} Asm;
+
+static void emit(Asm* a, uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+  struct bpf_insn* x = &a->i[a->n++];
+  memset(x, 0, sizeof(*x));
+  x->code = code; x->dst_reg = dst; x->src_reg = src; x->off = off; x->imm = imm;
+}
+static void jump(Asm* a, uint8_t code, uint8_t dst, uint8_t src, int32_t imm, int label)
+{
+  a->fix_at[a->nfix] = a->n; a->fix_to[a->nfix++] = label;
+  emit(a, code, dst, src, 0, imm);
+}
+static void mark(Asm* a, int label) { a->label[label] = a->n; }
+static void ld_map(Asm* a, uint8_t dst, int fd)
+{
+  emit(a, BPF_LD|BPF_DW|BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+  emit(a, 0, 0, 0, 0, 0);
+}
+
+#define R0 BPF_REG_0
+#define R1 BPF_REG_1
+#define R2 BPF_REG_2
+#define R3 BPF_REG_3
+#define R4 BPF_REG_4
+#define R5 BPF_REG_5
+#define R6 BPF_REG_6
+#define R7 BPF_REG_7
+#define R8 BPF_REG_8
+#define R9 BPF_REG_9
+#define FP BPF_REG_10
+
+//r6 = ctx, r7 = counter slot, r8 = bucket then verdict (1 accept), r9 = VLAN
+static int assemble(const XGuard* g, int xsk_map_fd, Asm* a)
+{
+  memset(a, 0, sizeof(*a));
+  emit(a, BPF_ALU64|BPF_MOV|BPF_X, R6, R1, 0, 0);
+  emit(a, BPF_LDX|BPF_MEM|BPF_W, R2, R6, (int16_t)offsetof(struct xdp_md, data), 0);
+  emit(a, BPF_LDX|BPF_MEM|BPF_W, R3, R6, (int16_t)offsetof(struct xdp_md, data_end), 0);
+  //Ethernet + 802.1Q + APPID all fit in 20 bytes; real frames are >= 60
+  emit(a, BPF_ALU64|BPF_MOV|BPF_X, R4, R2, 0, 0);
+  emit(a, BPF_ALU64|BPF_ADD|BPF_K, R4, 0, 0, 20);
+  jump(a, BPF_JMP|BPF_JGT|BPF_X, R4, R3, 0, L_SHORT);
+
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R9, 0, 0, 0);
+  emit(a, BPF_LDX|BPF_MEM|BPF_H, R5, R2, 12, 0);
+  emit(a, BPF_ALU|BPF_END|BPF_TO_BE, R5, 0, 0, 16);
+  jump(a, BPF_JMP|BPF_JNE|BPF_K, R5, 0, 0x8100, L_TYPE);
+  emit(a, BPF_LDX|BPF_MEM|BPF_H, R5, R2, 16, 0);
+  emit(a, BPF_ALU|BPF_END|BPF_TO_BE, R5, 0, 0, 16);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R9, 0, 0, 1);
+  mark(a, L_TYPE);
+  jump(a, BPF_JMP|BPF_JEQ|BPF_K, R5, 0, 0x88f7, L_PASS);
+  jump(a, BPF_JMP|BPF_JEQ|BPF_K, R5, 0, 0x88b8, L_GOOSE);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R7, 0, 0, g->pass_other ? XG_PASS : XG_ETHERTYPE);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R8, 0, 0, g->pass_other ? 1 : 0);
+  jump(a, BPF_JMP|BPF_JA, 0, 0, 0, L_COUNT);
+
+  //appId -> this CPU's bucket
+  mark(a, L_GOOSE);
+  emit(a, BPF_LDX|BPF_MEM|BPF_H, R5, R2, 14, 0);
+  emit(a, BPF_JMP|BPF_JEQ|BPF_K, R9, 0, 1, 0);
+  emit(a, BPF_LDX|BPF_MEM|BPF_H, R5, R2, 18, 0);
+  emit(a, BPF_ALU|BPF_END|BPF_TO_BE, R5, 0, 0, 16);
+  emit(a, BPF_STX|BPF_MEM|BPF_W, FP, R5, -4, 0);
+  ld_map(a, R1, g->budget_fd);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_X, R2, FP, 0, 0);
+  emit(a, BPF_ALU64|BPF_ADD|BPF_K, R2, 0, 0, -4);
+  emit(a, BPF_JMP|BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+  jump(a, BPF_JMP|BPF_JEQ|BPF_K, R0, 0, 0, L_UNKNOWN);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_X, R8, R0, 0, 0);
+  emit(a, BPF_LDX|BPF_MEM|BPF_DW, R1, R8, (int16_t)offsetof(Bucket, cost_ns), 0);
+  jump(a, BPF_JMP|BPF_JEQ|BPF_K, R1, 0, 0, L_PASS);
+
+  //credit = min(credit + (now - last), cap); spend cost_ns if there is enough
+  emit(a, BPF_JMP|BPF_CALL, 0, 0, 0, BPF_FUNC_ktime_get_ns);
+  emit(a, BPF_LDX|BPF_MEM|BPF_DW, R2, R8, (int16_t)offsetof(Bucket, last_ns), 0);
+  emit(a, BPF_STX|BPF_MEM|BPF_DW, R8, R0, (int16_t)offsetof(Bucket, last_ns), 0);
+  emit(a, BPF_ALU64|BPF_SUB|BPF_X, R0, R2, 0, 0);
+  emit(a, BPF_LDX|BPF_MEM|BPF_DW, R3, R8, (int16_t)offsetof(Bucket, tokens_ns), 0);
+  emit(a, BPF_ALU64|BPF_ADD|BPF_X, R3, R0, 0, 0);
+  emit(a, BPF_LDX|BPF_MEM|BPF_DW, R4, R8, (int16_t)offsetof(Bucket, cap_ns), 0);
+  emit(a, BPF_JMP|BPF_JGE|BPF_X, R4, R3, 1, 0);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_X, R3, R4, 0, 0);
+  emit(a, BPF_LDX|BPF_MEM|BPF_DW, R1, R8, (int16_t)offsetof(Bucket, cost_ns), 0);
+  jump(a, BPF_JMP|BPF_JGT|BPF_X, R1, R3, 0, L_RATE);
+  emit(a, BPF_ALU64|BPF_SUB|BPF_X, R3, R1, 0, 0);
+  emit(a, BPF_STX|BPF_MEM|BPF_DW, R8, R3, (int16_t)offsetof(Bucket, tokens_ns), 0);
+  jump(a, BPF_JMP|BPF_JA, 0, 0, 0, L_PASS);
+
+  mark(a, L_RATE);
+  emit(a, BPF_STX|BPF_MEM|BPF_DW, R8, R3, (int16_t)offsetof(Bucket, tokens_ns), 0);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R7, 0, 0, XG_RATE);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R8, 0, 0, g->enforce ? 0 : 1);
+  jump(a, BPF_JMP|BPF_JA, 0, 0, 0, L_COUNT);
+  mark(a, L_UNKNOWN);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R7, 0, 0, XG_UNKNOWN);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R8, 0, 0, g->enforce ? 0 : 1);
+  jump(a, BPF_JMP|BPF_JA, 0, 0, 0, L_COUNT);
+  mark(a, L_SHORT);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R7, 0, 0, XG_SHORT);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R8, 0, 0, 0);
+  jump(a, BPF_JMP|BPF_JA, 0, 0, 0, L_COUNT);
+  mark(a, L_PASS);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R7, 0, 0, XG_PASS);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R8, 0, 0, 1);
+
+  //stats[r7]++ (this CPU's slot, so a plain add)
+  mark(a, L_COUNT);
+  emit(a, BPF_STX|BPF_MEM|BPF_W, FP, R7, -8, 0);
+  ld_map(a, R1, g->stats_fd);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_X, R2, FP, 0, 0);
+  emit(a, BPF_ALU64|BPF_ADD|BPF_K, R2, 0, 0, -8);
+  emit(a, BPF_JMP|BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+  emit(a, BPF_JMP|BPF_JEQ|BPF_K, R0, 0, 3, 0);
+  emit(a, BPF_LDX|BPF_MEM|BPF_DW, R1, R0, 0, 0);
+  emit(a, BPF_ALU64|BPF_ADD|BPF_K, R1, 0, 0, 1);
+  emit(a, BPF_STX|BPF_MEM|BPF_DW, R0, R1, 0, 0);
+  jump(a, BPF_JMP|BPF_JNE|BPF_K, R8, 0, 0, L_ACCEPT);
+  emit(a, BPF_ALU64|BPF_MOV|BPF_K, R0, 0, 0, XDP_DROP);
+  emit(a, BPF_JMP|BPF_EXIT, 0, 0, 0, 0);
+
+  mark(a, L_ACCEPT);
+  if (xsk_map_fd >= 0) {
+    //Same tail as io_xdp.c's redirect program
+    emit(a, BPF_LDX|BPF_MEM|BPF_W, R2, R6, (int16_t)offsetof(struct xdp_md, rx_queue_index), 0);
+    ld_map(a, R1, xsk_map_fd);
+    emit(a, BPF_ALU64|BPF_MOV|BPF_K, R3, 0, 0, XDP_PASS);
+    emit(a, BPF_JMP|BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+  } else {
+    emit(a, BPF_ALU64|BPF_MOV|BPF_K, R0, 0, 0, XDP_PASS);
+  }
+  emit(a, BPF_JMP|BPF_EXIT, 0, 0, 0, 0);
+
+  for (int k=0;k<a->nfix;k++)
+    a->i[a->fix_at[k]].off = (int16_t)(a->label[a->fix_to[k]] - a->fix_at[k] - 1);
+  return a->n;
+}
+
+//Guard program ending in a redirect to xsk_map_fd, or in XDP_PASS when it
+//is -1. The caller owns the returned fd
+int xguard_prog_load(void* guard, int xsk_map_fd, char* err, size_t errlen)
+{
+  Asm a;
+  int n = assemble((const XGuard*)guard, xsk_map_fd, &a);
+  return bpf_xdp_prog_load(a.i, (size_t)n, "bitw_guard", err, errlen);
+}
+
+//Run the guard on ifname in front of the normal stack. generic skips the
+//native attempt (veth test setups)
+int xguard_attach(void* guard, const char* ifname, bool generic, char* err, size_t errlen)
+{
+  XGuard* g = (XGuard*)guard;
+  if (g->nlinks == XG_MAX_LINKS) { snprintf(err, errlen, "too many guard links"); return -1; }
+  int ifindex = (int)if_nametoindex(ifname);
+  if (!ifindex) { snprintf(err, errlen, "%s: no such interface", ifname); return -1; }
+  int pfd = xguard_prog_load(g, -1, err, errlen);
+  if (pfd < 0) return -1;
+  int k = g->nlinks;
+  g->generic[k] = generic;
+  int lfd = bpf_xdp_attach(pfd, ifindex, &g->generic[k], err, errlen);
+  if (lfd < 0) { close(pfd); return -1; }
+  g->prog_fd[k] = pfd; g->link_fd[k] = lfd;
+  snprintf(g->ifname[k], IFNAMSIZ, "%s", ifname);
+  g->nlinks++;
+  fprintf(stderr, "[xguard] %s: %s XDP\n", ifname, g->generic[k] ? "generic" : "native");
+  return 0;
+}
+
+//Sum of one counter over all CPUs
+static uint64_t stat_sum(const XGuard* g, uint32_t slot)
+{
+  uint64_t* v = (uint64_t*)calloc((size_t)g->ncpu, sizeof(uint64_t));
+  uint64_t s = 0;
+  if (v && bpf_map_lookup(g->stats_fd, &slot, v) == 0)
+    for (int i=0;i<g->ncpu;i++) s += v[i];
+  free(v);
+  return s;
+}
+
+void xguard_report(void* guard)
+{
+  XGuard* g = (XGuard*)guard;
+  if (!g) return;
+  uint64_t c[XG_N];
+  for (int i=0;i<XG_N;i++) c[i] = stat_sum(g, (uint32_t)i);
+  fprintf(stderr, "[xguard] %s=%llu %s=%llu %s=%llu %s=%llu %s=%llu%s\n",
+          xg_names[0], (unsigned long long)c[0], xg_names[1], (unsigned long long)c[1],
+          xg_names[2], (unsigned long long)c[2], xg_names[3], (unsigned long long)c[3],
+          xg_names[4], (unsigned long long)c[4],
+          g->enforce ? "" : " (monitor: unknown/rate counted, not dropped)");
+}
+
+void xguard_free(void* guard)
+{
+  XGuard* g = (XGuard*)guard;
+  if (!g) return;
+  for (int k=0;k<g->nlinks;k++) { close(g->link_fd[k]); close(g->prog_fd[k]); }
+  close(g->budget_fd);
+  close(g->stats_fd);
+  free(g);
+}
@@ -0,0 +1,258 @@
+/*
+BENCHMARK (not shipped)
+------------------------
+  - ns, TSC cycles and heap allocations per call of the publisher's
+    canonicalization and crypto primitives, for datasets of 2, 8 and 32
+    entries (booleans and integers alternating). VLAN and tag length only
+    change the frame libiec61850 builds, which none of these touch
+  - Each row is the median of 5 runs, each run long enough for ~10 ms
+  - Allocations are counted by wrapping malloc/calloc/realloc (glibc), so
+    ones made inside libcrypto show up too
+  - -o FILE writes the rows as CSV (same columns as GOOSE_BITW's
+    bench_codec), -b FILE prints the change against an earlier CSV
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//Must match auth_canon.c's PublicationConfigMini
+typedef struct {
+    char  name[64];
+    char  type[16];
+    char  quality[16];
+    bool  bool_val;
+    int   int_val;
+} DataFieldMini;
+
+typedef struct {
+    uint16_t appId;
+    char     gocbRef[128];
+    char     datSet[128];
+    char     goID[128];
+    unsigned char dstMac[6];
+    int      vlanId;
+    int      vlanPriority;
+    int      timeAllowedToLive;
+    int      confRev;
+    bool     ndsCom;
+    bool     test;
+    int      heartbeat_ms;
+    int      dataset_count;
+    DataFieldMini dataset[32];
+} PublicationConfigMini;
+
+void hkdf_sha256_extract(const uint8_t *salt, size_t salt_len,
+                         const uint8_t *ikm, size_t ikm_len,
+                         uint8_t *prk, size_t prk_len);
+void hkdf_sha256_expand(const uint8_t *prk, size_t prk_len,
+                        const uint8_t *info, size_t info_len,
+                        uint8_t *okm, size_t okm_len);
+void hmac_sha256(const uint8_t *key, size_t key_len,
+                 const uint8_t *data, size_t data_len,
+                 uint8_t *out32);
+size_t auth_build_canonical_blob(uint8_t *buf, size_t buf_max,
+                                 const char* goID, const char* gocbRef, uint16_t appId,
+                                 uint32_t stNum, uint32_t sqNum,
+                                 const void* dataset_bytes, size_t dataset_len);
+size_t auth_dataset_bytes_from_cfg(uint8_t *buf, size_t buf_max, const void* cfg);
+
+#define RUNS     5
+#define RUN_NS   10000000ULL
+#define MAX_ROWS 32
+
+static const char* INFO = "GOOSE|IEDA/LLN0$GO$healthA|IEDA/LLN0$GO$healthA|1000";
+
+static const int ds_sizes[] = { 2, 8, 32 };
+
+//Heap calls made by anything in the process, libcrypto included
+static unsigned long n_alloc;
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t n);
+extern void* __libc_calloc(size_t k, size_t n);
+extern void* __libc_realloc(void* p, size_t n);
+void* malloc(size_t n){ n_alloc++; return __libc_malloc(n); }
+void* calloc(size_t k, size_t n){ n_alloc++; return __libc_calloc(k, n); }
+void* realloc(void* p, size_t n){ n_alloc++; return __libc_realloc(p, n); }
+#define ALLOCS_COUNTED 1
+#else
+#define ALLOCS_COUNTED 0
+#endif
+
+typedef struct {
+    char   func[40];
+    char   variant[32];
+    double ns, cyc, allocs;
+    unsigned long ops;
+} Row;
+
+static PublicationConfigMini cfg;
+static uint8_t ds[256], blob[512];
+static size_t  ds_len, blob_len;
+static uint8_t k_device[32], prk[32], okm[32];
+static Row     rows[MAX_ROWS];
+static int     nrows;
+static volatile unsigned sink;
+
+static inline uint64_t ticks(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+static inline uint64_t now_ns(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//healthA identity with n dataset entries
+static void set_dataset(int n){
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.appId = 1000;
+    snprintf(cfg.goID, sizeof(cfg.goID), "IEDA/LLN0$GO$healthA");
+    snprintf(cfg.gocbRef, sizeof(cfg.gocbRef), "IEDA/LLN0$GO$healthA");
+    cfg.dataset_count = n;
+    for (int i=0;i<n;i++) {
+        DataFieldMini* df = &cfg.dataset[i];
+        if (i % 2 == 0) { snprintf(df->type, sizeof(df->type), "boolean"); df->bool_val = (i % 4 == 0); }
+        else            { snprintf(df->type, sizeof(df->type), "integer"); df->int_val  = 25 << (i % 24); }
+    }
+    ds_len = auth_dataset_bytes_from_cfg(ds, sizeof(ds), &cfg);
+    blob_len = auth_build_canonical_blob(blob, sizeof(blob), cfg.goID, cfg.gocbRef, cfg.appId,
+                                         1, 42, ds, ds_len);
+}
+
+static void do_dataset(void){
+    uint8_t b[256];
+    sink += (unsigned)auth_dataset_bytes_from_cfg(b, sizeof(b), &cfg);
+}
+static void do_blob(void){
+    uint8_t b[512];
+    sink += (unsigned)auth_build_canonical_blob(b, sizeof(b), cfg.goID, cfg.gocbRef, cfg.appId,
+                                                1, 42, ds, ds_len);
+}
+static void do_hmac(void){
+    uint8_t mac[32];
+    hmac_sha256(okm, sizeof(okm), blob, blob_len, mac);
+    sink += mac[0];
+}
+static void do_extract(void){
+    uint8_t k[32];
+    hkdf_sha256_extract(NULL, 0, k_device, sizeof(k_device), k, sizeof(k));
+    sink += k[0];
+}
+static void do_expand(void){
+    uint8_t k[32];
+    hkdf_sha256_expand(prk, sizeof(prk), (const uint8_t*)INFO, strlen(INFO), k, sizeof(k));
+    sink += k[0];
+}
+
+static int cmp_dbl(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+//Median of RUNS timed runs, each sized to take about RUN_NS
+static void run(const char* func, const char* variant, void (*fn)(void)){
+    unsigned long n = 64;
+    for (;;) {
+        uint64_t t0 = now_ns();
+        for (unsigned long i=0;i<n;i++) fn();
+        if (now_ns() - t0 >= RUN_NS / 4 || n >= (1ul << 28)) break;
+        n *= 2;
+    }
+    n *= 4;
+
+    double ns[RUNS], cyc[RUNS], al[RUNS], sorted[RUNS];
+    for (int r=0;r<RUNS;r++) {
+        unsigned long a0 = n_alloc;
+        uint64_t t0 = now_ns(), c0 = ticks();
+        for (unsigned long i=0;i<n;i++) fn();
+        uint64_t c1 = ticks(), t1 = now_ns();
+        ns[r]  = (double)(t1 - t0) / n;
+        cyc[r] = (double)(c1 - c0) / n;
+        al[r]  = (double)(n_alloc - a0) / n;
+        sorted[r] = ns[r];
+    }
+    qsort(sorted, RUNS, sizeof(double), cmp_dbl);
+    int m = 0;
+    while (ns[m] != sorted[RUNS/2]) m++;
+
+    if (nrows == MAX_ROWS) return;
+    Row* R = &rows[nrows++];
+    snprintf(R->func, sizeof(R->func), "%s", func);
+    snprintf(R->variant, sizeof(R->variant), "%s", variant);
+    R->ns = ns[m]; R->cyc = cyc[m]; R->allocs = ALLOCS_COUNTED ? al[m] : -1; R->ops = n;
+    printf("%-30s %-8s %9.1f ns/op %9.1f cycles/op %6.2f allocs/op\n",
+           func, variant, R->ns, R->cyc, R->allocs);
+}
+
+static int write_csv(const char* path){
+    FILE* f = fopen(path, "w");
+    if (!f) { perror(path); return -1; }
+    fprintf(f, "component,func,variant,ops,ns_op,cycles_op,allocs_op\n");
+    for (int i=0;i<nrows;i++)
+        fprintf(f, "publisher,%s,%s,%lu,%.2f,%.2f,%.3f\n", rows[i].func, rows[i].variant,
+                rows[i].ops, rows[i].ns, rows[i].cyc, rows[i].allocs);
+    fclose(f);
+    return 0;
+}
+
+static int compare_csv(const char* path){
+    FILE* f = fopen(path, "r");
+    if (!f) { perror(path); return -1; }
+    char line[256], comp[32], func[40], variant[32];
+    unsigned long ops; double ns, cyc, al;
+    printf("\nAgainst %s (ns/op, allocs/op):\n", path);
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%31[^,],%39[^,],%31[^,],%lu,%lf,%lf,%lf",
+                   comp, func, variant, &ops, &ns, &cyc, &al) != 7) continue;
+        for (int i=0;i<nrows;i++) {
+            const Row* R = &rows[i];
+            if (strcmp(R->func, func) || strcmp(R->variant, variant)) continue;
+            printf("%-30s %-8s %9.1f -> %9.1f (%+6.1f%%) %6.2f -> %6.2f\n", func, variant,
+                   ns, R->ns, ns > 0 ? 100.0 * (R->ns - ns) / ns : 0.0, al, R->allocs);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char** argv){
+    const char* csv = NULL; const char* base = NULL;
+    int c;
+    while ((c = getopt(argc, argv, "o:b:")) != -1) {
+        if (c == 'o') csv = optarg;
+        else if (c == 'b') base = optarg;
+        else { fprintf(stderr, "Usage: %s [-o results.csv] [-b baseline.csv]\n", argv[0]); return 1; }
+    }
+
+    for (int i=0;i<32;i++) k_device[i]=(uint8_t)(0xA5 ^ i);
+    hkdf_sha256_extract(NULL,0,k_device,sizeof(k_device),prk,sizeof(prk));
+    hkdf_sha256_expand(prk,sizeof(prk),(const uint8_t*)INFO,strlen(INFO),okm,sizeof(okm));
+
+    printf("Publisher canonicalization and crypto primitives (median of %d runs)\n", RUNS);
+    for (size_t i=0;i<sizeof(ds_sizes)/sizeof(ds_sizes[0]);i++) {
+        char v[16]; snprintf(v, sizeof(v), "ds%d", ds_sizes[i]);
+        set_dataset(ds_sizes[i]);
+        run("auth_dataset_bytes_from_cfg", v, do_dataset);
+        run("auth_build_canonical_blob", v, do_blob);
+        run("hmac_sha256", v, do_hmac);
+    }
+    run("hkdf_sha256_extract", "ikm32", do_extract);
+    run("hkdf_sha256_expand", "okm32", do_expand);
+
+    if (csv && write_csv(csv) != 0) return 1;
+    if (base && compare_csv(base) != 0) return 1;
+    return 0;
+}
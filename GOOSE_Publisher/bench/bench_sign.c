@@ -0,0 +1,163 @@
+/*
+BENCHMARK (not shipped)
+------------------------
+  - Cycles per HMAC tag on the publisher signing path (healthA dataset)
+  - before: HKDF + full canonical blob + one-shot HMAC on every publish
+  - after:  per-frame tail only, cloned from the cached prefix midstate
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//Must match auth_canon.c's PublicationConfigMini
+typedef struct {
+    char  name[64];
+    char  type[16];
+    char  quality[16];
+    bool  bool_val;
+    int   int_val;
+} DataFieldMini;
+
+typedef struct {
+    uint16_t appId;
+    char     gocbRef[128];
+    char     datSet[128];
+    char     goID[128];
+    unsigned char dstMac[6];
+    int      vlanId;
+    int      vlanPriority;
+    int      timeAllowedToLive;
+    int      confRev;
+    bool     ndsCom;
+    bool     test;
+    int      heartbeat_ms;
+    int      dataset_count;
+    DataFieldMini dataset[32];
+} PublicationConfigMini;
+
+void hkdf_sha256_extract(const uint8_t *salt, size_t salt_len,
+                         const uint8_t *ikm, size_t ikm_len,
+                         uint8_t *prk, size_t prk_len);
+void hkdf_sha256_expand(const uint8_t *prk, size_t prk_len,
+                        const uint8_t *info, size_t info_len,
+                        uint8_t *okm, size_t okm_len);
+void hmac_sha256(const uint8_t *key, size_t key_len,
+                 const uint8_t *data, size_t data_len,
+                 uint8_t *out32);
+void* hmac_sha256_prefix_new(const uint8_t *key, size_t key_len,
+                             const uint8_t *prefix, size_t prefix_len);
+void  hmac_sha256_prefix_mac(const void *pre,
+                             const uint8_t *data, size_t data_len,
+                             uint8_t *out32);
+size_t auth_build_canonical_blob(uint8_t *buf, size_t buf_max,
+                                 const char* goID, const char* gocbRef, uint16_t appId,
+                                 uint32_t stNum, uint32_t sqNum,
+                                 const void* dataset_bytes, size_t dataset_len);
+size_t auth_build_canonical_prefix(uint8_t *buf, size_t buf_max,
+                                   const char* goID, const char* gocbRef, uint16_t appId);
+size_t auth_build_canonical_tail(uint8_t *buf, size_t buf_max,
+                                 uint32_t stNum, uint32_t sqNum,
+                                 const void* dataset_bytes, size_t dataset_len);
+size_t auth_dataset_bytes_from_cfg(uint8_t *buf, size_t buf_max, const void* cfg);
+
+#define ITERS 200000
+
+static const char* INFO = "GOOSE|IEDA/LLN0$GO$healthA|IEDA/LLN0$GO$healthA|1000";
+
+static PublicationConfigMini cfg;
+static uint8_t k_device[32];
+static uint8_t okm[32];
+static void*   mac_pre;
+static volatile unsigned sink;
+
+static inline uint64_t ticks(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+static inline uint64_t now_ns(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//Previous auth_make_hmac_tag() body
+static void sign_before(uint32_t sq){
+    uint8_t ds[1024]; size_t ds_len = auth_dataset_bytes_from_cfg(ds,sizeof(ds),&cfg);
+    uint8_t canon[2048];
+    size_t cn = auth_build_canonical_blob(canon,sizeof(canon),cfg.goID,cfg.gocbRef,cfg.appId,1,sq,ds,ds_len);
+    uint8_t prk[32]={0}, k[32], mac[32];
+    hkdf_sha256_extract(NULL,0,k_device,sizeof(k_device),prk,sizeof(prk));
+    hkdf_sha256_expand(prk,sizeof(prk),(const uint8_t*)INFO,strlen(INFO),k,sizeof(k));
+    hmac_sha256(k,sizeof(k),canon,cn,mac);
+    sink += mac[0];
+}
+
+//Cached OKM, still one-shot over the full blob
+static void sign_oneshot(uint32_t sq){
+    uint8_t ds[1024]; size_t ds_len = auth_dataset_bytes_from_cfg(ds,sizeof(ds),&cfg);
+    uint8_t canon[2048], mac[32];
+    size_t cn = auth_build_canonical_blob(canon,sizeof(canon),cfg.goID,cfg.gocbRef,cfg.appId,1,sq,ds,ds_len);
+    hmac_sha256(okm,sizeof(okm),canon,cn,mac);
+    sink += mac[0];
+}
+
+//Current auth_make_hmac_tag() body
+static void sign_midstate(uint32_t sq){
+    uint8_t ds[1024]; size_t ds_len = auth_dataset_bytes_from_cfg(ds,sizeof(ds),&cfg);
+    uint8_t tail[1200], mac[32];
+    size_t tn = auth_build_canonical_tail(tail,sizeof(tail),1,sq,ds,ds_len);
+    hmac_sha256_prefix_mac(mac_pre,tail,tn,mac);
+    sink += mac[0];
+}
+
+static void run(const char* name, void (*fn)(uint32_t)){
+    for (uint32_t i=0;i<ITERS/10;i++) fn(i);
+    uint64_t t0=now_ns(), c0=ticks();
+    for (uint32_t i=0;i<ITERS;i++) fn(i);
+    uint64_t c1=ticks(), t1=now_ns();
+    printf("%-30s %10.1f cycles/op %9.1f ns/op\n", name,
+           (double)(c1-c0)/ITERS, (double)(t1-t0)/ITERS);
+}
+
+int main(void){
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.appId = 1000;
+    snprintf(cfg.goID, sizeof(cfg.goID), "IEDA/LLN0$GO$healthA");
+    snprintf(cfg.gocbRef, sizeof(cfg.gocbRef), "IEDA/LLN0$GO$healthA");
+    cfg.dataset_count = 2;
+    snprintf(cfg.dataset[0].type, sizeof(cfg.dataset[0].type), "boolean"); cfg.dataset[0].bool_val = true;
+    snprintf(cfg.dataset[1].type, sizeof(cfg.dataset[1].type), "integer"); cfg.dataset[1].int_val  = 25;
+
+    for (int i=0;i<32;i++) k_device[i]=(uint8_t)(0xA5 ^ i);
+    uint8_t prk[32]={0};
+    hkdf_sha256_extract(NULL,0,k_device,sizeof(k_device),prk,sizeof(prk));
+    hkdf_sha256_expand(prk,sizeof(prk),(const uint8_t*)INFO,strlen(INFO),okm,sizeof(okm));
+    uint8_t pre[512];
+    size_t pn = auth_build_canonical_prefix(pre,sizeof(pre),cfg.goID,cfg.gocbRef,cfg.appId);
+    mac_pre = hmac_sha256_prefix_new(okm,sizeof(okm),pre,pn);
+
+    //Both paths must produce the same tag
+    uint8_t ds[64], canon[512], tail[256], a[32], b[32];
+    size_t dn = auth_dataset_bytes_from_cfg(ds,sizeof(ds),&cfg);
+    size_t cn = auth_build_canonical_blob(canon,sizeof(canon),cfg.goID,cfg.gocbRef,cfg.appId,7,42,ds,dn);
+    hmac_sha256(okm,sizeof(okm),canon,cn,a);
+    size_t tn = auth_build_canonical_tail(tail,sizeof(tail),7,42,ds,dn);
+    hmac_sha256_prefix_mac(mac_pre,tail,tn,b);
+    if (memcmp(a,b,32) != 0) { fprintf(stderr,"midstate MAC mismatch\n"); return 1; }
+
+    printf("Publisher sign path (%d iterations, blob=%zu B, tail=%zu B)\n", ITERS, cn, tn);
+    run("before: hkdf + one-shot", sign_before);
+    run("before: one-shot (cached okm)", sign_oneshot);
+    run("after:  prefix midstate", sign_midstate);
+    return 0;
+}
@@ -69,18 +69,37 @@ static size_t put_blob(uint8_t *b, size_t m, size_t w, const uint8_t* d, size_t
     b[w++] = 0xF3; b[w++] = (uint8_t)L; memcpy(b+w, d, L); return w+L;
 }
 
-size_t auth_build_canonical_blob(uint8_t *buf, size_t buf_max,
-                                 const char* goID, const char* gocbRef, uint16_t appId,
-                                 uint32_t stNum, uint32_t sqNum,
-                                 const void* dataset_bytes, size_t dataset_len)
+//Constant identity part of the blob; auth_security.c absorbs it into a
+//keyed HMAC state once per stream
+size_t auth_build_canonical_prefix(uint8_t *buf, size_t buf_max,
+                                   const char* goID, const char* gocbRef, uint16_t appId)
 {
     size_t w=0;
     w = put_str(buf,buf_max,w,"GOOSE");
     w = put_str(buf,buf_max,w,goID);
     w = put_str(buf,buf_max,w,gocbRef);
     w = put_u16(buf,buf_max,w,appId);
+    return w;
+}
+
+//Per-frame part of the blob
+size_t auth_build_canonical_tail(uint8_t *buf, size_t buf_max,
+                                 uint32_t stNum, uint32_t sqNum,
+                                 const void* dataset_bytes, size_t dataset_len)
+{
+    size_t w=0;
     w = put_u32(buf,buf_max,w,stNum);
     w = put_u32(buf,buf_max,w,sqNum);
     w = put_blob(buf,buf_max,w,(const uint8_t*)dataset_bytes,dataset_len);
     return w;
 }
+
+size_t auth_build_canonical_blob(uint8_t *buf, size_t buf_max,
+                                 const char* goID, const char* gocbRef, uint16_t appId,
+                                 uint32_t stNum, uint32_t sqNum,
+                                 const void* dataset_bytes, size_t dataset_len)
+{
+    size_t w = auth_build_canonical_prefix(buf,buf_max,goID,gocbRef,appId);
+    w += auth_build_canonical_tail(buf+w,buf_max-w,stNum,sqNum,dataset_bytes,dataset_len);
+    return w;
+}
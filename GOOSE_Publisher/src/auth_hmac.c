@@ -1,7 +1,10 @@
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
 
 void hkdf_sha256_extract(const uint8_t *salt, size_t salt_len,
                          const uint8_t *ikm, size_t ikm_len,
@@ -42,3 +45,52 @@ void hmac_sha256(const uint8_t *key, size_t key_len,
     unsigned int L=0;
     HMAC(EVP_sha256(), key, (int)key_len, data, data_len, out32, &L);
 }
+
+//Keyed HMAC context with any constant message prefix already absorbed,
+//cloned per frame so per-frame work is only the variable tail
+typedef struct {
+    EVP_MAC_CTX *ctx;
+} HmacPrefix;
+
+void* hmac_sha256_prefix_new(const uint8_t *key, size_t key_len,
+                             const uint8_t *prefix, size_t prefix_len)
+{
+    HmacPrefix *H = (HmacPrefix*)calloc(1, sizeof(*H));
+    if (!H) return NULL;
+
+    EVP_MAC *mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+    if (mac) H->ctx = EVP_MAC_CTX_new(mac);
+    EVP_MAC_free(mac);   //the context keeps its own reference
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"SHA256", 0),
+        OSSL_PARAM_construct_end()
+    };
+    if (!H->ctx || !EVP_MAC_init(H->ctx, key, key_len, params) ||
+        (prefix_len && !EVP_MAC_update(H->ctx, prefix, prefix_len))) {
+        EVP_MAC_CTX_free(H->ctx);
+        free(H);
+        return NULL;
+    }
+    return H;
+}
+
+//A zero tag when the clone fails, which never verifies
+void hmac_sha256_prefix_mac(const void *pre,
+                            const uint8_t *data, size_t data_len,
+                            uint8_t *out32)
+{
+    const HmacPrefix *H = (const HmacPrefix*)pre;
+    EVP_MAC_CTX *c = EVP_MAC_CTX_dup(H->ctx);
+    size_t L = 0;
+    if (!c || (data_len && !EVP_MAC_update(c, data, data_len)) ||
+        !EVP_MAC_final(c, out32, &L, 32) || L != 32)
+        memset(out32, 0, 32);
+    EVP_MAC_CTX_free(c);
+}
+
+void hmac_sha256_prefix_free(void *pre)
+{
+    if (!pre) return;
+    EVP_MAC_CTX_free(((HmacPrefix*)pre)->ctx);
+    free(pre);
+}
@@ -19,6 +19,19 @@ typedef struct {
 static HmacConfig g_hmac;
 static bool g_loaded = false;
 
+//Per-stream signing state: OKM and HMAC midstate over the constant
+//canonical prefix, rebuilt only when the stream identity changes
+typedef struct {
+    bool     valid;
+    char     goID[128];
+    char     gocbRef[128];
+    uint16_t appId;
+    uint8_t  okm[32];
+    void    *mac_pre;
+} SignCache;
+
+static SignCache g_sign;
+
 static bool hex2bin(const char* hex, uint8_t* out, size_t outlen) {
     size_t L = strlen(hex);
     if (L != outlen*2) return false;
@@ -65,13 +78,17 @@ void hkdf_sha256_extract(const uint8_t *salt, size_t salt_len,
 void hkdf_sha256_expand(const uint8_t *prk, size_t prk_len,
                         const uint8_t *info, size_t info_len,
                         uint8_t *okm, size_t okm_len);
-void hmac_sha256(const uint8_t *key, size_t key_len,
-                 const uint8_t *data, size_t data_len,
-                 uint8_t *out32);
+void* hmac_sha256_prefix_new(const uint8_t *key, size_t key_len,
+                             const uint8_t *prefix, size_t prefix_len);
+void  hmac_sha256_prefix_mac(const void *pre,
+                             const uint8_t *data, size_t data_len,
+                             uint8_t *out32);
+void  hmac_sha256_prefix_free(void *pre);
 
 //Canon blob + dataset bytes
-size_t auth_build_canonical_blob(uint8_t *buf, size_t buf_max,
-                                 const char* goID, const char* gocbRef, uint16_t appId,
+size_t auth_build_canonical_prefix(uint8_t *buf, size_t buf_max,
+                                   const char* goID, const char* gocbRef, uint16_t appId);
+size_t auth_build_canonical_tail(uint8_t *buf, size_t buf_max,
                                  uint32_t stNum, uint32_t sqNum,
                                  const void* dataset_bytes, size_t dataset_len);
 size_t auth_dataset_bytes_from_cfg(uint8_t *buf, size_t buf_max, const void* cfg);
@@ -148,6 +165,33 @@ static void auth_load_once(void)
 bool auth_is_enabled(void) { auth_load_once(); return g_hmac.enabled; }
 int  auth_trunc_len(void)  { auth_load_once(); return g_hmac.trunc_bytes; }
 
+static bool sign_cache_get(const char* goID, const char* gocbRef, uint16_t appId)
+{
+    if (g_sign.valid && g_sign.appId == appId &&
+        strcmp(g_sign.goID, goID) == 0 && strcmp(g_sign.gocbRef, gocbRef) == 0)
+        return true;
+
+    hmac_sha256_prefix_free(g_sign.mac_pre);
+    memset(&g_sign, 0, sizeof(g_sign));
+
+    uint8_t prk[32]={0};
+    hkdf_sha256_extract(NULL,0,g_hmac.k_device,sizeof(g_hmac.k_device),prk,sizeof(prk));
+
+    char infoStr[256]; build_info(infoStr,sizeof(infoStr),g_hmac.infoFmt,goID,gocbRef,appId);
+    hkdf_sha256_expand(prk,sizeof(prk),(const uint8_t*)infoStr,strlen(infoStr),g_sign.okm,sizeof(g_sign.okm));
+
+    uint8_t pre[512];
+    size_t pn = auth_build_canonical_prefix(pre,sizeof(pre),goID,gocbRef,appId);
+    g_sign.mac_pre = hmac_sha256_prefix_new(g_sign.okm,sizeof(g_sign.okm),pre,pn);
+    if (!g_sign.mac_pre) return false;
+
+    snprintf(g_sign.goID, sizeof(g_sign.goID), "%s", goID);
+    snprintf(g_sign.gocbRef, sizeof(g_sign.gocbRef), "%s", gocbRef);
+    g_sign.appId = appId;
+    g_sign.valid = true;
+    return true;
+}
+
 size_t auth_make_hmac_tag(uint8_t *out, size_t out_max,
                           const char* goID, const char* gocbRef, uint16_t appId,
                           uint32_t stNum, uint32_t sqNum,
@@ -155,19 +199,13 @@ size_t auth_make_hmac_tag(uint8_t *out, size_t out_max,
 {
     auth_load_once();
     if (!g_hmac.enabled) return 0;
+    if (!sign_cache_get(goID, gocbRef, appId)) return 0;
 
     uint8_t ds[1024]; size_t ds_len = auth_dataset_bytes_from_cfg(ds,sizeof(ds),cfg_ptr);
-    uint8_t canon[2048];
-    size_t cn = auth_build_canonical_blob(canon,sizeof(canon),
-                                          goID,gocbRef,appId,stNum,sqNum,ds,ds_len);
-
-    uint8_t prk[32]={0};
-    hkdf_sha256_extract(NULL,0,g_hmac.k_device,sizeof(g_hmac.k_device),prk,sizeof(prk));
-
-    char infoStr[256]; build_info(infoStr,sizeof(infoStr),g_hmac.infoFmt,goID,gocbRef,appId);
-    uint8_t okm[32]; hkdf_sha256_expand(prk,sizeof(prk),(const uint8_t*)infoStr,strlen(infoStr),okm,sizeof(okm));
+    uint8_t tail[1200];
+    size_t tn = auth_build_canonical_tail(tail,sizeof(tail),stNum,sqNum,ds,ds_len);
 
-    uint8_t mac[32]; hmac_sha256(okm,sizeof(okm),canon,cn,mac);
+    uint8_t mac[32]; hmac_sha256_prefix_mac(g_sign.mac_pre,tail,tn,mac);
 
     size_t L = (g_hmac.trunc_bytes>0 && g_hmac.trunc_bytes<=32) ? (size_t)g_hmac.trunc_bytes : 16;
     if (L > out_max) L = out_max;